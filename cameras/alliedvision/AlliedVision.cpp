@@ -1,5 +1,13 @@
 #include <VimbaCPP/Include/VimbaCPP.h>
 
+#include "PixelFormatConversion.h"
+#include "ImageEncoder.h"
+#include "SyntheticImages.h"
+#include "FrameBufferArena.h"
+#include "MpmcRing.h"
+#include "ChangeGate.h"
+#include "RawRecorder.h"
+
 #include <messaging/claim/PostOffice.h>
 #include <messaging/claim/AttributeMessage.h>
 
@@ -8,18 +16,26 @@
 
 #include "../../lib/system_clock_time_point_string_conversion/system_clock_time_point_string_conversion.h"
 
+#include "../../common/ThreadPlacement.h"
+
 #include "../../lib/tuc/include/tuc/string.hpp"
 #include "../../lib/tuc/include/tuc/to_string.hpp"
+#include "../../lib/nlohmann_json/single_include/nlohmann/json.hpp"
 
-#include "../../lib/shared_buffer/shared_buffer.h"
-
-#include <opencv2/imgcodecs/imgcodecs.hpp>
-#include <opencv2/imgproc/imgproc.hpp> // required at least for Bayer conversion
+#include <opencv2/imgproc/imgproc.hpp> // cv::resize
 
 #include <unordered_map>
+#include <map>
+#include <set>
+#include <functional>
+#include <tuple>
 #include <iomanip>
 #include <deque>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <csignal>
 
 #define CHECK_VIMBA(call) {                                                                \
     const auto result = call;                                                              \
@@ -29,9 +45,10 @@
 }
 
 namespace {
-    bool isRunning = true;
+    std::atomic<bool> isRunning(true); // lock-free, so fine to set in a signal handler too
 }
 
+#ifdef _WIN32
 BOOL WINAPI consoleCtrlHandler(_In_ DWORD dwCtrlType)
 {
     std::string eventDescription;
@@ -54,6 +71,12 @@ BOOL WINAPI consoleCtrlHandler(_In_ DWORD dwCtrlType)
     isRunning = false;
     return TRUE;
 }
+#else
+void signalHandler(int signal)
+{
+    isRunning = false;
+}
+#endif
 
 void LogVimbaVersion(AVT::VmbAPI::VimbaSystem& vimbaSystem)
 {
@@ -66,383 +89,2708 @@ void LogVimbaVersion(AVT::VmbAPI::VimbaSystem& vimbaSystem)
         + std::to_string(versionInfo.patch), "log_vimba_version");
 }
 
-struct ImageEncodingInputItem {
-    cv::Mat rawData;
-    VmbPixelFormatType pixelFormat = static_cast<VmbPixelFormatType>(0);
-    std::chrono::system_clock::time_point timestamp;
-    uint64_t counter = std::numeric_limits<uint64_t>::max();
-};
+// Recycles cv::Mat buffers of the same size and type, so that in steady state
+// frames can be processed without allocating new pixel buffers all the time
+class BufferPool : public std::enable_shared_from_this<BufferPool> {
+public:
+    struct Statistics {
+        size_t highWaterMark = 0; // max number of buffers simultaneously borrowed
+        size_t overflowCount = 0; // number of times a buffer had to be allocated outside the pool
+    };
 
-class FrameObserver : public AVT::VmbAPI::IFrameObserver {
-public: 
-    FrameObserver(AVT::VmbAPI::CameraPtr camera, shared_buffer<ImageEncodingInputItem>& imageEncodingInput)
-        : AVT::VmbAPI::IFrameObserver( camera )
-        , camera(camera)
-        , imageEncodingInput(imageEncodingInput)
-    {
-        CHECK_VIMBA(camera->GetFeatureByName("DeviceTemperature", temperatureFeature));
-        CHECK_VIMBA(camera->GetFeatureByName("ExposureTimeAbs", exposureTimeFeature));
-        CHECK_VIMBA(camera->GetFeatureByName("Gain", gainFeature));
-    }
+    BufferPool(size_t maxBufferCount)
+        : maxBufferCount(maxBufferCount)
+    {}
 
-    void FrameReceived(const AVT::VmbAPI::FramePtr frame) {
-        const auto timestamp = std::chrono::system_clock::now();
-        VmbFrameStatusType frameStatus;
-        const auto res = frame->GetReceiveStatus(frameStatus);
-        if (VmbErrorSuccess == res) {
-            if (VmbFrameStatusComplete == frameStatus) {
-                // Frame receivd successfully
-                VmbUint32_t width = 0, height = 0;
-                VmbUchar_t* data = 0;
-                VmbPixelFormatType pixelFormat = static_cast<VmbPixelFormatType>(0);
-                CHECK_VIMBA(frame->GetWidth(width));
-                CHECK_VIMBA(frame->GetHeight(height));
-                CHECK_VIMBA(frame->GetBuffer(data));
-                CHECK_VIMBA(frame->GetPixelFormat(pixelFormat));
+    // Points mat to a buffer of the requested size and type; the buffer goes back
+    // to the pool when the returned lease (and all copies of it) have been released
+    std::shared_ptr<void> Borrow(int rows, int cols, int type, cv::Mat& mat) {
+        const auto key = std::make_tuple(rows, cols, type);
 
-                ImageEncodingInputItem imageEncodingInputItem;
+        std::unique_lock<std::mutex> lock(mutex);
 
-                const cv::Mat temp(height, width, CV_8UC1, data);
-                temp.copyTo(imageEncodingInputItem.rawData);
+        auto& available = availableBuffers[key];
 
-                imageEncodingInputItem.pixelFormat = pixelFormat;
-                imageEncodingInputItem.timestamp = timestamp;
-                imageEncodingInputItem.counter = counter;
+        if (available.empty() && bufferCount >= maxBufferCount) {
+            // The resolution may have changed: make room by dropping buffers of other sizes
+            for (auto& i : availableBuffers) {
+                if (i.first != key && !i.second.empty()) {
+                    i.second.pop_back();
+                    --bufferCount;
+                    break;
+                }
+            }
+        }
 
-                imageEncodingInput.push_back(std::move(imageEncodingInputItem));
+        if (available.empty() && bufferCount >= maxBufferCount) {
+            ++statistics.overflowCount;
+            lock.unlock();
+            mat.create(rows, cols, type);
+            return nullptr;
+        }
 
-                RegisterCompleteFrame();
-            }
-            else if (VmbFrameStatusIncomplete == frameStatus) {
-                RegisterIncompleteFrame();
-            }
-            else if (VmbFrameStatusTooSmall == frameStatus) {
-                numcfc::Logger::LogAndEcho("Frame buffer too small", "log_errors");
-            }
-            else if (VmbFrameStatusInvalid == frameStatus) {
-                numcfc::Logger::LogAndEcho("Frame buffer not valid", "log_errors");
-            }
-            else {
-                numcfc::Logger::LogAndEcho("Unexpected frame status: " + std::to_string(frameStatus), "log_errors");
-            }
+        cv::Mat buffer;
+        if (!available.empty()) {
+            buffer = std::move(available.back());
+            available.pop_back();
         }
         else {
-            numcfc::Logger::LogAndEcho("Error getting receive status: " + std::to_string(res), "log_errors");
+            ++bufferCount;
         }
 
-        ++counter;
+        statistics.highWaterMark = std::max(statistics.highWaterMark, ++borrowedCount);
 
-        camera->QueueFrame(frame);
-    }
+        lock.unlock();
 
-    std::pair<size_t, size_t> GetAndResetFramesReceived() {
-        return std::make_pair(
-            completeFramesReceived.exchange(0),
-            incompleteFramesReceived.exchange(0)
-        );
-    }
+        if (buffer.empty()) {
+            buffer.create(rows, cols, type);
+        }
 
-    double GetCameraTemperature() {
-        return GetFeature(temperatureFeature);
-    }
+        mat = buffer;
 
-    double GetCameraExposureTime() {
-        return GetFeature(exposureTimeFeature);
+        const auto self = shared_from_this();
+        return std::shared_ptr<void>(nullptr, [self, key, buffer](void*) {
+            self->Return(key, buffer);
+        });
     }
 
-    double GetCameraGain() {
-        return GetFeature(gainFeature);
+    Statistics GetAndResetStatistics() {
+        std::lock_guard<std::mutex> lock(mutex);
+        const Statistics result = statistics;
+        statistics = Statistics();
+        statistics.highWaterMark = borrowedCount;
+        return result;
     }
 
 private:
-    void RegisterCompleteFrame() {
-        if (!firstCompleteFrameReceived) {
-            firstCompleteFrameReceived = true;
-            numcfc::Logger::LogAndEcho("First frame received", "log_init");
-        }
+    typedef std::tuple<int, int, int> Key; // rows, cols, type
 
-        ++completeFramesReceived;
+    void Return(const Key& key, const cv::Mat& buffer) {
+        std::lock_guard<std::mutex> lock(mutex);
+        availableBuffers[key].push_back(buffer);
+        --borrowedCount;
     }
 
-    void RegisterIncompleteFrame() {
-        if (!firstCompleteFrameReceived) {
-            firstCompleteFrameReceived = true;
-            numcfc::Logger::LogAndEcho("First incomplete frame received", "log_incomplete_frames");
-        }
+    const size_t maxBufferCount;
+    std::mutex mutex;
+    std::map<Key, std::vector<cv::Mat>> availableBuffers;
+    size_t bufferCount = 0;
+    size_t borrowedCount = 0;
+    Statistics statistics;
+};
 
-        ++incompleteFramesReceived;
-    }
+// Makes sure that the images of each camera are sent in increasing counter order, even
+// though they are encoded in parallel: an encoded image is held back while an older image
+// of the same camera is still being encoded. An image is held for at most maxHoldTime,
+// though; any older image that becomes ready after that is discarded instead of sent.
+class ImageReorderer {
+    struct CameraState;
+
+public:
+    // Reserves a place in the sending order for an image. If the ticket is released
+    // without calling Send, the image is considered skipped (e.g., dropped from a queue).
+    class Ticket {
+    public:
+        Ticket(ImageReorderer& reorderer, const std::shared_ptr<CameraState>& cameraState, uint64_t counter)
+            : reorderer(reorderer), cameraState(cameraState), counter(counter)
+        {}
+
+        ~Ticket() {
+            if (!used) {
+                reorderer.Skip(*this);
+            }
+        }
 
-    double GetFeature(const AVT::VmbAPI::FeaturePtr& feature) {
-        double value = std::numeric_limits<double>::quiet_NaN();
-        CHECK_VIMBA(feature->GetValue(value));
-        return value;
-    }
+    private:
+        friend class ImageReorderer;
+        ImageReorderer& reorderer;
+        const std::shared_ptr<CameraState> cameraState;
+        const uint64_t counter;
+        bool used = false;
+    };
 
-    AVT::VmbAPI::CameraPtr camera;
-    shared_buffer<ImageEncodingInputItem>& imageEncodingInput;
-    uint64_t counter = 0;
-    bool firstCompleteFrameReceived = false;
-    bool firstIncompleteFrameReceived = false;
-    std::atomic<uintmax_t> completeFramesReceived = 0;
-    std::atomic<uintmax_t> incompleteFramesReceived = 0;
-    AVT::VmbAPI::FeaturePtr temperatureFeature;
-    AVT::VmbAPI::FeaturePtr exposureTimeFeature;
-    AVT::VmbAPI::FeaturePtr gainFeature;
-};
+    // The trace origin given to Send is passed on to sendMessage, to complete the latency trace with
+    ImageReorderer(std::chrono::milliseconds maxHoldTime, std::function<void(claim::AttributeMessage&, std::chrono::steady_clock::time_point traceOrigin)> sendMessage)
+        : maxHoldTime(maxHoldTime)
+        , sendMessage(sendMessage)
+    {}
 
-void Log(const std::string& id, FrameObserver* frameObserver, size_t totalCount, bool logTemperature, bool logExposureTime, bool logGain)
-{
-    std::ostringstream logEntry;
+    // Returns nullptr if reordering is disabled
+    std::shared_ptr<Ticket> Reserve(size_t cameraIndex, uint64_t counter) {
+        if (maxHoldTime.count() <= 0) {
+            return nullptr;
+        }
 
-    if (totalCount > 1) {
-        logEntry << id << ": ";
+        const auto cameraState = GetCameraState(cameraIndex);
+        {
+            std::lock_guard<std::mutex> lock(cameraState->mutex);
+            cameraState->pending.insert(counter);
+        }
+        return std::make_shared<Ticket>(*this, cameraState, counter);
     }
 
-    bool firstItemLogged = false;
+    // Sends the messages of an image (e.g., the full-size image and its preview) as soon as
+    // all older images of the same camera have been sent or skipped
+    void Send(const std::shared_ptr<Ticket>& ticket, std::vector<claim::AttributeMessage>&& messages, std::chrono::steady_clock::time_point traceOrigin) {
+        if (!ticket) {
+            for (auto& message : messages) {
+                sendMessage(message, traceOrigin);
+            }
+            return;
+        }
 
-    const auto addCommaIfRequired = [&]() {
-        if (firstItemLogged) {
-            logEntry << ", ";
+        CameraState& cameraState = *ticket->cameraState;
+        std::lock_guard<std::mutex> lock(cameraState.mutex);
+
+        ticket->used = true;
+        cameraState.pending.erase(ticket->counter);
+
+        if (cameraState.anythingSent && ticket->counter <= cameraState.lastSentCounter) {
+            ++cameraState.lateCount; // a newer image has already been sent
         }
         else {
-            firstItemLogged = true;
+            HeldMessage& heldMessage = cameraState.held[ticket->counter];
+            heldMessage.messages = std::move(messages);
+            heldMessage.traceOrigin = traceOrigin;
+            heldMessage.heldSince = std::chrono::steady_clock::now();
         }
-    };
 
-    if (logTemperature) {
-        addCommaIfRequired(); // actually never required - but why not make this look similar to the other items
-        logEntry << "temp: " << std::fixed << std::setprecision(2) << frameObserver->GetCameraTemperature();
+        Flush(cameraState);
     }
 
-    if (logExposureTime) {
-        addCommaIfRequired();
-        logEntry << "exp t: " << std::fixed << std::setprecision(0) << frameObserver->GetCameraExposureTime();
+    // Sends any messages that have been held for too long; should be called every now and then
+    void SendExpired() {
+        std::vector<std::shared_ptr<CameraState>> cameraStates;
+        {
+            std::lock_guard<std::mutex> lock(cameraStatesMutex);
+            for (const auto& i : this->cameraStates) {
+                cameraStates.push_back(i.second);
+            }
+        }
+
+        for (const auto& cameraState : cameraStates) {
+            std::lock_guard<std::mutex> lock(cameraState->mutex);
+            Flush(*cameraState);
+        }
     }
 
-    if (logGain) {
-        addCommaIfRequired();
-        logEntry << "gain: " << std::fixed << std::setprecision(0) << frameObserver->GetCameraGain();
+    // Returns the number of images discarded because they would have been sent out of order
+    size_t GetAndResetLateCount(size_t cameraIndex) {
+        const auto cameraState = GetCameraState(cameraIndex);
+        std::lock_guard<std::mutex> lock(cameraState->mutex);
+        const size_t lateCount = cameraState->lateCount;
+        cameraState->lateCount = 0;
+        return lateCount;
     }
 
-    const auto frames = frameObserver->GetAndResetFramesReceived();
+private:
+    struct HeldMessage {
+        std::vector<claim::AttributeMessage> messages;
+        std::chrono::steady_clock::time_point traceOrigin;
+        std::chrono::steady_clock::time_point heldSince;
+    };
 
-    addCommaIfRequired();
+    struct CameraState {
+        std::mutex mutex;
+        std::set<uint64_t> pending;              // images reserved, but not yet sent or skipped
+        std::map<uint64_t, HeldMessage> held;    // images ready, but waiting for some older ones
+        uint64_t lastSentCounter = 0;
+        bool anythingSent = false;
+        size_t lateCount = 0;
+    };
 
-    std::ostringstream oss;
-    oss << "fps: " << frames.first;
-    if (frames.second) {
-        oss << ", incomplete: " << frames.second;
-        numcfc::Logger::LogNoEcho((totalCount > 1 ? (id + ": ") : "") + oss.str(), "log_incomplete_frames");
+    std::shared_ptr<CameraState> GetCameraState(size_t cameraIndex) {
+        std::lock_guard<std::mutex> lock(cameraStatesMutex);
+        auto& cameraState = cameraStates[cameraIndex];
+        if (!cameraState) {
+            cameraState = std::make_shared<CameraState>();
+        }
+        return cameraState;
     }
-    logEntry << oss.str();
 
-    numcfc::Logger::LogAndEcho(logEntry.str());
-}
+    void Skip(Ticket& ticket) {
+        CameraState& cameraState = *ticket.cameraState;
+        std::lock_guard<std::mutex> lock(cameraState.mutex);
+        cameraState.pending.erase(ticket.counter);
+        Flush(cameraState);
+    }
 
-int main(int argc, char* argv[])
-{
-    if (!SetConsoleCtrlHandler(consoleCtrlHandler, TRUE)) {
-        std::cerr << "Error calling SetConsoleCtrlHandler" << std::endl;
+    // Sends, in order, everything that no longer needs to be held. Called with the camera's
+    // mutex locked, which is what keeps concurrent senders from getting out of order.
+    void Flush(CameraState& cameraState) {
+        const auto now = std::chrono::steady_clock::now();
+
+        // If some message has been held for too long, then it goes out now, and so do all older ones
+        bool anyExpired = false;
+        uint64_t expiredUpTo = 0;
+        for (const auto& i : cameraState.held) {
+            if (now - i.second.heldSince >= maxHoldTime) {
+                anyExpired = true;
+                expiredUpTo = i.first;
+            }
+        }
+
+        while (!cameraState.held.empty()) {
+            const auto oldest = cameraState.held.begin();
+            const uint64_t counter = oldest->first;
+            const bool isOldest = cameraState.pending.empty() || counter < *cameraState.pending.begin();
+            if (!isOldest && !(anyExpired && counter <= expiredUpTo)) {
+                break;
+            }
+            for (auto& message : oldest->second.messages) {
+                sendMessage(message, oldest->second.traceOrigin);
+            }
+            cameraState.lastSentCounter = counter;
+            cameraState.anythingSent = true;
+            cameraState.held.erase(oldest);
+        }
     }
 
-    while (isRunning) {
-        try {
-            numcfc::IniFile iniFile("AlliedVision.ini");
+    const std::chrono::milliseconds maxHoldTime;
+    const std::function<void(claim::AttributeMessage&, std::chrono::steady_clock::time_point)> sendMessage;
 
-            claim::PostOffice postOffice;
+    std::mutex cameraStatesMutex;
+    std::unordered_map<size_t, std::shared_ptr<CameraState>> cameraStates;
+};
 
-            postOffice.Initialize(iniFile, "AV");
+// Returns the given percentile (0...1) of the values, which get reordered; 0 if there are no values
+double GetPercentile(std::vector<double>& values, double percentile)
+{
+    if (values.empty()) {
+        return 0;
+    }
+    const size_t index = std::min(values.size() - 1, static_cast<size_t>(percentile * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
 
-            const std::string imageFormat = iniFile.GetSetValue("ImageEncoding", "ImageFormat", "jpg");
-            const bool isJpeg = tuc::string::equal_case_insensitive(imageFormat, "jpg") || tuc::string::equal_case_insensitive(imageFormat, "jpeg");
+// The per-camera measurements of the Metrics message that are not kept elsewhere: the
+// Vimba callback reports the frames, and the encoding threads the processing times.
+class CameraMetrics {
+public:
+    // Called for each frame received, complete or not
+    void AddFrameId(VmbUint64_t frameId) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (anyFrameIdReceived && frameId > lastFrameId + 1) {
+            ++frameIdGapCount;
+            missingFrameIdCount += frameId - lastFrameId - 1;
+        }
+        lastFrameId = frameId;
+        anyFrameIdReceived = true;
+    }
 
-            const double jpegCompressionQuality = isJpeg
-                ? iniFile.GetSetValue("ImageEncoding", "JpegCompressionQuality", 90)
-                : std::numeric_limits<double>::quiet_NaN();
+    // Called for each complete frame
+    void AddFrameTimestamp(std::chrono::system_clock::time_point timestamp) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (anyTimestampReceived) {
+            const double interval_ms = std::chrono::duration<double, std::milli>(timestamp - lastTimestamp).count();
+            size_t bin = 0;
+            while (bin < intervalHistogramUpperBounds_ms.size() && interval_ms >= intervalHistogramUpperBounds_ms[bin]) {
+                ++bin;
+            }
+            ++intervalHistogram[bin];
+        }
+        lastTimestamp = timestamp;
+        anyTimestampReceived = true;
+    }
 
-            const auto defaultImageEncodingThreadCount = std::max(2u, std::thread::hardware_concurrency()) - 1;
-            const size_t imageEncodingThreadCount = static_cast<size_t>(iniFile.GetSetValue("ImageEncoding", "ThreadCount", defaultImageEncodingThreadCount));
+    // Called by the encoding threads for each image encoded
+    void AddImage(size_t encodedByteCount, double conversionTime_ms, double encodeTime_ms) {
+        std::lock_guard<std::mutex> lock(mutex);
+        encodedBytes += encodedByteCount;
+        conversionTimes_ms.push_back(conversionTime_ms);
+        encodeTimes_ms.push_back(encodeTime_ms);
+    }
 
-            const size_t totalFrameBufferCount = static_cast<size_t>(iniFile.GetSetValue("FrameBuffers", "TotalCount", 100));
+    void GetAndReset(nlohmann::json& metrics, double elapsed_s) {
+        std::lock_guard<std::mutex> lock(mutex);
 
-            const double noImagesTimeout_s = iniFile.GetSetValue("Operation", "NoImagesTimeout_s", 10.0);
+        metrics["frameIdGaps"] = frameIdGapCount;
+        metrics["missingFrameIds"] = missingFrameIdCount;
+        metrics["encodedBytesPerSecond"] = elapsed_s > 0 ? encodedBytes / elapsed_s : 0.0;
 
-            const bool logTemperature =  iniFile.GetSetValue("Logging", "LogTemperature",  1.0) > 0.0;
-            const bool logExposureTime = iniFile.GetSetValue("Logging", "LogExposureTime", 1.0) > 0.0;
-            const bool logGain =         iniFile.GetSetValue("Logging", "LogGain",         1.0) > 0.0;
+        auto& histogram = metrics["interFrameInterval_ms"];
+        for (size_t bin = 0; bin < intervalHistogram.size(); ++bin) {
+            const std::string lowerBound = bin > 0 ? std::to_string(intervalHistogramUpperBounds_ms[bin - 1]) : "0";
+            const std::string upperBound = bin < intervalHistogramUpperBounds_ms.size() ? std::to_string(intervalHistogramUpperBounds_ms[bin]) : "inf";
+            histogram[lowerBound + "-" + upperBound] = intervalHistogram[bin];
+        }
 
-            if (iniFile.IsDirty()) {
-                iniFile.Save();
-            }
+        const auto addPercentiles = [](nlohmann::json& json, std::vector<double>& values) {
+            json["count"] = values.size();
+            json["p50"] = GetPercentile(values, 0.50);
+            json["p95"] = GetPercentile(values, 0.95);
+            json["p99"] = GetPercentile(values, 0.99);
+            json["max"] = GetPercentile(values, 1.00);
+        };
+
+        addPercentiles(metrics["conversionTime_ms"], conversionTimes_ms);
+        addPercentiles(metrics["encodeTime_ms"], encodeTimes_ms);
+
+        frameIdGapCount = 0;
+        missingFrameIdCount = 0;
+        encodedBytes = 0;
+        std::fill(intervalHistogram.begin(), intervalHistogram.end(), 0);
+        conversionTimes_ms.clear();
+        encodeTimes_ms.clear();
+    }
 
-            using namespace AVT::VmbAPI;
+private:
+    const std::vector<int> intervalHistogramUpperBounds_ms = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000 };
+
+    std::mutex mutex;
+    bool anyFrameIdReceived = false;
+    VmbUint64_t lastFrameId = 0;
+    size_t frameIdGapCount = 0;
+    uint64_t missingFrameIdCount = 0;
+    bool anyTimestampReceived = false;
+    std::chrono::system_clock::time_point lastTimestamp;
+    std::vector<size_t> intervalHistogram = std::vector<size_t>(intervalHistogramUpperBounds_ms.size() + 1);
+    uint64_t encodedBytes = 0;
+    std::vector<double> conversionTimes_ms;
+    std::vector<double> encodeTimes_ms;
+};
 
-            auto& vimbaSystem = VimbaSystem::GetInstance();
+// Maps the timestamps of a camera's frames to host (system clock) time. Every now and then, the
+// camera's timestamp counter is latched, and the value is paired with the host time at that moment;
+// a line fitted to the recent pairs then gives both the offset and the drift between the clocks.
+class CameraClock {
+public:
+    CameraClock(AVT::VmbAPI::CameraPtr camera)
+        : camera(camera)
+    {
+        // GigE cameras, and the SFNC names used e.g. by USB cameras
+        if (camera->GetFeatureByName("GevTimestampControlLatch", latchFeature) == VmbErrorSuccess) {
+            camera->GetFeatureByName("GevTimestampValue", valueFeature);
+        }
+        else if (camera->GetFeatureByName("TimestampLatch", latchFeature) == VmbErrorSuccess) {
+            camera->GetFeatureByName("TimestampLatchValue", valueFeature);
+        }
+
+        AVT::VmbAPI::FeaturePtr tickFrequencyFeature;
+        VmbInt64_t tickFrequency = 0;
+        if (camera->GetFeatureByName("GevTimestampTickFrequency", tickFrequencyFeature) == VmbErrorSuccess
+            && tickFrequencyFeature->GetValue(tickFrequency) == VmbErrorSuccess
+            && tickFrequency > 0) {
+            ticksPerSecond = static_cast<double>(tickFrequency);
+        }
+    }
 
-            LogVimbaVersion(vimbaSystem);
+    bool IsAvailable() const {
+        return latchFeature && valueFeature;
+    }
 
-            numcfc::Logger::LogAndEcho("Starting Vimba system...", "log_init");
+    // Latches the camera's timestamp counter; should be called every now and then (say, once per second)
+    void Sample() {
+        if (!IsAvailable()) {
+            return;
+        }
 
-            CHECK_VIMBA(vimbaSystem.Startup());
+        const auto before = std::chrono::system_clock::now();
+        if (latchFeature->RunCommand() != VmbErrorSuccess) {
+            return;
+        }
+        const auto after = std::chrono::system_clock::now();
 
-            shared_buffer<ImageEncodingInputItem> imageEncodingInput;
+        VmbInt64_t ticks = 0;
+        if (valueFeature->GetValue(ticks) != VmbErrorSuccess) {
+            return;
+        }
 
-            auto imageLastReceived = std::chrono::steady_clock::now();
-            std::mutex imageLastReceivedMutex;
+        const auto host = before + (after - before) / 2;
 
-            const auto encodeImages = [&]() {
+        std::lock_guard<std::mutex> lock(mutex);
 
-                std::vector<uchar> encodingBuffer;
-                cv::Mat image;
+        if (!samples.empty() && ticks <= samples.back().first) {
+            samples.clear(); // the camera has been reset
+        }
 
-                while (imageEncodingInput.is_enabled()) {
-                    ImageEncodingInputItem item;
-                    if (imageEncodingInput.pop_front(item, std::chrono::milliseconds(1000))) {
-                        switch (item.pixelFormat) {
-                            case VmbPixelFormatMono8:
-                            {
-                                image = item.rawData;
-                                break;
-                            }
-                            case VmbPixelFormatBayerRG8:
-                            {
-                                cv::cvtColor(item.rawData, image, cv::COLOR_BayerBG2BGR);
-                                break;
-                            }
-                            default:
-                            {
-                                numcfc::Logger::LogAndEcho("Unsupported pixel format: " + std::to_string(item.pixelFormat), "log_errors");
-                                image = item.rawData;
-                            }
-                        }
+        samples.emplace_back(ticks, host);
+        while (samples.size() > maxSampleCount) {
+            samples.pop_front();
+        }
 
-                        std::vector<int> encodingParameters;
-                        if (!std::isnan(jpegCompressionQuality)) {
-                            encodingParameters.push_back(cv::IMWRITE_JPEG_QUALITY);
-                            encodingParameters.push_back(static_cast<int>(std::round(jpegCompressionQuality)));
-                        }
+        Fit();
+    }
 
-                        cv::imencode("." + imageFormat, image, encodingBuffer, encodingParameters);
+    // Returns false if the clocks have not been paired yet
+    bool ToHostTime(VmbUint64_t ticks, std::chrono::system_clock::time_point& hostTime) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!fitted) {
+            return false;
+        }
+        const double x = (static_cast<double>(ticks) - static_cast<double>(referenceTicks)) / ticksPerSecond;
+        const double y = intercept_s + slope * x;
+        hostTime = referenceHostTime + std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::duration<double>(y));
+        return true;
+    }
 
-                        const std::string timestamp = system_clock_time_point_string_conversion::to_string(item.timestamp);
+    // How much faster (> 0) or slower the host clock runs, in parts per million
+    double GetDrift_ppm() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return fitted ? (slope - 1.0) * 1e6 : std::numeric_limits<double>::quiet_NaN();
+    }
 
-                        const auto getId = [](const std::string& timestamp, size_t counter, const std::string& imageFormat) {
-                            std::string id = timestamp;
-                            std::replace(id.begin(), id.end(), ':', '.');
-                            std::ostringstream oss;
-                            oss << std::hex << std::setw(16) << std::setfill('0') << counter;
-                            id += "_" + oss.str() + "." + imageFormat;
-                            return id;
-                        };
+private:
+    // Least squares, relative to the first sample to keep the precision
+    void Fit() {
+        referenceTicks = samples.front().first;
+        referenceHostTime = samples.front().second;
+
+        if (samples.size() == 1) {
+            slope = 1.0;
+            intercept_s = 0.0;
+            fitted = true;
+            return;
+        }
 
-                        claim::AttributeMessage amsg;
-                        amsg.m_type = "Image";
-                        amsg.m_attributes["id"] = getId(timestamp, item.counter, imageFormat);
-                        amsg.m_attributes["timestamp"] = timestamp;
-                        amsg.m_attributes["counter"] = std::to_string(item.counter);
-                        amsg.m_attributes["rows"] = std::to_string(image.rows);
-                        amsg.m_attributes["cols"] = std::to_string(image.cols);
-                        amsg.m_attributes["data"] = std::string(encodingBuffer.begin(), encodingBuffer.end());
-                        amsg.m_attributes["format"] = imageFormat;
-                        if (!std::isnan(jpegCompressionQuality)) {
-                            amsg.m_attributes["jpegQuality"] = std::to_string(jpegCompressionQuality);
-                        }
-                        postOffice.Send(amsg);
+        double sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+        for (const auto& sample : samples) {
+            const double x = (sample.first - referenceTicks) / ticksPerSecond;
+            const double y = std::chrono::duration<double>(sample.second - referenceHostTime).count();
+            sumX += x;
+            sumY += y;
+            sumXX += x * x;
+            sumXY += x * y;
+        }
+        const double n = static_cast<double>(samples.size());
+        const double denominator = n * sumXX - sumX * sumX;
+        slope = denominator > 0 ? (n * sumXY - sumX * sumY) / denominator : 1.0;
+        intercept_s = (sumY - slope * sumX) / n;
+        fitted = true;
+    }
 
-                        if (noImagesTimeout_s > 0) {
-                            std::lock_guard<std::mutex> lock(imageLastReceivedMutex);
-                            imageLastReceived = std::chrono::steady_clock::now();
-                        }
-                    }
-                }
-            };
+    static const size_t maxSampleCount = 60;
 
-            std::deque<std::thread> imageEncodingThreads;
-            for (size_t i = 0; i < imageEncodingThreadCount; ++i) {
-                imageEncodingThreads.emplace_back(encodeImages);
-            }
+    AVT::VmbAPI::CameraPtr camera;
+    AVT::VmbAPI::FeaturePtr latchFeature;
+    AVT::VmbAPI::FeaturePtr valueFeature;
+    double ticksPerSecond = 1e9; // if the camera does not tell, then assume nanoseconds
+
+    mutable std::mutex mutex;
+    std::deque<std::pair<VmbInt64_t, std::chrono::system_clock::time_point>> samples;
+    bool fitted = false;
+    VmbInt64_t referenceTicks = 0;
+    std::chrono::system_clock::time_point referenceHostTime;
+    double slope = 1.0;
+    double intercept_s = 0.0;
+};
 
-            try {
-                numcfc::Logger::LogAndEcho("Vimba system started.", "log_init");
+struct ImageEncodingInputItem {
+    cv::Mat rawData;
+    std::shared_ptr<void> rawDataOwner; // if set, keeps the memory behind rawData reserved until the item is released
+    std::shared_ptr<BufferPool> bufferPool; // the camera's pool, for any intermediate images
+    VmbPixelFormatType pixelFormat = static_cast<VmbPixelFormatType>(0);
+    std::chrono::system_clock::time_point timestamp; // from the camera clock, if available; otherwise, when received
+    std::chrono::steady_clock::time_point callbackEntered; // the origin of the latency trace
+    double cameraToCallback_us = std::numeric_limits<double>::quiet_NaN(); // from the timestamp to callbackEntered
+    uint64_t counter = std::numeric_limits<uint64_t>::max();
+    size_t cameraIndex = 0;
+    std::shared_ptr<ImageReorderer::Ticket> reorderTicket;
+    std::shared_ptr<const std::vector<cv::Rect>> regionsOfInterest; // in sensor pixels; if empty, the whole image
+    std::shared_ptr<CameraMetrics> metrics;
+};
 
-                CameraPtrVector cameras;
+enum class QueueOverloadPolicy {
+    DropOldest,
+    DropNewest,
+    Block // makes the Vimba callback wait, so that eventually frames start getting lost already in the camera
+};
 
-                CHECK_VIMBA(vimbaSystem.GetCameras(cameras));
+// Queues between the Vimba callbacks and the encoding threads: one lock-free ring per camera,
+// holding at most a maximum number of items per camera that can be waiting to be encoded.
+// Each encoding thread primarily serves its own "home" cameras, and steals work
+// from the other cameras (the most backlogged first) only when those are idle.
+// The Vimba callback takes no lock, unless an encoding thread is waiting to be woken up,
+// or the overload policy is to block.
+class ImageEncodingQueue {
+public:
+    struct Statistics {
+        size_t depth = 0;       // items currently waiting
+        size_t stolenCount = 0; // items encoded by a thread that does not have this camera as a home camera
+    };
 
-                if (cameras.empty()) {
-                    throw std::runtime_error("No cameras found");
+    // What MaxQueueLengthPerCamera = 0 stands for
+    static const size_t defaultMaxItemCountPerCamera = 1000;
+
+    ImageEncodingQueue(size_t maxItemCountPerCamera, QueueOverloadPolicy overloadPolicy, size_t consumerCount)
+        : maxItemCountPerCamera(std::max(static_cast<size_t>(1), maxItemCountPerCamera))
+        , overloadPolicy(overloadPolicy)
+        , consumerCount(std::max(static_cast<size_t>(1), consumerCount))
+        , cameraQueues(std::make_shared<CameraQueues>())
+        , nextHomeCameraIndex(this->consumerCount)
+    {}
+
+    // Returns the number of items dropped because the queue was full (0 or 1)
+    size_t push_back(ImageEncodingInputItem&& item) {
+        CameraQueue& cameraQueue = GetCameraQueue(item.cameraIndex);
+
+        ImageEncodingInputItem droppedItem; // released only on returning, as that may give a frame back to Vimba
+        size_t droppedItemCount = 0;
+
+        // Counted in advance, so that a consumer never sees the counts go below zero
+        ++cameraQueue.depth;
+        ++itemCount;
+
+        while (!cameraQueue.items.TryPush(std::move(item))) {
+            switch (overloadPolicy) {
+            case QueueOverloadPolicy::DropOldest:
+                if (droppedItemCount == 0 && cameraQueue.items.TryPop(droppedItem)) {
+                    --cameraQueue.depth;
+                    --itemCount;
+                    droppedItemCount = 1;
+                }
+                else {
+                    std::this_thread::yield(); // a consumer is in the middle of popping the oldest
+                }
+                break;
+            case QueueOverloadPolicy::DropNewest:
+                --cameraQueue.depth;
+                --itemCount;
+                return 1;
+            case QueueOverloadPolicy::Block:
+                {
+                    std::unique_lock<std::mutex> lock(cameraQueue.mutex);
+                    ++cameraQueue.waitingProducerCount;
+                    cameraQueue.itemPopped.wait_for(lock, std::chrono::milliseconds(10), [&]() { return !enabled || cameraQueue.depth <= maxItemCountPerCamera; });
+                    --cameraQueue.waitingProducerCount;
                 }
+                if (!enabled) {
+                    --cameraQueue.depth;
+                    --itemCount;
+                    return 1;
+                }
+                break;
+            }
+        }
 
-                numcfc::Logger::LogAndEcho("Found " + std::to_string(cameras.size()) + " camera" + (cameras.size() == 1 ? "" : "s") + ":", "log_init");
+        if (waitingConsumerCount > 0) {
+            std::lock_guard<std::mutex> lock(waitMutex);
+            itemPushed.notify_one();
+        }
 
-                for (const auto& camera : cameras) {
-                    std::string model, id;
-                    CHECK_VIMBA(camera->GetModel(model));
-                    CHECK_VIMBA(camera->GetID(id));
-                    numcfc::Logger::LogAndEcho("  " + id + " : " + model, "log_init");
-                }
+        return droppedItemCount;
+    }
 
-                std::unordered_map<std::string, FramePtrVector> frames;
-                std::unordered_map<std::string, std::pair<FrameObserver*, IFrameObserverPtr>> frameObservers;
+    bool pop_front(ImageEncodingInputItem& item, std::chrono::milliseconds timeout, size_t consumerIndex) {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
 
-                for (auto& camera : cameras) {
-                    CHECK_VIMBA(camera->Open(VmbAccessModeFull));
+        while (enabled) {
+            if (TryPop(item, consumerIndex)) {
+                return true;
+            }
 
-                    FeaturePtr feature;
+            std::unique_lock<std::mutex> lock(waitMutex);
+            ++waitingConsumerCount;
+            const bool itemsAvailable = itemPushed.wait_until(lock, deadline, [this]() { return !enabled || itemCount > 0; });
+            --waitingConsumerCount;
 
-                    const auto vimbaParameters = iniFile.GetKeys("VimbaParameters");
-                    for (const auto& parameterName : vimbaParameters) {
-                        const auto value = iniFile.GetValue("VimbaParameters", parameterName);
+            if (!itemsAvailable) {
+                return false;
+            }
+        }
 
-                        numcfc::Logger::LogAndEcho(parameterName + " = " + value, "log_camera_parameters");
+        return false;
+    }
 
-                        CHECK_VIMBA(camera->GetFeatureByName(parameterName.c_str(), feature));
+    Statistics GetAndResetStatistics(size_t cameraIndex) {
+        CameraQueue& cameraQueue = GetCameraQueue(cameraIndex);
+        Statistics statistics;
+        statistics.depth = cameraQueue.depth;
+        statistics.stolenCount = cameraQueue.stolenCount.exchange(0);
+        return statistics;
+    }
 
-                        VmbFeatureDataType dataType = VmbFeatureDataUnknown;
-                        CHECK_VIMBA(feature->GetDataType(dataType));
+    // The number of items waiting for the camera that has the most
+    size_t GetMaxDepth() const {
+        const auto queues = std::atomic_load(&cameraQueues);
+        size_t maxDepth = 0;
+        for (const auto& cameraQueue : *queues) {
+            maxDepth = std::max(maxDepth, static_cast<size_t>(cameraQueue->depth));
+        }
+        return maxDepth;
+    }
 
-                        switch (dataType) {
-                        case VmbFeatureDataInt:    CHECK_VIMBA(feature->SetValue(std::stoi(value))); break;
-                        case VmbFeatureDataFloat:  CHECK_VIMBA(feature->SetValue(std::stod(value))); break;
-                        case VmbFeatureDataEnum:   CHECK_VIMBA(feature->SetValue(value.c_str())); break;
-                        case VmbFeatureDataString: CHECK_VIMBA(feature->SetValue(value.c_str())); break;
-                        case VmbFeatureDataBool:   CHECK_VIMBA(feature->SetValue(std::stoi(value) != 0)); break;
-                        default: throw std::runtime_error("Unsupported data type: " + std::to_string(dataType) + " (parameter name: " + parameterName + ")");
-                        }
-                    }
+    void halt() {
+        enabled = false;
 
-                    VmbInt64_t payloadSize = -1;
-                    CHECK_VIMBA(camera->GetFeatureByName("PayloadSize", feature));
-                    CHECK_VIMBA(feature->GetValue(payloadSize));
-                    
-                    const auto frameCount = std::max(1ull, totalFrameBufferCount / cameras.size());
+        {
+            std::lock_guard<std::mutex> lock(waitMutex);
+            itemPushed.notify_all();
+        }
+
+        const auto queues = std::atomic_load(&cameraQueues);
+        for (const auto& cameraQueue : *queues) {
+            std::lock_guard<std::mutex> lock(cameraQueue->mutex);
+            cameraQueue->itemPopped.notify_all();
+        }
+    }
+
+    bool is_enabled() const {
+        return enabled;
+    }
+
+private:
+    struct CameraQueue {
+        CameraQueue(size_t maxItemCount)
+            : items(maxItemCount)
+        {}
+
+        MpmcRing<ImageEncodingInputItem> items;
+        std::atomic<size_t> depth = 0; // the items in the ring, give or take one being pushed
+        std::atomic<size_t> stolenCount = 0;
+
+        // Only for QueueOverloadPolicy::Block
+        std::mutex mutex;
+        std::condition_variable itemPopped;
+        std::atomic<size_t> waitingProducerCount = 0;
+    };
+
+    // Cameras may be added while the encoding threads are running, so the list is
+    // replaced as a whole (and never modified in place) when a camera is added
+    typedef std::vector<std::shared_ptr<CameraQueue>> CameraQueues;
+
+    CameraQueue& GetCameraQueue(size_t cameraIndex) {
+        auto queues = std::atomic_load(&cameraQueues);
+        if (cameraIndex < queues->size()) {
+            return *(*queues)[cameraIndex];
+        }
+
+        std::lock_guard<std::mutex> lock(cameraQueuesMutex);
+        queues = std::atomic_load(&cameraQueues);
+        if (cameraIndex >= queues->size()) {
+            auto newQueues = std::make_shared<CameraQueues>(*queues);
+            while (newQueues->size() <= cameraIndex) {
+                newQueues->push_back(std::make_shared<CameraQueue>(maxItemCountPerCamera));
+            }
+            std::atomic_store(&cameraQueues, std::shared_ptr<CameraQueues>(newQueues));
+            queues = newQueues;
+        }
+        return *(*queues)[cameraIndex];
+    }
+
+    bool TryPop(ImageEncodingInputItem& item, size_t consumerIndex) {
+        const auto queues = std::atomic_load(&cameraQueues);
+        const size_t cameraCount = queues->size();
+
+        if (cameraCount == 0) {
+            return false;
+        }
+
+        // With more cameras than threads, each thread has several home cameras;
+        // with more threads than cameras, each camera is home to several threads
+        const auto isHomeCamera = [&](size_t cameraIndex) {
+            return cameraCount >= consumerCount
+                ? cameraIndex % consumerCount == consumerIndex
+                : cameraIndex == consumerIndex % cameraCount;
+        };
+
+        // First serve the home cameras, starting from where we left off last time
+        size_t& nextCameraIndex = nextHomeCameraIndex[consumerIndex];
+        for (size_t i = 0; i < cameraCount; ++i) {
+            const size_t cameraIndex = (nextCameraIndex + i) % cameraCount;
+            if (isHomeCamera(cameraIndex) && TryPop(*(*queues)[cameraIndex], item)) {
+                nextCameraIndex = cameraIndex + 1;
+                return true;
+            }
+        }
+
+        // Then steal from whichever other camera has the longest backlog
+        while (true) {
+            CameraQueue* victim = nullptr;
+            size_t victimDepth = 0;
+            for (size_t cameraIndex = 0; cameraIndex < cameraCount; ++cameraIndex) {
+                CameraQueue& cameraQueue = *(*queues)[cameraIndex];
+                const size_t depth = cameraQueue.depth;
+                if (!isHomeCamera(cameraIndex) && depth > victimDepth) {
+                    victim = &cameraQueue;
+                    victimDepth = depth;
+                }
+            }
+
+            if (!victim) {
+                return false;
+            }
+
+            if (TryPop(*victim, item)) {
+                ++victim->stolenCount;
+                return true;
+            }
+        }
+    }
+
+    bool TryPop(CameraQueue& cameraQueue, ImageEncodingInputItem& item) {
+        if (cameraQueue.depth == 0) {
+            return false;
+        }
+
+        if (!cameraQueue.items.TryPop(item)) {
+            return false;
+        }
+
+        --cameraQueue.depth;
+        --itemCount;
+
+        if (cameraQueue.waitingProducerCount > 0) {
+            std::lock_guard<std::mutex> lock(cameraQueue.mutex);
+            cameraQueue.itemPopped.notify_all();
+        }
+
+        return true;
+    }
+
+    const size_t maxItemCountPerCamera;
+    const QueueOverloadPolicy overloadPolicy;
+    const size_t consumerCount;
+
+    std::mutex cameraQueuesMutex;
+    std::shared_ptr<CameraQueues> cameraQueues;
+
+    std::vector<size_t> nextHomeCameraIndex; // one per consumer, touched only by that consumer
+
+    std::atomic<size_t> itemCount = 0;
+    std::atomic<size_t> waitingConsumerCount = 0;
+    std::mutex waitMutex;
+    std::condition_variable itemPushed;
+    std::atomic<bool> enabled = true;
+};
+
+// Where the images come from: a camera (see FrameObserver), or a synthetic source. Keeps the
+// statistics, and hands the images over to the encoding threads in order.
+class CameraSource {
+public:
+    CameraSource(size_t cameraIndex, ImageEncodingQueue& imageEncodingInput, ImageReorderer& imageReorderer, size_t maxPooledBufferCount, const std::vector<cv::Rect>& regionsOfInterest, const thread_placement::Placement& receivingThreadPlacement, std::unique_ptr<ChangeGate> changeGate, uint64_t firstCounter)
+        : cameraIndex(cameraIndex)
+        , bufferPool(std::make_shared<BufferPool>(maxPooledBufferCount))
+        , counter(firstCounter)
+        , imageEncodingInput(imageEncodingInput)
+        , imageReorderer(imageReorderer)
+        , regionsOfInterest(std::make_shared<const std::vector<cv::Rect>>(regionsOfInterest))
+        , receivingThreadPlacement(receivingThreadPlacement)
+        , changeGate(std::move(changeGate))
+        , lastCompleteFrameReceived(std::chrono::steady_clock::now().time_since_epoch().count())
+    {}
+
+    virtual ~CameraSource() {}
+
+    std::pair<size_t, size_t> GetAndResetFramesReceived() {
+        return std::make_pair(
+            completeFramesReceived.exchange(0),
+            incompleteFramesReceived.exchange(0)
+        );
+    }
+
+    size_t GetAndResetFramesDropped() {
+        return framesDropped.exchange(0);
+    }
+
+    // Complete frames skipped by the change gate
+    size_t GetAndResetFramesUnchanged() {
+        return framesUnchanged.exchange(0);
+    }
+
+    size_t GetAndResetLateImageCount() {
+        return imageReorderer.GetAndResetLateCount(cameraIndex);
+    }
+
+    ImageEncodingQueue::Statistics GetAndResetImageEncodingQueueStatistics() {
+        return imageEncodingInput.GetAndResetStatistics(cameraIndex);
+    }
+
+    BufferPool::Statistics GetAndResetBufferPoolStatistics() {
+        return bufferPool->GetAndResetStatistics();
+    }
+
+    void GetAndResetMetrics(nlohmann::json& metrics, double elapsed_s) {
+        this->metrics->GetAndReset(metrics, elapsed_s);
+    }
+
+    // The time of construction, if no complete frame has been received yet
+    std::chrono::steady_clock::time_point GetLastCompleteFrameReceived() const {
+        return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(lastCompleteFrameReceived.load()));
+    }
+
+    // Where the counter of a new source should continue from, so that the images of a
+    // reconnected camera do not look like old ones to the reorderer; call when not acquiring
+    uint64_t GetNextCounter() const {
+        return counter;
+    }
+
+    // Keeps the raw frames in a ring file, too; null = not recorded
+    void SetRawRecorder(const std::shared_ptr<RawRecorder>& rawRecorder) {
+        std::atomic_store(&this->rawRecorder, rawRecorder);
+    }
+
+    virtual void SampleCameraClock() {}
+
+    // NaN if the camera clock is not used
+    virtual double GetCameraClockDrift_ppm() const {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+
+    // NaN if not available
+    virtual double GetCameraTemperature() {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+
+    virtual double GetCameraExposureTime() {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+
+    virtual double GetCameraGain() {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+
+protected:
+    // Hands a complete frame over to the encoding threads; rawData and rawDataOwner, the pixel
+    // format and the timestamps are expected to be set already
+    void PushImage(ImageEncodingInputItem&& imageEncodingInputItem) {
+        metrics->AddFrameTimestamp(imageEncodingInputItem.timestamp);
+        imageEncodingInputItem.bufferPool = bufferPool;
+        imageEncodingInputItem.metrics = metrics;
+        imageEncodingInputItem.counter = counter;
+        imageEncodingInputItem.cameraIndex = cameraIndex;
+        imageEncodingInputItem.reorderTicket = imageReorderer.Reserve(cameraIndex, counter);
+        imageEncodingInputItem.regionsOfInterest = regionsOfInterest;
+
+        const auto callbackEntered = imageEncodingInputItem.callbackEntered;
+
+        framesDropped += imageEncodingInput.push_back(std::move(imageEncodingInputItem));
+
+        RegisterCompleteFrame(callbackEntered);
+    }
+
+    // Call with each complete frame, before copying it anywhere; the pixel format and the
+    // timestamps of the item are expected to be set already. Returns false if the frame is
+    // unchanged, and is to be skipped - it has then been counted as received already.
+    bool PassChangeGate(const cv::Mat& rawData, const ImageEncodingInputItem& imageEncodingInputItem) {
+        if (!changeGate || changeGate->Pass(rawData, imageEncodingInputItem.pixelFormat, imageEncodingInputItem.callbackEntered)) {
+            return true;
+        }
+        metrics->AddFrameTimestamp(imageEncodingInputItem.timestamp);
+        ++framesUnchanged;
+        RegisterCompleteFrame(imageEncodingInputItem.callbackEntered);
+        return false;
+    }
+
+    // Call with each complete frame, straight from the buffer it arrived in, before anything else
+    // is done with it: even the frames skipped by the change gate get recorded
+    void RecordRawFrame(const void* data, size_t size, uint32_t width, uint32_t height, VmbPixelFormatType pixelFormat,
+        std::chrono::system_clock::time_point timestamp, std::chrono::steady_clock::time_point callbackEntered) {
+        const auto rawRecorder = std::atomic_load(&this->rawRecorder);
+        if (rawRecorder) {
+            rawRecorder->Record(data, size, width, height, pixelFormat, counter, timestamp, callbackEntered);
+        }
+    }
+
+    // Call first thing in the thread that receives the frames. Vimba may call back from more
+    // than one thread, so each thread is placed when it first shows up.
+    void PlaceReceivingThread() {
+        thread_local bool placed = false;
+        if (!placed) {
+            placed = true;
+            if (!thread_placement::ApplyToCurrentThread(receivingThreadPlacement)) {
+                numcfc::Logger::LogAndEcho("Unable to place the thread receiving the frames on cores " + thread_placement::FormatCoreSet(receivingThreadPlacement.cores)
+                    + " with priority " + thread_placement::ToString(receivingThreadPlacement.priority), "log_errors");
+            }
+        }
+    }
+
+    void RegisterIncompleteFrame() {
+        if (!firstIncompleteFrameReceived) {
+            firstIncompleteFrameReceived = true;
+            numcfc::Logger::LogAndEcho("First incomplete frame received", "log_incomplete_frames");
+        }
+
+        ++incompleteFramesReceived;
+    }
+
+    const size_t cameraIndex;
+    const std::shared_ptr<BufferPool> bufferPool;
+    const std::shared_ptr<CameraMetrics> metrics = std::make_shared<CameraMetrics>();
+    uint64_t counter; // of all frames, complete or not; touched only by the thread that receives the frames
+
+private:
+    void RegisterCompleteFrame(std::chrono::steady_clock::time_point time) {
+        lastCompleteFrameReceived = time.time_since_epoch().count();
+
+        if (!firstCompleteFrameReceived) {
+            firstCompleteFrameReceived = true;
+            numcfc::Logger::LogAndEcho("First frame received", "log_init");
+        }
+
+        ++completeFramesReceived;
+    }
+
+    ImageEncodingQueue& imageEncodingInput;
+    ImageReorderer& imageReorderer;
+    const std::shared_ptr<const std::vector<cv::Rect>> regionsOfInterest;
+    const thread_placement::Placement receivingThreadPlacement;
+    const std::unique_ptr<ChangeGate> changeGate; // touched only by the thread that receives the frames
+    std::shared_ptr<RawRecorder> rawRecorder;
+    bool firstCompleteFrameReceived = false;
+    bool firstIncompleteFrameReceived = false;
+    std::atomic<uintmax_t> completeFramesReceived = 0;
+    std::atomic<uintmax_t> incompleteFramesReceived = 0;
+    std::atomic<uintmax_t> framesDropped = 0;
+    std::atomic<uintmax_t> framesUnchanged = 0;
+    std::atomic<std::chrono::steady_clock::rep> lastCompleteFrameReceived;
+};
+
+class FrameObserver : public AVT::VmbAPI::IFrameObserver, public CameraSource {
+public: 
+    FrameObserver(AVT::VmbAPI::CameraPtr camera, size_t cameraIndex, ImageEncodingQueue& imageEncodingInput, ImageReorderer& imageReorderer, bool zeroCopy, size_t zeroCopyMinQueuedFrameCount, size_t maxPooledBufferCount, const std::vector<cv::Rect>& regionsOfInterest, const thread_placement::Placement& receivingThreadPlacement, std::unique_ptr<ChangeGate> changeGate, bool useCameraClock, uint64_t firstCounter)
+        : AVT::VmbAPI::IFrameObserver( camera )
+        , CameraSource(cameraIndex, imageEncodingInput, imageReorderer, maxPooledBufferCount, regionsOfInterest, receivingThreadPlacement, std::move(changeGate), firstCounter)
+        , camera(camera)
+        , zeroCopy(zeroCopy)
+        , zeroCopyMinQueuedFrameCount(zeroCopyMinQueuedFrameCount)
+    {
+        if (useCameraClock) {
+            cameraClock.reset(new CameraClock(camera));
+            if (!cameraClock->IsAvailable()) {
+                numcfc::Logger::LogAndEcho("Camera timestamp latching not supported (using the time of receiving instead)", "log_init");
+                cameraClock.reset();
+            }
+            else {
+                cameraClock->Sample(); // so that the first frames already get a camera timestamp
+            }
+        }
+
+        CHECK_VIMBA(camera->GetFeatureByName("DeviceTemperature", temperatureFeature));
+        CHECK_VIMBA(camera->GetFeatureByName("ExposureTimeAbs", exposureTimeFeature));
+        CHECK_VIMBA(camera->GetFeatureByName("Gain", gainFeature));
+    }
+
+    void FrameReceived(const AVT::VmbAPI::FramePtr frame) {
+        PlaceReceivingThread();
+        const auto callbackEntered = std::chrono::steady_clock::now();
+        const auto timeReceived = std::chrono::system_clock::now();
+        const int64_t stillQueuedFrameCount = --queuedFrameCount;
+        if (stillQueuedFrameCount < minQueuedFrameCount) {
+            minQueuedFrameCount = stillQueuedFrameCount; // racing with a reset is harmless
+        }
+        bool frameLent = false;
+        VmbFrameStatusType frameStatus;
+        const auto res = frame->GetReceiveStatus(frameStatus);
+
+        VmbUint64_t frameId = 0;
+        if (frame->GetFrameID(frameId) == VmbErrorSuccess) {
+            metrics->AddFrameId(frameId);
+        }
+
+        if (VmbErrorSuccess == res) {
+            if (VmbFrameStatusComplete == frameStatus) {
+                // Frame receivd successfully
+                VmbUint32_t width = 0, height = 0;
+                VmbUchar_t* data = 0;
+                VmbPixelFormatType pixelFormat = static_cast<VmbPixelFormatType>(0);
+                CHECK_VIMBA(frame->GetWidth(width));
+                CHECK_VIMBA(frame->GetHeight(height));
+                CHECK_VIMBA(frame->GetBuffer(data));
+                CHECK_VIMBA(frame->GetPixelFormat(pixelFormat));
+
+                ImageEncodingInputItem imageEncodingInputItem;
+
+                cv::Mat temp = WrapPixelBuffer(data, width, height, pixelFormat);
+                if (temp.empty()) {
+                    temp = cv::Mat(height, width, CV_8UC1, data); // not supported, but let's pass on what we have
+                }
+
+                imageEncodingInputItem.pixelFormat = pixelFormat;
+                imageEncodingInputItem.timestamp = timeReceived;
+                imageEncodingInputItem.callbackEntered = callbackEntered;
+
+                VmbUint64_t cameraTimestamp = 0;
+                std::chrono::system_clock::time_point timestamp;
+                if (cameraClock && frame->GetTimestamp(cameraTimestamp) == VmbErrorSuccess && cameraClock->ToHostTime(cameraTimestamp, timestamp)) {
+                    imageEncodingInputItem.timestamp = timestamp;
+                    imageEncodingInputItem.cameraToCallback_us = std::chrono::duration<double, std::micro>(timeReceived - timestamp).count();
+                }
+
+                VmbUint32_t imageSize = 0;
+                if (frame->GetImageSize(imageSize) == VmbErrorSuccess) {
+                    RecordRawFrame(data, imageSize, width, height, pixelFormat, imageEncodingInputItem.timestamp, callbackEntered);
+                }
+
+                // Checked before the frame is copied, so that an unchanged frame costs only the thumbnail
+                if (PassChangeGate(temp, imageEncodingInputItem)) {
+                    if (zeroCopy && queuedFrameCount >= static_cast<int64_t>(zeroCopyMinQueuedFrameCount)) {
+                        // Let the encoding thread work directly on the Vimba buffer - the frame is
+                        // given back to the camera only once the encoding thread is done with it
+                        imageEncodingInputItem.rawData = temp;
+                        imageEncodingInputItem.rawDataOwner = LendFrame(frame);
+                        frameLent = true;
+                    }
+                    else {
+                        imageEncodingInputItem.rawDataOwner = bufferPool->Borrow(temp.rows, temp.cols, temp.type(), imageEncodingInputItem.rawData);
+                        temp.copyTo(imageEncodingInputItem.rawData);
+                    }
+
+                    PushImage(std::move(imageEncodingInputItem));
+                }
+            }
+            else if (VmbFrameStatusIncomplete == frameStatus) {
+                RegisterIncompleteFrame();
+            }
+            else if (VmbFrameStatusTooSmall == frameStatus) {
+                numcfc::Logger::LogAndEcho("Frame buffer too small", "log_errors");
+            }
+            else if (VmbFrameStatusInvalid == frameStatus) {
+                numcfc::Logger::LogAndEcho("Frame buffer not valid", "log_errors");
+            }
+            else {
+                numcfc::Logger::LogAndEcho("Unexpected frame status: " + std::to_string(frameStatus), "log_errors");
+            }
+        }
+        else {
+            numcfc::Logger::LogAndEcho("Error getting receive status: " + std::to_string(res), "log_errors");
+        }
+
+        ++counter;
+
+        if (!frameLent) {
+            QueueFrame(frame);
+        }
+    }
+
+    void QueueFrame(const AVT::VmbAPI::FramePtr& frame) {
+        ++queuedFrameCount;
+        if (camera->QueueFrame(frame) != VmbErrorSuccess) {
+            --queuedFrameCount; // e.g., a lent frame returned after the acquisition was stopped
+        }
+    }
+
+    // To be called after flushing the queue of the camera
+    void ResetQueuedFrameCount() {
+        queuedFrameCount = 0;
+    }
+
+    // The fewest frames the camera has had queued since the previous call: if it gets to zero,
+    // the camera has nowhere to put the next frame
+    int64_t GetAndResetMinQueuedFrameCount() {
+        const int64_t queuedFrameCount = this->queuedFrameCount;
+        return std::min(queuedFrameCount, minQueuedFrameCount.exchange(queuedFrameCount));
+    }
+
+    void SampleCameraClock() override {
+        if (cameraClock) {
+            cameraClock->Sample();
+        }
+    }
+
+    double GetCameraClockDrift_ppm() const override {
+        return cameraClock ? cameraClock->GetDrift_ppm() : std::numeric_limits<double>::quiet_NaN();
+    }
+
+    double GetCameraTemperature() override {
+        return GetFeature(temperatureFeature);
+    }
+
+    double GetCameraExposureTime() override {
+        return GetFeature(exposureTimeFeature);
+    }
+
+    double GetCameraGain() override {
+        return GetFeature(gainFeature);
+    }
+
+private:
+    std::shared_ptr<void> LendFrame(const AVT::VmbAPI::FramePtr& frame) {
+        // Capturing this is fine: each frame holds a reference to its observer
+        return std::shared_ptr<void>(nullptr, [this, frame](void*) {
+            QueueFrame(frame);
+        });
+    }
+
+    double GetFeature(const AVT::VmbAPI::FeaturePtr& feature) {
+        double value = std::numeric_limits<double>::quiet_NaN();
+        CHECK_VIMBA(feature->GetValue(value));
+        return value;
+    }
+
+    AVT::VmbAPI::CameraPtr camera;
+    const bool zeroCopy;
+    const size_t zeroCopyMinQueuedFrameCount;
+    std::atomic<int64_t> queuedFrameCount = 0;
+    std::atomic<int64_t> minQueuedFrameCount = std::numeric_limits<int64_t>::max();
+    std::unique_ptr<CameraClock> cameraClock;
+    AVT::VmbAPI::FeaturePtr temperatureFeature;
+    AVT::VmbAPI::FeaturePtr exposureTimeFeature;
+    AVT::VmbAPI::FeaturePtr gainFeature;
+};
+
+// A frame whose buffer is in an arena: keeps the arena alive for as long as the frame is around,
+// e.g. while lent to the encoding threads
+class ArenaFrame : public AVT::VmbAPI::Frame {
+public:
+    ArenaFrame(const std::shared_ptr<FrameBufferArena>& frameBufferArena, size_t index)
+        : AVT::VmbAPI::Frame(frameBufferArena->GetBuffer(index), static_cast<VmbInt64_t>(frameBufferArena->GetBufferSize()))
+        , frameBufferArena(frameBufferArena)
+    {}
+
+private:
+    const std::shared_ptr<FrameBufferArena> frameBufferArena;
+};
+
+// Produces frames without a camera, at a fixed rate: either test patterns, or images replayed
+// from a directory. The frames are prepared in advance, so that making them up costs nothing
+// while running; each frame is still copied into a pooled buffer, like a camera frame would be.
+class SyntheticCameraSource : public CameraSource {
+public:
+    struct Settings {
+        std::string pattern = "gradient";   // see CreateTestPattern
+        std::string replayDirectory;        // if set, the images in this directory are replayed instead
+        int width = 1920;
+        int height = 1200;
+        bool pixelFormatSet = false;        // if not, Mono8 for test patterns, and Mono8 or BGR8 for replayed images
+        VmbPixelFormatType pixelFormat = VmbPixelFormatMono8;
+        double noiseLevel = 0.0;
+        double fps = 10.0;
+        size_t distinctFrameCount = 8;      // of test patterns
+    };
+
+    SyntheticCameraSource(size_t cameraIndex, ImageEncodingQueue& imageEncodingInput, ImageReorderer& imageReorderer, size_t maxPooledBufferCount, const std::vector<cv::Rect>& regionsOfInterest, const thread_placement::Placement& receivingThreadPlacement, std::unique_ptr<ChangeGate> changeGate, const Settings& settings)
+        : CameraSource(cameraIndex, imageEncodingInput, imageReorderer, maxPooledBufferCount, regionsOfInterest, receivingThreadPlacement, std::move(changeGate), 0)
+        , frameInterval(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / std::max(0.001, settings.fps))))
+    {
+        std::vector<cv::Mat> images;
+        if (!settings.replayDirectory.empty()) {
+            images = ReadImageFiles(settings.replayDirectory);
+            if (images.empty()) {
+                throw std::runtime_error("No images found in " + settings.replayDirectory);
+            }
+        }
+        else {
+            const bool color = settings.pixelFormatSet && GetConvertedImageType(settings.pixelFormat) == CV_8UC3;
+            for (size_t i = 0; i < std::max(static_cast<size_t>(1), settings.distinctFrameCount); ++i) {
+                cv::Mat image;
+                CreateTestPattern(settings.pattern, settings.width, settings.height, color, i, settings.noiseLevel, image);
+                images.push_back(image);
+            }
+        }
+
+        for (const auto& image : images) {
+            PreparedFrame frame;
+            frame.pixelFormat = settings.pixelFormatSet ? settings.pixelFormat : (image.channels() == 1 ? VmbPixelFormatMono8 : VmbPixelFormatBgr8);
+            CreateRawData(image, frame.pixelFormat, frame.rawData);
+            frames.push_back(frame);
+        }
+
+        thread = std::thread(&SyntheticCameraSource::Run, this);
+    }
+
+    ~SyntheticCameraSource() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        stopRequested.notify_all();
+        thread.join();
+    }
+
+    // The size of the biggest frame, in bytes
+    size_t GetMaxRawDataSize() const {
+        size_t maxSize = 0;
+        for (const auto& frame : frames) {
+            maxSize = std::max(maxSize, frame.rawData.total() * frame.rawData.elemSize());
+        }
+        return maxSize;
+    }
+
+private:
+    struct PreparedFrame {
+        cv::Mat rawData;
+        VmbPixelFormatType pixelFormat;
+    };
+
+    void Run() {
+        PlaceReceivingThread();
+
+        auto nextFrame = std::chrono::steady_clock::now();
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (stopRequested.wait_until(lock, nextFrame, [this]() { return stopping; })) {
+                    return;
+                }
+            }
+
+            nextFrame += frameInterval;
+
+            const auto callbackEntered = std::chrono::steady_clock::now();
+            const PreparedFrame& frame = frames[counter % frames.size()];
+
+            ImageEncodingInputItem imageEncodingInputItem;
+            imageEncodingInputItem.pixelFormat = frame.pixelFormat;
+            imageEncodingInputItem.timestamp = std::chrono::system_clock::now();
+            imageEncodingInputItem.callbackEntered = callbackEntered;
+
+            const cv::Size imageSize = GetImageSize(frame.rawData, frame.pixelFormat);
+            RecordRawFrame(frame.rawData.data, frame.rawData.total() * frame.rawData.elemSize(), imageSize.width, imageSize.height, frame.pixelFormat, imageEncodingInputItem.timestamp, callbackEntered);
+
+            if (PassChangeGate(frame.rawData, imageEncodingInputItem)) {
+                imageEncodingInputItem.rawDataOwner = bufferPool->Borrow(frame.rawData.rows, frame.rawData.cols, frame.rawData.type(), imageEncodingInputItem.rawData);
+                frame.rawData.copyTo(imageEncodingInputItem.rawData);
+
+                PushImage(std::move(imageEncodingInputItem));
+            }
+
+            ++counter;
+
+            // If the encoding is blocking or badly behind, skip the missed frames rather than trying to catch up
+            const auto now = std::chrono::steady_clock::now();
+            if (nextFrame < now) {
+                nextFrame = now;
+            }
+        }
+    }
+
+    const std::chrono::steady_clock::duration frameInterval;
+    std::vector<PreparedFrame> frames;
+    std::mutex mutex;
+    std::condition_variable stopRequested;
+    bool stopping = false;
+    std::thread thread;
+};
+
+// The latency trace of an image: the time from entering the Vimba callback to each stage, in
+// microseconds, as attributes named trace_<stage>_us. The origin of the trace travels beside the
+// message, through ImageReorderer, until the image is sent.
+void AddLatencyTrace(claim::AttributeMessage& amsg, const std::string& stage, std::chrono::steady_clock::time_point origin, std::chrono::steady_clock::time_point time)
+{
+    amsg.m_attributes["trace_" + stage + "_us"] = std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(time - origin).count());
+}
+
+// Parses rectangles given as "x,y,width,height", separated by semicolons
+std::vector<cv::Rect> ParseRegionsOfInterest(const std::string& value)
+{
+    std::vector<cv::Rect> regionsOfInterest;
+    std::istringstream input(value);
+    std::string item;
+    while (std::getline(input, item, ';')) {
+        if (item.find_first_not_of(" \t") == std::string::npos) {
+            continue;
+        }
+        std::replace(item.begin(), item.end(), ',', ' ');
+        std::istringstream rectangle(item);
+        cv::Rect roi;
+        if (!(rectangle >> roi.x >> roi.y >> roi.width >> roi.height) || roi.width <= 0 || roi.height <= 0) {
+            throw std::runtime_error("Unable to parse region of interest: " + item + " (expected x,y,width,height)");
+        }
+        regionsOfInterest.push_back(roi);
+    }
+    return regionsOfInterest;
+}
+
+// Steers the JPEG quality, within a configured range, so that the encoders keep up: the
+// quality is lowered quickly when over budget, and raised slowly when comfortably under.
+class JpegQualityController {
+public:
+    struct Settings {
+        int minQuality = 50;
+        int maxQuality = 90;
+        double targetBytesPerSecond = 0;        // all cameras together; 0 = no target
+        double targetEncodeTimeP95_ms = 0;      // per image; 0 = no target
+        size_t maxBacklog = 0;                  // per camera; 0 = no target
+    };
+
+    struct Status {
+        int quality = 0;
+        double bytesPerSecond = 0;
+        double encodeTimeP95_ms = 0;
+        size_t backlog = 0;
+    };
+
+    JpegQualityController(const Settings& settings)
+        : settings(settings)
+        , quality(settings.maxQuality)
+        , lastUpdate(std::chrono::steady_clock::now())
+    {}
+
+    // The quality to use for the next image
+    int GetQuality() const {
+        return quality;
+    }
+
+    // Called by the encoding threads after each image
+    void AddSample(size_t encodedByteCount, double encodeTime_ms) {
+        std::lock_guard<std::mutex> lock(mutex);
+        byteCount += encodedByteCount;
+        encodeTimes_ms.push_back(encodeTime_ms);
+    }
+
+    // Should be called every now and then (say, once per second)
+    Status Update(size_t backlog) {
+        const auto now = std::chrono::steady_clock::now();
+
+        size_t byteCount = 0;
+        std::vector<double> encodeTimes_ms;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::swap(byteCount, this->byteCount);
+            std::swap(encodeTimes_ms, this->encodeTimes_ms);
+        }
+
+        const double elapsed_s = std::chrono::duration<double>(now - lastUpdate).count();
+        lastUpdate = now;
+
+        Status status;
+        status.bytesPerSecond = elapsed_s > 0 ? byteCount / elapsed_s : 0;
+        status.encodeTimeP95_ms = GetPercentile(encodeTimes_ms, 0.95);
+        status.backlog = backlog;
+
+        // How far over (> 1) or under (< 1) the tightest budget we are
+        double load = 0;
+        if (settings.targetBytesPerSecond > 0) {
+            load = std::max(load, status.bytesPerSecond / settings.targetBytesPerSecond);
+        }
+        if (settings.targetEncodeTimeP95_ms > 0) {
+            load = std::max(load, status.encodeTimeP95_ms / settings.targetEncodeTimeP95_ms);
+        }
+        if (settings.maxBacklog > 0) {
+            load = std::max(load, backlog / static_cast<double>(settings.maxBacklog));
+        }
+
+        int newQuality = quality;
+        if (load > 1.0) {
+            // The further over budget, the bigger the step
+            newQuality -= std::min(10, static_cast<int>(std::ceil(10 * (load - 1.0))));
+        }
+        else if (load < 0.85 && !encodeTimes_ms.empty()) {
+            newQuality += 1;
+        }
+        quality = std::max(settings.minQuality, std::min(settings.maxQuality, newQuality));
+
+        status.quality = quality;
+        return status;
+    }
+
+private:
+    const Settings settings;
+    std::atomic<int> quality;
+    std::chrono::steady_clock::time_point lastUpdate;
+
+    std::mutex mutex;
+    size_t byteCount = 0;
+    std::vector<double> encodeTimes_ms;
+};
+
+// Returns the Vimba error code (rather than throwing), so that the caller can decide what to do
+VmbErrorType SetFeatureValue(const AVT::VmbAPI::FeaturePtr& feature, const std::string& parameterName, const std::string& value)
+{
+    VmbFeatureDataType dataType = VmbFeatureDataUnknown;
+    const VmbErrorType result = feature->GetDataType(dataType);
+    if (result != VmbErrorSuccess) {
+        return result;
+    }
+
+    switch (dataType) {
+    case VmbFeatureDataInt:    return feature->SetValue(std::stoi(value));
+    case VmbFeatureDataFloat:  return feature->SetValue(std::stod(value));
+    case VmbFeatureDataEnum:   return feature->SetValue(value.c_str());
+    case VmbFeatureDataString: return feature->SetValue(value.c_str());
+    case VmbFeatureDataBool:   return feature->SetValue(std::stoi(value) != 0);
+    default: throw std::runtime_error("Unsupported data type: " + std::to_string(dataType) + " (parameter name: " + parameterName + ")");
+    }
+}
+
+// The sections of AlliedVision.ini that the service reads, other than those of the post office
+const char* const iniFileSections[] = {
+    "Source", "Operation", "Logging", "Timestamps", "Threading", "FrameBuffers", "ImageEncoding",
+    "ChangeGate", "RawRecording", "NoImagesTimeouts", "RegionsOfInterest", "VimbaParameters"
+};
+
+// The values of those sections, by section and key, as numcfc::IniFile has them: kept so that
+// when the file is updated, the new values can be compared against the previous ones
+typedef std::map<std::string, std::map<std::string, std::string>> IniFileValues;
+
+IniFileValues GetIniFileValues(numcfc::IniFile& iniFile)
+{
+    IniFileValues values;
+    for (const char* section : iniFileSections) {
+        for (const auto& key : iniFile.GetKeys(section)) {
+            values[section][key] = iniFile.GetValue(section, key);
+        }
+    }
+    return values;
+}
+
+// The settings that the encoding threads pick up between images, if the ini file is changed
+struct EncodingConfiguration {
+    std::string imageFormat;
+    bool isJpeg = false;
+    std::string imageEncoderBackend;
+    ImageEncoderSettings imageEncoderSettings;
+    DebayerMode debayerMode = DebayerMode::Full;
+    int previewMaxWidth = 0;
+};
+
+std::shared_ptr<const EncodingConfiguration> ReadEncodingConfiguration(numcfc::IniFile& iniFile)
+{
+    const auto configuration = std::make_shared<EncodingConfiguration>();
+
+    configuration->imageFormat = iniFile.GetSetValue("ImageEncoding", "ImageFormat", "jpg", "Try \"jpg\" or \"png\" - or, if all consumers are on the same host, \"raw\" (uncompressed) or \"qoi\" (fast lossless)");
+    configuration->isJpeg = IsJpegFormat(configuration->imageFormat);
+
+    const double jpegCompressionQuality = configuration->isJpeg
+        ? iniFile.GetSetValue("ImageEncoding", "JpegCompressionQuality", 90)
+        : std::numeric_limits<double>::quiet_NaN();
+
+    configuration->imageEncoderBackend = iniFile.GetSetValue("ImageEncoding", "Encoder", "opencv", "Which JPEG encoder to use - try \"opencv\", or \"turbojpeg\" (if compiled in)");
+    if (tuc::string::equal_case_insensitive(configuration->imageEncoderBackend, "turbojpeg") && !IsTurboJpegAvailable()) {
+        numcfc::Logger::LogAndEcho("TurboJPEG support not compiled in (using opencv)", "log_errors");
+        configuration->imageEncoderBackend = "opencv";
+    }
+
+    ImageEncoderSettings& imageEncoderSettings = configuration->imageEncoderSettings;
+    imageEncoderSettings.imageFormat = configuration->imageFormat;
+    if (configuration->isJpeg) {
+        imageEncoderSettings.jpegQuality = static_cast<int>(std::round(jpegCompressionQuality));
+
+        const std::string jpegSubsampling = iniFile.GetSetValue("ImageEncoding", "Subsampling", "420", "JPEG chroma subsampling - try \"444\", \"422\", or \"420\" (the opencv encoder supports 420 only)");
+        if (!ParseJpegSubsampling(jpegSubsampling, imageEncoderSettings.jpegSubsampling)) {
+            numcfc::Logger::LogAndEcho("Unexpected JPEG subsampling: " + jpegSubsampling + " (using 420)", "log_errors");
+            imageEncoderSettings.jpegSubsampling = JpegSubsampling::S420;
+        }
+
+        imageEncoderSettings.jpegFastDct = iniFile.GetSetValue("ImageEncoding", "FastDCT", 0.0, "Use the faster, but slightly less accurate DCT (turbojpeg only)") > 0.0;
+        imageEncoderSettings.jpegOptimizeHuffman = iniFile.GetSetValue("ImageEncoding", "OptimizeHuffman", 0.0, "Optimize the Huffman tables: smaller files, but slower encoding (opencv only)") > 0.0;
+    }
+
+    const std::string debayering = iniFile.GetSetValue("ImageEncoding", "Debayering", "full", "How to convert Bayer images - try \"full\", or \"superpixel\" for half width and height");
+    configuration->debayerMode = tuc::string::equal_case_insensitive(debayering, "superpixel") ? DebayerMode::Superpixel : DebayerMode::Full;
+
+    if (configuration->debayerMode == DebayerMode::Full && !tuc::string::equal_case_insensitive(debayering, "full")) {
+        numcfc::Logger::LogAndEcho("Unexpected debayering: " + debayering + " (using full)", "log_errors");
+    }
+
+    configuration->previewMaxWidth = static_cast<int>(iniFile.GetSetValue("ImageEncoding", "PreviewMaxWidth", 0, "If positive, also send each image as an \"ImagePreview\" message, downscaled to at most this width"));
+
+    return configuration;
+}
+
+// Each camera goes through these states on its own, so that a failing camera can be reset
+// while the others keep streaming
+enum class CameraState {
+    Opening,        // about to open the camera
+    Configuring,    // opened; about to set the parameters and start acquisition
+    Acquiring,
+    Degraded,       // no images within the timeout; acquisition restarted once
+    Reconnecting    // closed; waiting for the backoff time, or for the camera to be plugged in
+};
+
+const char* GetCameraStateName(CameraState state)
+{
+    switch (state) {
+    case CameraState::Opening:      return "opening";
+    case CameraState::Configuring:  return "configuring";
+    case CameraState::Acquiring:    return "acquiring";
+    case CameraState::Degraded:     return "degraded";
+    case CameraState::Reconnecting: return "reconnecting";
+    default:                        return "unknown";
+    }
+}
+
+// What a camera needs for buffering its frames
+struct FrameBufferDemand {
+    VmbInt64_t payloadSize = 0;     // 0 until the camera has been configured
+    double frameRate = 0.0;
+    double bufferingScale = 1.0;    // grown when the camera seems to run out of frame buffers
+};
+
+// Splits the memory budget so that each camera can buffer the same time worth of frames (times its
+// bufferingScale), up to the target time. Cameras whose demand is not known yet get an even share
+// of the budget reserved. Returns the frame count of each camera: 0 for those not known yet, and
+// otherwise at least minCount.
+std::vector<size_t> PlanFrameBuffers(const std::vector<FrameBufferDemand>& demands, double memoryBudget_bytes, double targetBuffering_s, size_t minCount)
+{
+    double knownBytesPerSecond = 0.0;
+    size_t knownCount = 0;
+    for (const auto& demand : demands) {
+        if (demand.payloadSize > 0) {
+            knownBytesPerSecond += demand.payloadSize * demand.frameRate * demand.bufferingScale;
+            ++knownCount;
+        }
+    }
+
+    const double availableBytes = demands.empty() ? 0.0 : memoryBudget_bytes * knownCount / demands.size();
+    const double buffering_s = knownBytesPerSecond > 0.0 ? std::min(targetBuffering_s, availableBytes / knownBytesPerSecond) : 0.0;
+
+    std::vector<size_t> frameCounts;
+    for (const auto& demand : demands) {
+        if (demand.payloadSize > 0) {
+            frameCounts.push_back(std::max(minCount, static_cast<size_t>(demand.frameRate * demand.bufferingScale * buffering_s)));
+        }
+        else {
+            frameCounts.push_back(0);
+        }
+    }
+    return frameCounts;
+}
+
+// The frame rate the camera has been set to, or NaN if it does not tell
+double GetAcquisitionFrameRate(const AVT::VmbAPI::CameraPtr& camera)
+{
+    for (const char* featureName : { "AcquisitionFrameRateAbs", "AcquisitionFrameRate" }) {
+        AVT::VmbAPI::FeaturePtr feature;
+        double frameRate = 0.0;
+        if (camera->GetFeatureByName(featureName, feature) == VmbErrorSuccess && feature->GetValue(frameRate) == VmbErrorSuccess && frameRate > 0.0) {
+            return frameRate;
+        }
+    }
+    return std::numeric_limits<double>::quiet_NaN();
+}
+
+struct SupervisedCamera {
+    AVT::VmbAPI::CameraPtr camera;              // null while unplugged
+    CameraState state = CameraState::Opening;
+    std::chrono::steady_clock::time_point stateEntered = std::chrono::steady_clock::now();
+    size_t cameraIndex = 0;                     // kept over reconnects
+    FrameObserver* frameObserver = nullptr;     // set while acquiring or degraded
+    AVT::VmbAPI::IFrameObserverPtr frameObserverPtr;
+    AVT::VmbAPI::FramePtrVector frames;
+    std::shared_ptr<FrameBufferArena> frameBufferArena; // kept over reconnects, and reused if it fits
+    FrameBufferDemand frameBufferDemand;        // kept over reconnects
+    std::chrono::steady_clock::time_point frameBuffersLastGrown;
+    uint64_t nextCounter = 0;                   // where the next frame observer continues from
+    double noImagesTimeout_s = 0.0;
+    double reconnectBackoff_s = 0.0;
+    std::chrono::steady_clock::time_point nextReconnectAttempt;
+};
+
+// Collects the hot-plug events from the Vimba thread, to be handled in the main loop
+class CameraListObserver : public AVT::VmbAPI::ICameraListObserver {
+public:
+    struct Event {
+        AVT::VmbAPI::CameraPtr camera;
+        AVT::VmbAPI::UpdateTriggerType reason;
+    };
+
+    void CameraListChanged(AVT::VmbAPI::CameraPtr camera, AVT::VmbAPI::UpdateTriggerType reason) {
+        std::lock_guard<std::mutex> lock(mutex);
+        events.push_back(Event{ camera, reason });
+    }
+
+    std::vector<Event> GetAndClearEvents() {
+        std::vector<Event> result;
+        std::lock_guard<std::mutex> lock(mutex);
+        result.swap(events);
+        return result;
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<Event> events;
+};
+
+// Also fills in the corresponding fields of the camera's Metrics
+void Log(const std::string& id, CameraSource* cameraSource, size_t totalCount, bool logTemperature, bool logExposureTime, bool logGain, nlohmann::json& metrics)
+{
+    std::ostringstream logEntry;
+
+    if (totalCount > 1) {
+        logEntry << id << ": ";
+    }
+
+    bool firstItemLogged = false;
+
+    const auto addCommaIfRequired = [&]() {
+        if (firstItemLogged) {
+            logEntry << ", ";
+        }
+        else {
+            firstItemLogged = true;
+        }
+    };
+
+    // Not available for synthetic sources
+    const double temperature = logTemperature ? cameraSource->GetCameraTemperature() : std::numeric_limits<double>::quiet_NaN();
+    const double exposureTime = logExposureTime ? cameraSource->GetCameraExposureTime() : std::numeric_limits<double>::quiet_NaN();
+    const double gain = logGain ? cameraSource->GetCameraGain() : std::numeric_limits<double>::quiet_NaN();
+
+    if (!std::isnan(temperature)) {
+        addCommaIfRequired(); // actually never required - but why not make this look similar to the other items
+        logEntry << "temp: " << std::fixed << std::setprecision(2) << temperature;
+        metrics["temperature"] = temperature;
+    }
+
+    if (!std::isnan(exposureTime)) {
+        addCommaIfRequired();
+        logEntry << "exp t: " << std::fixed << std::setprecision(0) << exposureTime;
+        metrics["exposureTime"] = exposureTime;
+    }
+
+    if (!std::isnan(gain)) {
+        addCommaIfRequired();
+        logEntry << "gain: " << std::fixed << std::setprecision(0) << gain;
+        metrics["gain"] = gain;
+    }
+
+    const auto frames = cameraSource->GetAndResetFramesReceived();
+    metrics["framesComplete"] = frames.first;
+    metrics["framesIncomplete"] = frames.second;
+
+    addCommaIfRequired();
+
+    std::ostringstream oss;
+    oss << "fps: " << frames.first;
+    if (frames.second) {
+        oss << ", incomplete: " << frames.second;
+        numcfc::Logger::LogNoEcho((totalCount > 1 ? (id + ": ") : "") + oss.str(), "log_incomplete_frames");
+    }
+
+    const auto framesDropped = cameraSource->GetAndResetFramesDropped();
+    metrics["framesDropped"] = framesDropped;
+    if (framesDropped) {
+        oss << ", dropped: " << framesDropped;
+        numcfc::Logger::LogNoEcho((totalCount > 1 ? (id + ": ") : "") + oss.str(), "log_dropped_frames");
+    }
+
+    const auto framesUnchanged = cameraSource->GetAndResetFramesUnchanged();
+    metrics["framesUnchanged"] = framesUnchanged;
+    if (framesUnchanged) {
+        oss << ", unchanged: " << framesUnchanged;
+    }
+
+    const auto lateImageCount = cameraSource->GetAndResetLateImageCount();
+    metrics["imagesLate"] = lateImageCount;
+    if (lateImageCount) {
+        oss << ", late: " << lateImageCount;
+        numcfc::Logger::LogNoEcho((totalCount > 1 ? (id + ": ") : "") + oss.str(), "log_dropped_frames");
+    }
+
+    logEntry << oss.str();
+
+    const auto queueStatistics = cameraSource->GetAndResetImageEncodingQueueStatistics();
+    metrics["queueDepth"] = queueStatistics.depth;
+    metrics["imagesStolen"] = queueStatistics.stolenCount;
+    logEntry << ", queue: " << queueStatistics.depth;
+    if (queueStatistics.stolenCount) {
+        logEntry << " (stolen: " << queueStatistics.stolenCount << ")";
+    }
+
+    const auto bufferPoolStatistics = cameraSource->GetAndResetBufferPoolStatistics();
+    metrics["buffersHighWaterMark"] = bufferPoolStatistics.highWaterMark;
+    metrics["buffersUnpooled"] = bufferPoolStatistics.overflowCount;
+    logEntry << ", buffers: " << bufferPoolStatistics.highWaterMark;
+    if (bufferPoolStatistics.overflowCount) {
+        logEntry << " (+" << bufferPoolStatistics.overflowCount << " unpooled)";
+    }
+
+    const double cameraClockDrift_ppm = cameraSource->GetCameraClockDrift_ppm();
+    if (!std::isnan(cameraClockDrift_ppm)) {
+        logEntry << ", clock drift: " << std::fixed << std::setprecision(1) << cameraClockDrift_ppm << " ppm";
+        metrics["clockDrift_ppm"] = cameraClockDrift_ppm;
+    }
+
+    numcfc::Logger::LogAndEcho(logEntry.str());
+}
+
+int main(int argc, char* argv[])
+{
+#ifdef _WIN32
+    if (!SetConsoleCtrlHandler(consoleCtrlHandler, TRUE)) {
+        std::cerr << "Error calling SetConsoleCtrlHandler" << std::endl;
+    }
+#else
+    std::signal(SIGINT, signalHandler);
+    std::signal(SIGTERM, signalHandler);
+#endif
+
+    while (isRunning) {
+        try {
+            numcfc::IniFile iniFile("AlliedVision.ini");
+
+            claim::PostOffice postOffice;
+
+            postOffice.Initialize(iniFile, "AV");
+
+            // Can be replaced while running (see ApplyIniFileChanges below)
+            std::shared_ptr<const EncodingConfiguration> encodingConfiguration = ReadEncodingConfiguration(iniFile);
+
+            // Resolved here once, so that the size of the rings and the backlog target of the JPEG quality agree
+            const size_t configuredImageEncodingQueueLength = static_cast<size_t>(iniFile.GetSetValue("ImageEncoding", "MaxQueueLengthPerCamera", 100, "Images waiting to be encoded, per camera (0 = 1000)"));
+            const size_t maxImageEncodingQueueLength = configuredImageEncodingQueueLength > 0 ? configuredImageEncodingQueueLength : static_cast<size_t>(ImageEncodingQueue::defaultMaxItemCountPerCamera);
+
+            // Adaptive JPEG quality: JpegCompressionQuality is then the maximum
+            std::unique_ptr<JpegQualityController> jpegQualityController;
+            if (encodingConfiguration->isJpeg && iniFile.GetSetValue("ImageEncoding", "AdaptiveJpegQuality", 0.0, "Lower the JPEG quality (down to MinJpegCompressionQuality) when needed to stay within the targets") > 0.0) {
+                JpegQualityController::Settings settings;
+                settings.maxQuality = encodingConfiguration->imageEncoderSettings.jpegQuality;
+                settings.minQuality = std::min(settings.maxQuality, static_cast<int>(iniFile.GetSetValue("ImageEncoding", "MinJpegCompressionQuality", 50)));
+                settings.targetBytesPerSecond = 1e6 * iniFile.GetSetValue("ImageEncoding", "TargetBandwidth_MBps", 0.0, "Max encoded data rate of all cameras together (0 = no target)");
+                settings.targetEncodeTimeP95_ms = iniFile.GetSetValue("ImageEncoding", "TargetEncodeTimeP95_ms", 0.0, "Max 95th percentile of the encoding time per image (0 = no target)");
+                settings.maxBacklog = std::max<size_t>(1, maxImageEncodingQueueLength / 2); // lower the quality well before images get dropped
+                jpegQualityController.reset(new JpegQualityController(settings));
+            }
+
+            const std::string imageEncodingQueueOverloadPolicy = iniFile.GetSetValue("ImageEncoding", "QueueOverloadPolicy", "drop-oldest", "What to do when MaxQueueLengthPerCamera is reached - try \"drop-oldest\", \"drop-newest\", or \"block\"");
+
+            QueueOverloadPolicy queueOverloadPolicy = QueueOverloadPolicy::DropOldest;
+
+            if (tuc::string::equal_case_insensitive(imageEncodingQueueOverloadPolicy, "drop-newest")) {
+                queueOverloadPolicy = QueueOverloadPolicy::DropNewest;
+            }
+            else if (tuc::string::equal_case_insensitive(imageEncodingQueueOverloadPolicy, "block")) {
+                queueOverloadPolicy = QueueOverloadPolicy::Block;
+            }
+            else if (!tuc::string::equal_case_insensitive(imageEncodingQueueOverloadPolicy, "drop-oldest")) {
+                numcfc::Logger::LogAndEcho("Unexpected queue overload policy: " + imageEncodingQueueOverloadPolicy + " (using drop-oldest)", "log_errors");
+            }
+
+            const double reorderMaxHoldTime_ms = iniFile.GetSetValue("ImageEncoding", "ReorderMaxHoldTime_ms", 500.0, "Max time to hold an encoded image while waiting for older images to be encoded (0 = send in whatever order encoding completes)");
+
+            // Where the threads run; cores are given as e.g. "0-7,16-23"
+            const std::string coreBudgetFile = iniFile.GetSetValue("Threading", "CoreBudgetFile", "", "A file shared with the other services on this host (e.g. FindThings), with lines like \"AlliedVision = 0-11\"; empty = no budget");
+            const std::string coreBudgetName = iniFile.GetSetValue("Threading", "CoreBudgetName", "AlliedVision", "The name of this service in CoreBudgetFile");
+            const std::string encoderCoresString = iniFile.GetSetValue("Threading", "EncoderCores", "", "The cores of the encoding threads; empty = all the cores in the budget (or any, if no budget)");
+            const std::string encoderPinning = iniFile.GetSetValue("Threading", "EncoderPinning", "set", "\"set\": each encoding thread may run on any of EncoderCores, or \"core\": each one on a core of its own");
+            const std::string encoderPriority = iniFile.GetSetValue("Threading", "EncoderPriority", "normal", "Try \"lowest\", \"below-normal\", \"normal\", \"above-normal\", or \"highest\"");
+            const std::string receiverCoresString = iniFile.GetSetValue("Threading", "ReceiverCores", "", "The cores of the threads that receive the frames (the Vimba callbacks); empty = all the cores in the budget (or any)");
+            const std::string receiverPriority = iniFile.GetSetValue("Threading", "ReceiverPriority", "normal");
+            const std::string numaNodeString = iniFile.GetSetValue("Threading", "NumaNode", "", "With [FrameBuffers] Arena: keep the frames on this NUMA node - that of the network adapter the cameras are on (see /sys/class/net/<adapter>/device/numa_node, or the adapter in Device Manager) - or on that of the first encoder core, with \"encoders\"; empty = no preference");
+
+            thread_placement::CoreSet budgetCores;
+            if (!coreBudgetFile.empty()) {
+                const thread_placement::CoreBudget coreBudget = thread_placement::ReadCoreBudget(coreBudgetFile);
+                for (const std::string& overlap : thread_placement::FindOverlaps(coreBudget)) {
+                    numcfc::Logger::LogAndEcho("Core budget " + coreBudgetFile + ": " + overlap, "log_errors");
+                }
+                const auto i = coreBudget.find(coreBudgetName);
+                if (i == coreBudget.end() || i->second.empty()) {
+                    numcfc::Logger::LogAndEcho("Core budget " + coreBudgetFile + ": no cores for " + coreBudgetName + " (not restricting)", "log_errors");
+                }
+                else {
+                    budgetCores = i->second;
+                    if (thread_placement::RestrictProcess(budgetCores)) {
+                        numcfc::Logger::LogAndEcho("Core budget: cores " + thread_placement::FormatCoreSet(budgetCores), "log_init");
+                    }
+                    else {
+                        numcfc::Logger::LogAndEcho("Unable to restrict the process to cores " + thread_placement::FormatCoreSet(budgetCores) + " (placing the threads of our own only)", "log_errors");
+                    }
+                }
+            }
+
+            // The cores of the threads, limited to the budget
+            const auto getCores = [&](const std::string& coresString, const std::string& threads) {
+                thread_placement::CoreSet cores = thread_placement::ParseCoreSet(coresString);
+                if (cores.empty() || budgetCores.empty()) {
+                    return cores.empty() ? budgetCores : cores;
+                }
+                const thread_placement::CoreSet coresInBudget = thread_placement::Intersect(cores, budgetCores);
+                if (coresInBudget.size() < cores.size()) {
+                    numcfc::Logger::LogAndEcho("The " + threads + " cores " + coresString + " are not all in the core budget " + thread_placement::FormatCoreSet(budgetCores), "log_errors");
+                }
+                if (coresInBudget.empty()) {
+                    throw std::runtime_error("No " + threads + " cores left in the core budget");
+                }
+                return coresInBudget;
+            };
+
+            const auto getPriority = [](const std::string& priorityString) {
+                thread_placement::Priority priority = thread_placement::Priority::Normal;
+                if (!thread_placement::ParsePriority(priorityString, priority)) {
+                    numcfc::Logger::LogAndEcho("Unexpected thread priority: " + priorityString + " (using normal)", "log_errors");
+                }
+                return priority;
+            };
+
+            thread_placement::Placement encoderPlacement;
+            encoderPlacement.cores = getCores(encoderCoresString, "encoder");
+            encoderPlacement.onePerCore = tuc::string::equal_case_insensitive(encoderPinning, "core");
+            encoderPlacement.priority = getPriority(encoderPriority);
+            if (!encoderPlacement.onePerCore && !tuc::string::equal_case_insensitive(encoderPinning, "set")) {
+                numcfc::Logger::LogAndEcho("Unexpected encoder pinning: " + encoderPinning + " (using set)", "log_errors");
+            }
+
+            thread_placement::Placement receivingThreadPlacement;
+            receivingThreadPlacement.cores = getCores(receiverCoresString, "receiver");
+            receivingThreadPlacement.priority = getPriority(receiverPriority);
+
+            int numaNode = -1;
+            if (tuc::string::equal_case_insensitive(numaNodeString, "encoders")) {
+                if (encoderPlacement.cores.empty()) {
+                    numcfc::Logger::LogAndEcho("NumaNode = encoders, but no encoder cores set (no NUMA node preference)", "log_errors");
+                }
+                else {
+                    numaNode = thread_placement::GetNumaNode(encoderPlacement.cores.front());
+                }
+            }
+            else if (!numaNodeString.empty()) {
+                numaNode = std::stoi(numaNodeString);
+            }
+
+            // By default, one encoding thread per encoder core
+            const auto defaultImageEncodingThreadCount = encoderPlacement.cores.empty()
+                ? std::max(2u, std::thread::hardware_concurrency()) - 1
+                : static_cast<unsigned int>(encoderPlacement.cores.size());
+            const size_t imageEncodingThreadCount = static_cast<size_t>(iniFile.GetSetValue("ImageEncoding", "ThreadCount", defaultImageEncodingThreadCount));
+
+            const size_t totalFrameBufferCount = static_cast<size_t>(iniFile.GetSetValue("FrameBuffers", "TotalCount", 100, "Split evenly among the cameras found at startup; cameras plugged in later get the same share"));
+            const double frameBufferMemoryBudget_MiB = iniFile.GetSetValue("FrameBuffers", "MemoryBudget_MiB", 0.0, "If positive, split this among the cameras based on their payload size and frame rate, instead of splitting TotalCount evenly");
+            const double targetFrameBuffering_ms = iniFile.GetSetValue("FrameBuffers", "TargetBuffering_ms", 500.0, "With MemoryBudget_MiB: how long each camera should be able to keep going while no frame buffers are handed back");
+            const size_t minFrameBufferCountPerCamera = static_cast<size_t>(iniFile.GetSetValue("FrameBuffers", "MinCountPerCamera", 3));
+            const double assumedFrameRate = iniFile.GetSetValue("FrameBuffers", "AssumedFrameRate", 30.0, "With MemoryBudget_MiB: for cameras that do not tell their frame rate");
+            const double maxFrameBufferingScale = iniFile.GetSetValue("FrameBuffers", "MaxBufferingScale", 4.0, "With MemoryBudget_MiB: how far the buffering of a camera can be grown beyond the target, if it runs out of buffers");
+            const bool useFrameBufferArena = iniFile.GetSetValue("FrameBuffers", "Arena", 1.0, "Allocate the frames of each camera as one page-aligned block, up front (instead of letting Vimba allocate each frame)") > 0.0;
+            FrameBufferArena::Settings frameBufferArenaSettings;
+            frameBufferArenaSettings.largePages = iniFile.GetSetValue("FrameBuffers", "LargePages", 0.0, "With Arena: use large pages, if the account has the \"Lock pages in memory\" privilege") > 0.0;
+            frameBufferArenaSettings.lock = iniFile.GetSetValue("FrameBuffers", "Lock", 0.0, "With Arena: lock the frames in memory, so that they are never paged out") > 0.0;
+            frameBufferArenaSettings.numaNode = numaNode;
+            const bool zeroCopy = iniFile.GetSetValue("FrameBuffers", "ZeroCopy", 0.0) > 0.0;
+            const size_t zeroCopyMinQueuedFrameCount = static_cast<size_t>(iniFile.GetSetValue("FrameBuffers", "ZeroCopyMinQueuedCount", 4));
+            const size_t maxPooledBufferCount = static_cast<size_t>(iniFile.GetSetValue("FrameBuffers", "MaxPooledCountPerCamera", 50));
+
+            // Can be overridden per camera in [NoImagesTimeouts], with the camera id as the key
+            const double defaultNoImagesTimeout_s = iniFile.GetSetValue("Operation", "NoImagesTimeout_s", 10.0);
+            const double minReconnectBackoff_s = iniFile.GetSetValue("Operation", "MinReconnectBackoff_s", 1.0, "Time to wait before reopening a failed camera; doubled after each failed attempt");
+            const double maxReconnectBackoff_s = iniFile.GetSetValue("Operation", "MaxReconnectBackoff_s", 60.0);
+
+            const bool useCameraClock = iniFile.GetSetValue("Timestamps", "UseCameraClock", 1.0, "Timestamp the images using the camera clock (mapped to host time), instead of the time of receiving") > 0.0;
+
+            const bool logTemperature =  iniFile.GetSetValue("Logging", "LogTemperature",  1.0) > 0.0;
+            const bool logExposureTime = iniFile.GetSetValue("Logging", "LogExposureTime", 1.0) > 0.0;
+            const bool logGain =         iniFile.GetSetValue("Logging", "LogGain",         1.0) > 0.0;
+
+            const bool publishMetrics = iniFile.GetSetValue("Logging", "PublishMetrics", 1.0, "Send a \"Metrics\" message (JSON) every second") > 0.0;
+
+            const std::string sourceType = iniFile.GetSetValue("Source", "Type", "vimba", "\"vimba\" (the cameras), or \"synthetic\" (test patterns, or the images in ReplayDirectory)");
+            const bool useVimba = !tuc::string::equal_case_insensitive(sourceType, "synthetic");
+            if (useVimba && !tuc::string::equal_case_insensitive(sourceType, "vimba")) {
+                numcfc::Logger::LogAndEcho("Unexpected source type: " + sourceType + " (using vimba)", "log_errors");
+            }
+
+            size_t syntheticSourceCount = 0;
+            SyntheticCameraSource::Settings syntheticSourceSettings;
+            if (!useVimba) {
+                syntheticSourceCount = static_cast<size_t>(iniFile.GetSetValue("Source", "Count", 1));
+                syntheticSourceSettings.pattern = iniFile.GetSetValue("Source", "Pattern", syntheticSourceSettings.pattern, "Try \"gradient\", \"checkerboard\", or \"noise\"");
+                syntheticSourceSettings.replayDirectory = iniFile.GetSetValue("Source", "ReplayDirectory", "", "Replay the images (raw, qoi, or anything OpenCV can read) in this directory, instead of making up test patterns");
+                syntheticSourceSettings.width = static_cast<int>(iniFile.GetSetValue("Source", "Width", syntheticSourceSettings.width));
+                syntheticSourceSettings.height = static_cast<int>(iniFile.GetSetValue("Source", "Height", syntheticSourceSettings.height));
+                syntheticSourceSettings.noiseLevel = iniFile.GetSetValue("Source", "NoiseLevel", syntheticSourceSettings.noiseLevel);
+                syntheticSourceSettings.fps = iniFile.GetSetValue("Source", "FPS", syntheticSourceSettings.fps);
+                syntheticSourceSettings.distinctFrameCount = static_cast<size_t>(iniFile.GetSetValue("Source", "DistinctFrames", static_cast<double>(syntheticSourceSettings.distinctFrameCount)));
+
+                const std::string pixelFormat = iniFile.GetSetValue("Source", "PixelFormat", "", "E.g., \"Mono12p\" or \"BayerRG8\" (default: Mono8, or BGR8 for color images replayed)");
+                if (!pixelFormat.empty()) {
+                    if (!ParsePixelFormat(pixelFormat, syntheticSourceSettings.pixelFormat)) {
+                        throw std::runtime_error("Unsupported pixel format: " + pixelFormat);
+                    }
+                    syntheticSourceSettings.pixelFormatSet = true;
+                }
+            }
+
+            const bool useChangeGate = iniFile.GetSetValue("ChangeGate", "Enabled", 0.0, "Skip the frames that look the same as the last frame sent, e.g. while the line is idle") > 0.0;
+            ChangeGate::Settings changeGateSettings;
+            changeGateSettings.thumbnailWidth = static_cast<int>(iniFile.GetSetValue("ChangeGate", "ThumbnailWidth", changeGateSettings.thumbnailWidth, "The frames are compared as grayscale thumbnails of this width, pixel by pixel"));
+            changeGateSettings.cellThreshold = iniFile.GetSetValue("ChangeGate", "CellThreshold", changeGateSettings.cellThreshold, "How much a thumbnail pixel needs to change to count, in 8-bit levels");
+            changeGateSettings.minChangedCellCount = static_cast<size_t>(iniFile.GetSetValue("ChangeGate", "MinChangedCells", static_cast<double>(changeGateSettings.minChangedCellCount), "How many thumbnail pixels need to change for the frame to be sent"));
+            changeGateSettings.heartbeatInterval_s = iniFile.GetSetValue("ChangeGate", "HeartbeatInterval_s", changeGateSettings.heartbeatInterval_s, "Send an unchanged frame anyway at least this often (0 = never)");
+
+            // Each camera gets a gate of its own
+            const auto createChangeGate = [&]() {
+                return std::unique_ptr<ChangeGate>(useChangeGate ? new ChangeGate(changeGateSettings) : nullptr);
+            };
+
+            const bool useRawRecording = iniFile.GetSetValue("RawRecording", "Enabled", 0.0, "Keep the latest raw frames of each camera in a ring file, to be frozen with a FreezeRecording message and converted with RawExport") > 0.0;
+            const std::string rawRecordingDirectory = iniFile.GetSetValue("RawRecording", "Directory", "", "Where the ring files go (default: the working directory) - preferably a fast drive of its own");
+            const double rawRecordingSize_GiB = iniFile.GetSetValue("RawRecording", "Size_GiB", 4.0, "Per camera; when full, the oldest frames are overwritten");
+            const double rawRecordingFreezeDelay_s = iniFile.GetSetValue("RawRecording", "FreezeDelay_s", 2.0, "How long to keep recording after a FreezeRecording message, unless the message says otherwise (delay_s)");
+
+            if (useRawRecording) {
+                postOffice.Subscribe("FreezeRecording");
+                postOffice.Subscribe("ResumeRecording");
+            }
+
+            // By camera id; kept over reconnects, and outlives the sources (and Vimba) that write into them
+            std::map<std::string, std::shared_ptr<RawRecorder>> rawRecorders;
+
+            // A new ring file is made only if the frames no longer fit, and the old one is not frozen
+            const auto attachRawRecorder = [&](CameraSource& cameraSource, const std::string& id, size_t maxFrameSize) {
+                std::shared_ptr<RawRecorder>& rawRecorder = rawRecorders[id];
+                if (!rawRecorder || (rawRecorder->GetSlotSize() < maxFrameSize && !rawRecorder->IsFrozen())) {
+                    // The new file has the same name, so the old one must be closed first: detached
+                    // from the source, the recorder is released here (the source is not acquiring)
+                    cameraSource.SetRawRecorder(nullptr);
+                    rawRecorder.reset();
+                    const std::string filename = (rawRecordingDirectory.empty() ? "" : rawRecordingDirectory + "/") + "RawRecording_" + id + ".ring";
+                    rawRecorder = std::make_shared<RawRecorder>(filename, static_cast<uint64_t>(rawRecordingSize_GiB * 1073741824.0), maxFrameSize, id);
+                    numcfc::Logger::LogAndEcho("Camera " + id + ": raw recording " + rawRecorder->GetDescription(), "log_init");
+                }
+                cameraSource.SetRawRecorder(rawRecorder);
+            };
+
+            if (iniFile.IsDirty()) {
+                iniFile.Save();
+            }
+
+            using namespace AVT::VmbAPI;
+
+            auto& vimbaSystem = VimbaSystem::GetInstance();
+
+            numcfc::Logger::LogAndEcho("Pixel format conversions using " + GetPixelFormatConversionInstructionSet(), "log_init");
+
+            if (useVimba) {
+                LogVimbaVersion(vimbaSystem);
+
+                numcfc::Logger::LogAndEcho("Starting Vimba system...", "log_init");
+
+                CHECK_VIMBA(vimbaSystem.Startup());
+            }
+
+            // Declared before imageEncodingInput, because any items left in the queue will still refer to this
+            ImageReorderer imageReorderer(
+                std::chrono::milliseconds(static_cast<int>(std::round(reorderMaxHoldTime_ms))),
+                [&postOffice](claim::AttributeMessage& amsg, std::chrono::steady_clock::time_point traceOrigin) {
+                    AddLatencyTrace(amsg, "sent", traceOrigin, std::chrono::steady_clock::now());
+                    postOffice.Send(amsg);
+                }
+            );
+
+            // One encoder per thread, created here so that any errors surface before the threads start
+            std::vector<std::unique_ptr<ImageEncoder>> imageEncoders;
+            for (size_t i = 0; i < imageEncodingThreadCount; ++i) {
+                imageEncoders.push_back(CreateImageEncoder(encodingConfiguration->imageEncoderBackend, encodingConfiguration->imageEncoderSettings));
+            }
+
+            if (!imageEncoders.empty()) {
+                numcfc::Logger::LogAndEcho("Encoding images using " + imageEncoders.front()->GetName(), "log_init");
+            }
+
+            if (!encoderPlacement.cores.empty()) {
+                numcfc::Logger::LogAndEcho("Encoding threads on cores " + thread_placement::FormatCoreSet(encoderPlacement.cores) + (encoderPlacement.onePerCore ? ", one per core" : ""), "log_init");
+            }
+
+            ImageEncodingQueue imageEncodingInput(maxImageEncodingQueueLength, queueOverloadPolicy, imageEncodingThreadCount);
+
+            const auto encodeImages = [&](size_t threadIndex) {
+
+                if (!thread_placement::ApplyToCurrentThread(encoderPlacement, threadIndex)) {
+                    numcfc::Logger::LogAndEcho("Unable to place encoding thread " + std::to_string(threadIndex) + " on cores " + thread_placement::FormatCoreSet(encoderPlacement.cores)
+                        + " with priority " + thread_placement::ToString(encoderPlacement.priority), "log_errors");
+                }
+
+                std::shared_ptr<const EncodingConfiguration> configuration = std::atomic_load(&encodingConfiguration);
+                std::unique_ptr<ImageEncoder> imageEncoder = std::move(imageEncoders[threadIndex]);
+                int jpegQuality = configuration->imageEncoderSettings.jpegQuality;
+
+                while (imageEncodingInput.is_enabled()) {
+                    ImageEncodingInputItem item;
+                    if (imageEncodingInput.pop_front(item, std::chrono::milliseconds(1000), threadIndex)) {
+                        const auto dequeued = std::chrono::steady_clock::now();
+
+                        // Pick up any changed settings between images
+                        const auto latestConfiguration = std::atomic_load(&encodingConfiguration);
+                        if (latestConfiguration != configuration) {
+                            try {
+                                imageEncoder = CreateImageEncoder(latestConfiguration->imageEncoderBackend, latestConfiguration->imageEncoderSettings);
+                                jpegQuality = latestConfiguration->imageEncoderSettings.jpegQuality;
+                            }
+                            catch (std::exception& e) {
+                                numcfc::Logger::LogAndEcho(std::string("Unable to create image encoder: ") + e.what(), "log_errors");
+                            }
+                            configuration = latestConfiguration;
+                        }
+
+                        const std::string& imageFormat = configuration->imageFormat;
+                        const bool isJpeg = configuration->isJpeg;
+                        const DebayerMode debayerMode = configuration->debayerMode;
+                        const int previewMaxWidth = configuration->previewMaxWidth;
+
+                        const std::string timestamp = system_clock_time_point_string_conversion::to_string(item.timestamp);
 
-                    std::string id;
+                        const auto getId = [](const std::string& timestamp, size_t counter, const std::string& suffix, const std::string& imageFormat) {
+                            std::string id = timestamp;
+                            std::replace(id.begin(), id.end(), ':', '.');
+                            std::ostringstream oss;
+                            oss << std::hex << std::setw(16) << std::setfill('0') << counter;
+                            id += "_" + oss.str() + suffix + "." + imageFormat;
+                            return id;
+                        };
+
+                        const bool hasRegionsOfInterest = item.regionsOfInterest && !item.regionsOfInterest->empty();
+                        const size_t regionCount = hasRegionsOfInterest ? item.regionsOfInterest->size() : 1;
+
+                        std::vector<claim::AttributeMessage> messages;
+
+                        for (size_t regionIndex = 0; regionIndex < regionCount; ++regionIndex) {
+                            // Only the pixels inside the region of interest are converted and encoded
+                            cv::Rect roi;
+                            cv::Mat rawData;
+                            if (hasRegionsOfInterest) {
+                                roi = (*item.regionsOfInterest)[regionIndex];
+                                rawData = GetRegionOfInterest(item.rawData, item.pixelFormat, roi);
+                                if (rawData.empty()) {
+                                    numcfc::Logger::LogAndEcho("Region of interest " + std::to_string(regionIndex + 1) + " is outside the image", "log_errors");
+                                    continue;
+                                }
+                            }
+                            else {
+                                rawData = item.rawData;
+                            }
+
+                            const auto conversionStarted = std::chrono::steady_clock::now();
+
+                            cv::Mat image;
+                            std::shared_ptr<void> imageOwner;
+
+                            if (!IsSupportedPixelFormat(item.pixelFormat)) {
+                                numcfc::Logger::LogAndEcho("Unsupported pixel format: " + GetPixelFormatName(item.pixelFormat), "log_errors");
+                                image = rawData;
+                            }
+                            else if (IsPassThroughPixelFormat(item.pixelFormat)) {
+                                image = rawData;
+                            }
+                            else {
+                                const cv::Size imageSize = GetConvertedImageSize(rawData, item.pixelFormat, debayerMode);
+                                imageOwner = item.bufferPool->Borrow(imageSize.height, imageSize.width, GetConvertedImageType(item.pixelFormat), image);
+                                ConvertPixelFormat(rawData, item.pixelFormat, image, debayerMode);
+                            }
+
+                            const auto converted = std::chrono::steady_clock::now();
+
+                            // How many image pixels there are per sensor pixel, in each direction
+                            const double scale = image.cols / static_cast<double>(GetImageSize(rawData, item.pixelFormat).width);
+
+                            // The preview is made from the already-converted image, so that the debayering is not repeated
+                            cv::Mat preview;
+                            std::shared_ptr<void> previewOwner;
+                            if (previewMaxWidth > 0 && image.cols > previewMaxWidth) {
+                                const int previewHeight = std::max(1, static_cast<int>(std::round(image.rows * previewMaxWidth / static_cast<double>(image.cols))));
+                                previewOwner = item.bufferPool->Borrow(previewHeight, previewMaxWidth, image.type(), preview);
+                                cv::resize(image, preview, preview.size(), 0.0, 0.0, cv::INTER_AREA);
+                            }
+
+                            if (jpegQualityController && jpegQualityController->GetQuality() != jpegQuality) {
+                                jpegQuality = jpegQualityController->GetQuality();
+                                imageEncoder->SetJpegQuality(jpegQuality);
+                            }
+
+                            // Encoded straight into what becomes the payload of the messages
+                            std::string encodedImage;
+                            std::string encodedPreview;
+                            std::chrono::steady_clock::time_point encoded;
+
+                            try {
+                                const auto encodingStarted = std::chrono::steady_clock::now();
+
+                                imageEncoder->Encode(image, encodedImage);
+
+                                if (!preview.empty()) {
+                                    imageEncoder->Encode(preview, encodedPreview);
+                                }
+
+                                encoded = std::chrono::steady_clock::now();
+
+                                const size_t encodedByteCount = encodedImage.size() + encodedPreview.size();
+                                const double encodeTime_ms = std::chrono::duration<double, std::milli>(encoded - encodingStarted).count();
+
+                                if (jpegQualityController) {
+                                    jpegQualityController->AddSample(encodedByteCount, encodeTime_ms);
+                                }
+
+                                if (item.metrics) {
+                                    const double conversionTime_ms = std::chrono::duration<double, std::milli>(converted - conversionStarted).count();
+                                    item.metrics->AddImage(encodedByteCount, conversionTime_ms, encodeTime_ms);
+                                }
+                            }
+                            catch (std::exception& e) {
+                                // The image is skipped, but the thread keeps going
+                                numcfc::Logger::LogAndEcho(std::string("Unable to encode image: ") + e.what(), "log_errors");
+                                continue;
+                            }
+
+                            // With several regions, each gets an id of its own
+                            const std::string idSuffix = regionCount > 1 ? "_roi" + std::to_string(regionIndex + 1) : "";
+
+                            claim::AttributeMessage amsg;
+                            amsg.m_type = "Image";
+                            amsg.m_attributes["id"] = getId(timestamp, item.counter, idSuffix, imageFormat);
+                            amsg.m_attributes["timestamp"] = timestamp;
+                            amsg.m_attributes["counter"] = std::to_string(item.counter);
+                            amsg.m_attributes["rows"] = std::to_string(image.rows);
+                            amsg.m_attributes["cols"] = std::to_string(image.cols);
+                            amsg.m_attributes["scale"] = std::to_string(scale);
+                            if (hasRegionsOfInterest) {
+                                // Where the image is on the sensor: sensor x = offsetX + image x / scale
+                                amsg.m_attributes["offsetX"] = std::to_string(roi.x);
+                                amsg.m_attributes["offsetY"] = std::to_string(roi.y);
+                                amsg.m_attributes["roiIndex"] = std::to_string(regionIndex);
+                            }
+                            amsg.m_attributes["format"] = imageFormat;
+                            if (isJpeg) {
+                                amsg.m_attributes["jpegQuality"] = std::to_string(static_cast<double>(jpegQuality));
+                            }
+
+                            if (!std::isnan(item.cameraToCallback_us)) {
+                                amsg.m_attributes["trace_cameraToCallback_us"] = std::to_string(static_cast<long long>(std::round(item.cameraToCallback_us)));
+                            }
+                            AddLatencyTrace(amsg, "dequeued", item.callbackEntered, dequeued);
+                            AddLatencyTrace(amsg, "converted", item.callbackEntered, converted);
+                            AddLatencyTrace(amsg, "encoded", item.callbackEntered, encoded);
+
+                            if (previewMaxWidth > 0) {
+                                // Same id as the full-size image, so that any results can be matched to it
+                                claim::AttributeMessage previewMessage = amsg; // copied before the full-size data is added
+                                previewMessage.m_type = "ImagePreview";
+                                if (!preview.empty()) {
+                                    // How many preview pixels there are per full-size image pixel, in each direction
+                                    const double previewScale = preview.cols / static_cast<double>(image.cols);
+                                    previewMessage.m_attributes["rows"] = std::to_string(preview.rows);
+                                    previewMessage.m_attributes["cols"] = std::to_string(preview.cols);
+                                    previewMessage.m_attributes["scale"] = std::to_string(scale * previewScale);
+                                    previewMessage.m_attributes["previewScale"] = std::to_string(previewScale);
+                                    previewMessage.m_attributes["data"] = std::move(encodedPreview);
+                                }
+                                else {
+                                    previewMessage.m_attributes["previewScale"] = "1";
+                                    previewMessage.m_attributes["data"] = encodedImage; // the only copy: both messages need the full-size data
+                                }
+                                amsg.m_attributes["data"] = std::move(encodedImage);
+                                messages.push_back(std::move(amsg));
+                                messages.push_back(std::move(previewMessage));
+                            }
+                            else {
+                                amsg.m_attributes["data"] = std::move(encodedImage);
+                                messages.push_back(std::move(amsg));
+                            }
+                        }
+
+                        // Sent even if empty, to release the reorder ticket
+                        imageReorderer.Send(item.reorderTicket, std::move(messages), item.callbackEntered);
+                    }
+                    else {
+                        imageReorderer.SendExpired();
+                    }
+                }
+            };
+
+            CameraListObserver* cameraListObserver = new CameraListObserver;
+            ICameraListObserverPtr cameraListObserverPtr(cameraListObserver);
+
+            std::deque<std::thread> imageEncodingThreads;
+            for (size_t i = 0; i < imageEncodingThreadCount; ++i) {
+                imageEncodingThreads.emplace_back(encodeImages, i);
+            }
+
+            try {
+                std::map<std::string, SupervisedCamera> supervisedCameras;
+
+                const auto addCamera = [&](const CameraPtr& camera) {
+                    std::string model, id;
+                    CHECK_VIMBA(camera->GetModel(model));
                     CHECK_VIMBA(camera->GetID(id));
+                    numcfc::Logger::LogAndEcho("  " + id + " : " + model, "log_init");
+
+                    const std::string noImagesTimeoutValue = iniFile.GetValue("NoImagesTimeouts", id);
+
+                    SupervisedCamera& supervisedCamera = supervisedCameras[id];
+                    supervisedCamera.camera = camera;
+                    supervisedCamera.cameraIndex = supervisedCameras.size() - 1;
+                    supervisedCamera.noImagesTimeout_s = noImagesTimeoutValue.empty() ? defaultNoImagesTimeout_s : std::stod(noImagesTimeoutValue);
+                };
+
+                if (useVimba) {
+                    numcfc::Logger::LogAndEcho("Vimba system started.", "log_init");
+
+                    // Without continuous discovery, GigE cameras plugged in later would not be noticed
+                    {
+                        FeaturePtr feature;
+                        if (vimbaSystem.GetFeatureByName("GeVDiscoveryAllAuto", feature) == VmbErrorSuccess) {
+                            feature->RunCommand();
+                        }
+                    }
+
+                    CHECK_VIMBA(vimbaSystem.RegisterCameraListObserver(cameraListObserverPtr));
+
+                    CameraPtrVector cameras;
+
+                    CHECK_VIMBA(vimbaSystem.GetCameras(cameras));
+
+                    if (cameras.empty()) {
+                        numcfc::Logger::LogAndEcho("No cameras found - waiting for some to be plugged in", "log_init");
+                    }
+                    else {
+                        numcfc::Logger::LogAndEcho("Found " + std::to_string(cameras.size()) + " camera" + (cameras.size() == 1 ? "" : "s") + ":", "log_init");
+                    }
+
+                    for (const auto& camera : cameras) {
+                        addCamera(camera);
+                    }
+                }
+
+                // E.g., "0,800,4096,1000; 0,2000,4096,1000" to send two bands of the sensor as separate images
+                const auto getRegionsOfInterest = [&](const std::string& id) {
+                    std::string regionsOfInterestValue = iniFile.GetValue("RegionsOfInterest", id);
+                    if (regionsOfInterestValue.empty()) {
+                        regionsOfInterestValue = iniFile.GetValue("RegionsOfInterest", "Default");
+                    }
+                    const std::vector<cv::Rect> regionsOfInterest = ParseRegionsOfInterest(regionsOfInterestValue);
+
+                    for (const auto& roi : regionsOfInterest) {
+                        numcfc::Logger::LogAndEcho("Camera " + id + ": region of interest " + std::to_string(roi.x) + "," + std::to_string(roi.y) + "," + std::to_string(roi.width) + "," + std::to_string(roi.height), "log_init");
+                    }
+
+                    return regionsOfInterest;
+                };
+
+                const auto setState = [&](const std::string& id, SupervisedCamera& supervisedCamera, CameraState state, const std::string& reason) {
+                    numcfc::Logger::LogAndEcho("Camera " + id + ": " + GetCameraStateName(supervisedCamera.state) + " -> " + GetCameraStateName(state)
+                        + (reason.empty() ? "" : " (" + reason + ")"), "log_camera_state");
+                    supervisedCamera.state = state;
+                    supervisedCamera.stateEntered = std::chrono::steady_clock::now();
+                };
+
+                // Without a memory budget, TotalCount is split evenly among the cameras found at startup;
+                // any plugged in later get the same share, even if the total then exceeds TotalCount
+                const size_t frameBufferCountPerCamera = std::max(static_cast<size_t>(1), totalFrameBufferCount / std::max(static_cast<size_t>(1), supervisedCameras.size()));
+                if (frameBufferMemoryBudget_MiB <= 0.0) {
+                    numcfc::Logger::LogAndEcho(std::to_string(frameBufferCountPerCamera) + " frame buffers per camera (TotalCount = " + std::to_string(totalFrameBufferCount)
+                        + ", " + std::to_string(supervisedCameras.size()) + " camera" + (supervisedCameras.size() == 1 ? "" : "s") + " found); cameras plugged in later get as many", "log_init");
+                }
+
+                // With a memory budget, how many frames to announce for a camera: see PlanFrameBuffers. The
+                // frames announced by the others may have been planned when fewer cameras were known, so
+                // the camera gets no more than what they have left over.
+                const auto planFrameBufferCount = [&](const SupervisedCamera& supervisedCamera) {
+                    const double memoryBudget_bytes = frameBufferMemoryBudget_MiB * 1024 * 1024;
+
+                    std::vector<FrameBufferDemand> demands;
+                    size_t index = 0;
+                    double announcedByOthers_bytes = 0.0;
+                    for (const auto& i : supervisedCameras) {
+                        if (&i.second == &supervisedCamera) {
+                            index = demands.size();
+                        }
+                        else {
+                            announcedByOthers_bytes += static_cast<double>(i.second.frames.size()) * i.second.frameBufferDemand.payloadSize;
+                        }
+                        demands.push_back(i.second.frameBufferDemand);
+                    }
+
+                    const size_t frameCount = PlanFrameBuffers(demands, memoryBudget_bytes, targetFrameBuffering_ms / 1000.0, minFrameBufferCountPerCamera)[index];
+                    const size_t leftOverFrameCount = static_cast<size_t>(std::max(0.0, memoryBudget_bytes - announcedByOthers_bytes) / supervisedCamera.frameBufferDemand.payloadSize);
+
+                    return std::min(frameCount, std::max(minFrameBufferCountPerCamera, leftOverFrameCount));
+                };
+
+                const auto startAcquisition = [&](SupervisedCamera& supervisedCamera, const std::string& id) {
+                    CameraPtr& camera = supervisedCamera.camera;
+                    FeaturePtr feature;
+
+                    VmbInt64_t payloadSize = -1;
+                    CHECK_VIMBA(camera->GetFeatureByName("PayloadSize", feature));
+                    CHECK_VIMBA(feature->GetValue(payloadSize));
 
                     numcfc::Logger::LogAndEcho("Camera " + id + ": payload size = " + std::to_string(payloadSize), "log_init");
 
-                    frameObservers[id].first = new FrameObserver(camera, imageEncodingInput);
-                    frameObservers[id].second.reset(frameObservers[id].first);
- 
-                    frames[id].resize(frameCount);
+                    if (payloadSize <= 0) {
+                        throw std::runtime_error("Unexpected payload size: " + std::to_string(payloadSize));
+                    }
+
+                    double frameRate = GetAcquisitionFrameRate(camera);
+                    if (std::isnan(frameRate)) {
+                        numcfc::Logger::LogAndEcho("Camera " + id + ": frame rate not available (assuming " + std::to_string(assumedFrameRate) + " fps)", "log_init");
+                        frameRate = assumedFrameRate;
+                    }
+
+                    supervisedCamera.frameBufferDemand.payloadSize = payloadSize;
+                    supervisedCamera.frameBufferDemand.frameRate = frameRate;
+
+                    supervisedCamera.frames.clear();
+
+                    size_t frameCount = frameBufferCountPerCamera;
+
+                    if (frameBufferMemoryBudget_MiB <= 0.0) {
+                        size_t announcedCount = frameCount;
+                        for (const auto& i : supervisedCameras) {
+                            announcedCount += i.second.frames.size();
+                        }
+                        if (announcedCount > totalFrameBufferCount) {
+                            numcfc::Logger::LogAndEcho("Camera " + id + ": " + std::to_string(frameCount) + " frame buffers, making " + std::to_string(announcedCount)
+                                + " for all cameras, more than TotalCount = " + std::to_string(totalFrameBufferCount) + " (more cameras than found at startup)", "log_init");
+                        }
+                    }
+                    else {
+                        frameCount = planFrameBufferCount(supervisedCamera);
+
+                        double announced_bytes = static_cast<double>(frameCount) * payloadSize;
+                        for (const auto& i : supervisedCameras) {
+                            announced_bytes += static_cast<double>(i.second.frames.size()) * i.second.frameBufferDemand.payloadSize;
+                        }
+
+                        std::ostringstream oss;
+                        oss << std::fixed << std::setprecision(1)
+                            << "Camera " << id << ": " << frameCount << " frame buffers = " << static_cast<double>(frameCount) * payloadSize / (1024 * 1024) << " MiB"
+                            << " = " << std::setprecision(0) << 1000.0 * frameCount / frameRate << " ms at " << std::setprecision(1) << frameRate << " fps"
+                            << " (all cameras: " << announced_bytes / (1024 * 1024) << " MiB of " << frameBufferMemoryBudget_MiB << " MiB)";
+                        numcfc::Logger::LogAndEcho(oss.str(), "log_init");
+                    }
+
+                    supervisedCamera.frames.resize(frameCount);
+
+                    std::shared_ptr<FrameBufferArena>& frameBufferArena = supervisedCamera.frameBufferArena;
+                    if (!useFrameBufferArena) {
+                        frameBufferArena.reset();
+                    }
+                    else if (!frameBufferArena || frameBufferArena.use_count() > 1 // frames still lent out of it
+                        || frameBufferArena->GetBufferSize() != static_cast<size_t>(payloadSize) || frameBufferArena->GetBufferCount() != frameCount) {
+                        frameBufferArena.reset(); // free the memory first, if possible
+                        frameBufferArena = std::make_shared<FrameBufferArena>(payloadSize, frameCount, frameBufferArenaSettings);
+                        numcfc::Logger::LogAndEcho("Camera " + id + ": frame buffer arena " + frameBufferArena->GetDescription(), "log_init");
+                    }
+
+                    if (useRawRecording) {
+                        attachRawRecorder(*supervisedCamera.frameObserver, id, static_cast<size_t>(payloadSize));
+                    }
 
-                    for (auto& frame : frames[id]) {
-                        frame.reset(new Frame(payloadSize));
-                        CHECK_VIMBA(frame->RegisterObserver(frameObservers[id].second));
+                    for (size_t i = 0; i < frameCount; ++i) {
+                        FramePtr& frame = supervisedCamera.frames[i];
+                        frame.reset(frameBufferArena ? new ArenaFrame(frameBufferArena, i) : new Frame(payloadSize));
+                        CHECK_VIMBA(frame->RegisterObserver(supervisedCamera.frameObserverPtr));
                         CHECK_VIMBA(camera->AnnounceFrame(frame));
                     }
 
                     CHECK_VIMBA(camera->StartCapture());
 
-                    for (auto& frame : frames[id]) {
-                        camera->QueueFrame(frame);
+                    for (auto& frame : supervisedCamera.frames) {
+                        supervisedCamera.frameObserver->QueueFrame(frame);
                     }
 
                     CHECK_VIMBA(camera->GetFeatureByName("AcquisitionStart", feature));
                     CHECK_VIMBA(feature->RunCommand());
+                };
+
+                // Any frames still lent to the encoding threads fail to be queued again, which is fine
+                const auto stopAcquisition = [&](SupervisedCamera& supervisedCamera) {
+                    CameraPtr& camera = supervisedCamera.camera;
+                    FeaturePtr feature;
+                    CHECK_VIMBA(camera->GetFeatureByName("AcquisitionStop", feature));
+                    CHECK_VIMBA(feature->RunCommand());
+                    CHECK_VIMBA(camera->EndCapture());
+                    CHECK_VIMBA(camera->FlushQueue());
+                    CHECK_VIMBA(camera->RevokeAllFrames());
+                    supervisedCamera.frameObserver->ResetQueuedFrameCount();
+                };
+
+                // Sets the parameters, and starts acquiring with a new frame observer
+                const auto configure = [&](SupervisedCamera& supervisedCamera, const std::string& id) {
+                    CameraPtr& camera = supervisedCamera.camera;
+
+                    const auto vimbaParameters = iniFile.GetKeys("VimbaParameters");
+                    for (const auto& parameterName : vimbaParameters) {
+                        const auto value = iniFile.GetValue("VimbaParameters", parameterName);
+
+                        numcfc::Logger::LogAndEcho(parameterName + " = " + value, "log_camera_parameters");
+
+                        FeaturePtr feature;
+                        CHECK_VIMBA(camera->GetFeatureByName(parameterName.c_str(), feature));
+                        CHECK_VIMBA(SetFeatureValue(feature, parameterName, value));
+                    }
+
+                    const std::vector<cv::Rect> regionsOfInterest = getRegionsOfInterest(id);
+
+                    supervisedCamera.frameObserver = new FrameObserver(camera, supervisedCamera.cameraIndex, imageEncodingInput, imageReorderer, zeroCopy, zeroCopyMinQueuedFrameCount, maxPooledBufferCount, regionsOfInterest, receivingThreadPlacement, createChangeGate(), useCameraClock, supervisedCamera.nextCounter);
+                    supervisedCamera.frameObserverPtr.reset(supervisedCamera.frameObserver);
+
+                    startAcquisition(supervisedCamera, id);
+                };
+
+                // Best effort, as the camera may well be gone already
+                const auto close = [&](SupervisedCamera& supervisedCamera) {
+                    if (supervisedCamera.camera) {
+                        CameraPtr& camera = supervisedCamera.camera;
+                        FeaturePtr feature;
+                        if (camera->GetFeatureByName("AcquisitionStop", feature) == VmbErrorSuccess) {
+                            feature->RunCommand();
+                        }
+                        camera->EndCapture();
+                        camera->FlushQueue();
+                        camera->RevokeAllFrames();
+                        camera->Close();
+                    }
+                    if (supervisedCamera.frameObserver) {
+                        supervisedCamera.nextCounter = supervisedCamera.frameObserver->GetNextCounter();
+                        // The observer may outlive this, if frames are still lent out of it
+                        supervisedCamera.frameObserver->SetRawRecorder(nullptr);
+                    }
+                    supervisedCamera.frames.clear();
+                    supervisedCamera.frameObserver = nullptr;
+                    supervisedCamera.frameObserverPtr.reset();
+                };
+
+                const auto startReconnecting = [&](const std::string& id, SupervisedCamera& supervisedCamera, const std::string& reason) {
+                    close(supervisedCamera);
+
+                    supervisedCamera.reconnectBackoff_s = std::min(maxReconnectBackoff_s, std::max(minReconnectBackoff_s, 2 * supervisedCamera.reconnectBackoff_s));
+                    supervisedCamera.nextReconnectAttempt = std::chrono::steady_clock::now() + std::chrono::milliseconds(static_cast<int>(std::round(supervisedCamera.reconnectBackoff_s * 1000)));
+
+                    std::ostringstream oss;
+                    oss << reason << "; retrying in " << supervisedCamera.reconnectBackoff_s << " s";
+                    setState(id, supervisedCamera, CameraState::Reconnecting, oss.str());
+                };
+
+                // Incomplete frames while the camera has no frame buffers queued: give the camera more
+                // buffering time, if the budget allows. Restarts the acquisition of the camera, so this
+                // is done at most every 30 seconds.
+                const auto growFrameBuffers = [&](const std::string& id, SupervisedCamera& supervisedCamera, size_t incompleteFrameCount) {
+                    const auto now = std::chrono::steady_clock::now();
+                    if (now - supervisedCamera.frameBuffersLastGrown < std::chrono::seconds(30)) {
+                        return;
+                    }
+                    supervisedCamera.frameBuffersLastGrown = now;
+
+                    FrameBufferDemand& demand = supervisedCamera.frameBufferDemand;
+                    const size_t previousFrameCount = supervisedCamera.frames.size();
+
+                    const std::string reason = std::to_string(incompleteFrameCount) + " incomplete frames while out of frame buffers";
+
+                    if (demand.bufferingScale >= maxFrameBufferingScale) {
+                        numcfc::Logger::LogAndEcho("Camera " + id + ": " + reason + ", but the buffering is at its maximum already", "log_incomplete_frames");
+                        return;
+                    }
+
+                    const double previousBufferingScale = demand.bufferingScale;
+                    demand.bufferingScale = std::min(maxFrameBufferingScale, 1.5 * demand.bufferingScale);
+
+                    if (planFrameBufferCount(supervisedCamera) <= previousFrameCount) {
+                        demand.bufferingScale = previousBufferingScale;
+                        numcfc::Logger::LogAndEcho("Camera " + id + ": " + reason + ", but the memory budget is used up", "log_incomplete_frames");
+                        return;
+                    }
+
+                    numcfc::Logger::LogAndEcho("Camera " + id + ": " + reason + " - growing the frame buffers", "log_incomplete_frames");
+
+                    stopAcquisition(supervisedCamera);
+                    startAcquisition(supervisedCamera, id);
+                };
+
+                // Moves the camera along its state machine as far as it goes right now
+                const auto supervise = [&](const std::string& id, SupervisedCamera& supervisedCamera) {
+                    const auto now = std::chrono::steady_clock::now();
+                    const CameraState state = supervisedCamera.state;
+                    try {
+                        if (supervisedCamera.state == CameraState::Reconnecting && now >= supervisedCamera.nextReconnectAttempt) {
+                            // The camera object may be stale, or missing if the camera was unplugged
+                            CameraPtr camera;
+                            if (vimbaSystem.GetCameraByID(id.c_str(), camera) == VmbErrorSuccess) {
+                                supervisedCamera.camera = camera;
+                            }
+                            if (supervisedCamera.camera) {
+                                setState(id, supervisedCamera, CameraState::Opening, "");
+                            }
+                            else {
+                                startReconnecting(id, supervisedCamera, "not found");
+                            }
+                        }
+
+                        if (supervisedCamera.state == CameraState::Opening) {
+                            CHECK_VIMBA(supervisedCamera.camera->Open(VmbAccessModeFull));
+                            setState(id, supervisedCamera, CameraState::Configuring, "");
+                        }
+
+                        if (supervisedCamera.state == CameraState::Configuring) {
+                            configure(supervisedCamera, id);
+                            setState(id, supervisedCamera, CameraState::Acquiring, "");
+                        }
+                        else if (supervisedCamera.state == CameraState::Acquiring || supervisedCamera.state == CameraState::Degraded) {
+                            const double noImagesTimeout_s = supervisedCamera.noImagesTimeout_s;
+                            const auto lastCompleteFrameReceived = supervisedCamera.frameObserver->GetLastCompleteFrameReceived();
+                            const bool receivedSinceStateEntered = lastCompleteFrameReceived > supervisedCamera.stateEntered;
+
+                            if (supervisedCamera.state == CameraState::Acquiring) {
+                                const double timeSinceLatestImage_s = std::chrono::duration<double>(now - lastCompleteFrameReceived).count();
+                                if (noImagesTimeout_s > 0 && timeSinceLatestImage_s > noImagesTimeout_s) {
+                                    // First try restarting the acquisition only
+                                    setState(id, supervisedCamera, CameraState::Degraded, "no image received in " + std::to_string(static_cast<int>(timeSinceLatestImage_s)) + " s");
+                                    stopAcquisition(supervisedCamera);
+                                    startAcquisition(supervisedCamera, id);
+                                }
+                                else if (receivedSinceStateEntered) {
+                                    supervisedCamera.reconnectBackoff_s = 0.0; // healthy again
+                                }
+                            }
+                            else if (receivedSinceStateEntered) {
+                                setState(id, supervisedCamera, CameraState::Acquiring, "images received again");
+                            }
+                            else if (noImagesTimeout_s > 0 && now - supervisedCamera.stateEntered > std::chrono::milliseconds(static_cast<int>(std::round(noImagesTimeout_s * 1000)))) {
+                                startReconnecting(id, supervisedCamera, "still no images");
+                            }
+                        }
+                    }
+                    catch (std::exception& e) {
+                        numcfc::Logger::LogAndEcho("Camera " + id + ": " + e.what(), "log_errors");
+                        startReconnecting(id, supervisedCamera, std::string(GetCameraStateName(state)) + " failed");
+                    }
+                };
+
+                for (auto& i : supervisedCameras) {
+                    supervise(i.first, i.second);
                 }
+
+                std::map<std::string, std::unique_ptr<SyntheticCameraSource>> syntheticCameraSources;
+
+                for (size_t i = 0; i < syntheticSourceCount; ++i) {
+                    const std::string id = "synthetic" + std::to_string(i);
+                    const std::vector<cv::Rect> regionsOfInterest = getRegionsOfInterest(id);
+                    auto& syntheticCameraSource = syntheticCameraSources[id];
+                    syntheticCameraSource.reset(new SyntheticCameraSource(i, imageEncodingInput, imageReorderer, maxPooledBufferCount, regionsOfInterest, receivingThreadPlacement, createChangeGate(), syntheticSourceSettings));
+                    if (useRawRecording) {
+                        attachRawRecorder(*syntheticCameraSource, id, syntheticCameraSource->GetMaxRawDataSize());
+                    }
+                }
+
+                if (!syntheticCameraSources.empty()) {
+                    numcfc::Logger::LogAndEcho("Started " + std::to_string(syntheticCameraSources.size()) + " synthetic source" + (syntheticCameraSources.size() == 1 ? "" : "s"), "log_init");
+                }
+
+                // All the sources that are producing images right now
+                const auto getCameraSources = [&]() {
+                    std::map<std::string, CameraSource*> cameraSources;
+                    for (auto& i : supervisedCameras) {
+                        if (i.second.frameObserver) {
+                            cameraSources[i.first] = i.second.frameObserver;
+                        }
+                    }
+                    for (auto& i : syntheticCameraSources) {
+                        cameraSources[i.first] = i.second.get();
+                    }
+                    return cameraSources;
+                };
+
+                // Applies what can be applied without starting over: returns false if that is not enough
+                const auto applyIniFileChanges = [&](const IniFileValues& oldValues, const IniFileValues& newValues) {
+                    const auto getSection = [](const IniFileValues& values, const std::string& section) {
+                        const auto i = values.find(section);
+                        return i != values.end() ? i->second : std::map<std::string, std::string>();
+                    };
+
+                    // The encoding settings that the encoding threads can pick up between images
+                    std::set<std::string> liveEncodingKeys = { "ImageFormat", "JpegCompressionQuality", "Encoder", "Subsampling", "FastDCT", "OptimizeHuffman", "Debayering", "PreviewMaxWidth" };
+                    if (jpegQualityController) {
+                        liveEncodingKeys.erase("ImageFormat");
+                        liveEncodingKeys.erase("JpegCompressionQuality"); // the controller's range
+                    }
+
+                    std::set<std::string> sections;
+                    for (const auto* values : { &oldValues, &newValues }) {
+                        for (const auto& section : *values) {
+                            sections.insert(section.first);
+                        }
+                    }
+
+                    bool encodingChanged = false;
+
+                    for (const auto& section : sections) {
+                        if (section == "VimbaParameters") {
+                            continue;
+                        }
+                        const auto oldSection = getSection(oldValues, section);
+                        const auto newSection = getSection(newValues, section);
+                        std::set<std::string> keys;
+                        for (const auto* values : { &oldSection, &newSection }) {
+                            for (const auto& key : *values) {
+                                keys.insert(key.first);
+                            }
+                        }
+                        for (const auto& key : keys) {
+                            const auto oldValue = oldSection.find(key);
+                            const auto newValue = newSection.find(key);
+                            const bool changed = oldValue == oldSection.end() || newValue == newSection.end() || oldValue->second != newValue->second;
+                            if (!changed) {
+                                continue;
+                            }
+                            if (section == "ImageEncoding" && liveEncodingKeys.count(key)) {
+                                encodingChanged = true;
+                            }
+                            else {
+                                numcfc::Logger::LogAndEcho("Changed: [" + section + "] " + key, "log_init");
+                                return false;
+                            }
+                        }
+                    }
+
+                    if (encodingChanged) {
+                        const auto newEncodingConfiguration = ReadEncodingConfiguration(iniFile);
+                        CreateImageEncoder(newEncodingConfiguration->imageEncoderBackend, newEncodingConfiguration->imageEncoderSettings); // throws if not valid
+                        std::atomic_store(&encodingConfiguration, newEncodingConfiguration);
+                        numcfc::Logger::LogAndEcho("Image encoding settings updated", "log_init");
+                    }
+
+                    const auto oldVimbaParameters = getSection(oldValues, "VimbaParameters");
+                    const auto newVimbaParameters = getSection(newValues, "VimbaParameters");
+
+                    std::vector<std::string> changedParameterNames;
+                    for (const auto& parameter : oldVimbaParameters) {
+                        if (!newVimbaParameters.count(parameter.first)) {
+                            numcfc::Logger::LogAndEcho(parameter.first + " removed, but the camera keeps its current value", "log_camera_parameters");
+                        }
+                    }
+                    for (const auto& parameter : newVimbaParameters) {
+                        const auto oldValue = oldVimbaParameters.find(parameter.first);
+                        if (oldValue == oldVimbaParameters.end() || oldValue->second != parameter.second) {
+                            changedParameterNames.push_back(parameter.first);
+                        }
+                    }
+
+                    for (auto& i : supervisedCameras) {
+                        const std::string& id = i.first;
+                        SupervisedCamera& supervisedCamera = i.second;
+
+                        // The others get the new values when configured
+                        if (supervisedCamera.state != CameraState::Acquiring && supervisedCamera.state != CameraState::Degraded) {
+                            continue;
+                        }
+
+                        CameraPtr& camera = supervisedCamera.camera;
+
+                        try {
+                            // First write whatever can be written while acquiring
+                            std::vector<std::string> parametersNeedingStop;
+                            for (const auto& parameterName : changedParameterNames) {
+                                const auto value = iniFile.GetValue("VimbaParameters", parameterName);
+
+                                FeaturePtr feature;
+                                CHECK_VIMBA(camera->GetFeatureByName(parameterName.c_str(), feature));
+
+                                bool isWritable = false;
+                                if (feature->IsWritable(isWritable) == VmbErrorSuccess && isWritable && SetFeatureValue(feature, parameterName, value) == VmbErrorSuccess) {
+                                    numcfc::Logger::LogAndEcho(id + ": " + parameterName + " = " + value, "log_camera_parameters");
+                                }
+                                else {
+                                    parametersNeedingStop.push_back(parameterName);
+                                }
+                            }
+
+                            // Then restart this camera only, if needed
+                            if (!parametersNeedingStop.empty()) {
+                                numcfc::Logger::LogAndEcho(id + ": restarting acquisition to change " + parametersNeedingStop.front()
+                                    + (parametersNeedingStop.size() > 1 ? " and " + std::to_string(parametersNeedingStop.size() - 1) + " more" : ""), "log_camera_parameters");
+
+                                stopAcquisition(supervisedCamera);
+
+                                for (const auto& parameterName : parametersNeedingStop) {
+                                    const auto value = iniFile.GetValue("VimbaParameters", parameterName);
+                                    FeaturePtr feature;
+                                    CHECK_VIMBA(camera->GetFeatureByName(parameterName.c_str(), feature));
+                                    CHECK_VIMBA(SetFeatureValue(feature, parameterName, value));
+                                    numcfc::Logger::LogAndEcho(id + ": " + parameterName + " = " + value, "log_camera_parameters");
+                                }
+
+                                startAcquisition(supervisedCamera, id);
+                            }
+                        }
+                        catch (std::exception& e) {
+                            numcfc::Logger::LogAndEcho("Camera " + id + ": " + e.what(), "log_errors");
+                            startReconnecting(id, supervisedCamera, "unable to apply parameters");
+                        }
+                    }
+
+                    return true;
+                };
                 
                 if (iniFile.IsDirty()) {
                     iniFile.Save();
@@ -452,32 +2800,201 @@ int main(int argc, char* argv[])
                 }
 
                 auto sleepUntil = std::chrono::steady_clock::now();
+                auto metricsLastSent = sleepUntil;
+
+                IniFileValues iniFileValues = GetIniFileValues(iniFile);
+
+                // Handles the messages until the given time; the camera attribute, if given, picks
+                // the camera (otherwise all of them)
+                const auto receiveRawRecordingMessages = [&](std::chrono::steady_clock::time_point until) {
+                    while (true) {
+                        const double timeout_s = std::chrono::duration<double>(until - std::chrono::steady_clock::now()).count();
+                        slaim::Message msg;
+                        if (timeout_s <= 0.0 || !postOffice.Receive(msg, timeout_s)) {
+                            return;
+                        }
+
+                        claim::AttributeMessage amsg(msg);
+                        const std::string& camera = amsg.m_attributes["camera"];
+                        const std::string& reason = amsg.m_attributes["reason"];
+                        const std::string& delay = amsg.m_attributes["delay_s"];
+                        const double delay_s = delay.empty() ? rawRecordingFreezeDelay_s : std::max(0.0, std::atof(delay.c_str()));
+                        const std::string reasonSuffix = reason.empty() ? "" : " (" + reason + ")";
+
+                        for (auto& i : rawRecorders) {
+                            if (!camera.empty() && camera != i.first) {
+                                continue;
+                            }
+                            RawRecorder& rawRecorder = *i.second;
+                            if (amsg.m_type == "FreezeRecording") {
+                                if (rawRecorder.IsFrozen() || rawRecorder.IsFreezePending()) {
+                                    numcfc::Logger::LogAndEcho("Camera " + i.first + ": raw recording frozen already" + reasonSuffix, "log_raw_recording");
+                                    continue;
+                                }
+                                rawRecorder.Freeze(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(delay_s)));
+                                numcfc::Logger::LogAndEcho("Camera " + i.first + ": freezing the raw recording in " + std::to_string(delay_s) + " s" + reasonSuffix, "log_raw_recording");
+                            }
+                            else if (amsg.m_type == "ResumeRecording") {
+                                rawRecorder.Resume();
+                                numcfc::Logger::LogAndEcho("Camera " + i.first + ": raw recording resumed" + reasonSuffix, "log_raw_recording");
+                            }
+                        }
+                    }
+                };
 
                 while (isRunning) {
-                    std::this_thread::sleep_until(sleepUntil);
+                    if (useRawRecording) {
+                        receiveRawRecordingMessages(sleepUntil); // instead of just sleeping
+                    }
+                    else {
+                        std::this_thread::sleep_until(sleepUntil);
+                    }
                     sleepUntil += std::chrono::seconds(1);
 
                     if (iniFile.Refresh()) {
-                        numcfc::Logger::LogAndEcho("Ini file updated, starting over...", "log_init");
-                        break;
+                        const IniFileValues newIniFileValues = GetIniFileValues(iniFile);
+                        bool applied = false;
+                        if (newIniFileValues == iniFileValues) {
+                            // E.g. the settings of the post office, which are read only when starting
+                            numcfc::Logger::LogAndEcho("Changed: something outside the sections read by AlliedVision", "log_init");
+                        }
+                        else {
+                            try {
+                                applied = applyIniFileChanges(iniFileValues, newIniFileValues);
+                            }
+                            catch (std::exception& e) {
+                                numcfc::Logger::LogAndEcho(std::string("Unable to apply ini file changes: ") + e.what(), "log_errors");
+                            }
+                        }
+                        if (!applied) {
+                            numcfc::Logger::LogAndEcho("Ini file updated, starting over...", "log_init");
+                            break;
+                        }
+                        numcfc::Logger::LogAndEcho("Ini file updated, changes applied", "log_init");
+                        iniFileValues = newIniFileValues;
                     }
 
-                    for (auto& i : frameObservers) {
-                        const std::string& id = i.first;
-                        auto* frameObserver = i.second.first;
-                        Log(id, frameObserver, frameObservers.size(), logTemperature, logExposureTime, logGain);
+                    for (const auto& event : cameraListObserver->GetAndClearEvents()) {
+                        std::string id;
+                        if (!event.camera || event.camera->GetID(id) != VmbErrorSuccess) {
+                            continue;
+                        }
+                        const auto i = supervisedCameras.find(id);
+                        if (event.reason == UpdateTriggerPluggedIn) {
+                            if (i == supervisedCameras.end()) {
+                                numcfc::Logger::LogAndEcho("Camera plugged in:", "log_init");
+                                try {
+                                    addCamera(event.camera);
+                                }
+                                catch (std::exception& e) {
+                                    numcfc::Logger::LogAndEcho(e.what(), "log_errors");
+                                }
+                            }
+                            else if (i->second.state == CameraState::Reconnecting) {
+                                i->second.camera = event.camera;
+                                i->second.nextReconnectAttempt = std::chrono::steady_clock::now(); // no need to wait any longer
+                            }
+                        }
+                        else if (event.reason == UpdateTriggerPluggedOut && i != supervisedCameras.end()) {
+                            if (i->second.state != CameraState::Reconnecting) {
+                                startReconnecting(id, i->second, "unplugged");
+                            }
+                            i->second.camera.reset();
+                        }
                     }
 
-                    if (noImagesTimeout_s > 0) {
-                        std::lock_guard<std::mutex> lock(imageLastReceivedMutex);
-                        const auto durationSinceLatestImageReceived = std::chrono::steady_clock::now() - imageLastReceived;
-                        const auto timeoutDuration = std::chrono::milliseconds(static_cast<int>(std::round(noImagesTimeout_s * 1000)));
-                        if (durationSinceLatestImageReceived > timeoutDuration) {
-                            const auto duration_s = std::chrono::duration_cast<std::chrono::seconds>(durationSinceLatestImageReceived).count();
-                            numcfc::Logger::LogAndEcho("No image received in " + std::to_string(duration_s) + " s, starting over...", "log_init");
-                            break;
+                    for (auto& i : supervisedCameras) {
+                        supervise(i.first, i.second);
+                    }
+
+                    imageReorderer.SendExpired();
+
+                    const auto cameraSources = getCameraSources();
+
+                    for (auto& i : cameraSources) {
+                        i.second->SampleCameraClock();
+                    }
+
+                    if (jpegQualityController) {
+                        const int previousJpegQuality = jpegQualityController->GetQuality();
+                        const auto status = jpegQualityController->Update(imageEncodingInput.GetMaxDepth());
+                        if (status.quality != previousJpegQuality) {
+                            std::ostringstream logEntry;
+                            logEntry << std::fixed << std::setprecision(1)
+                                << "JPEG quality " << previousJpegQuality << " -> " << status.quality
+                                << " (" << status.bytesPerSecond / 1e6 << " MB/s"
+                                << ", p95 encode time " << status.encodeTimeP95_ms << " ms"
+                                << ", backlog " << status.backlog << ")";
+                            numcfc::Logger::LogAndEcho(logEntry.str(), "log_jpeg_quality");
+                        }
+                    }
+
+                    const auto now = std::chrono::steady_clock::now();
+
+                    for (auto& i : rawRecorders) {
+                        if (i.second->CheckFrozen(now)) {
+                            numcfc::Logger::LogAndEcho("Camera " + i.first + ": raw recording frozen, " + i.second->GetWindowDescription() + ", in " + i.second->GetFilename(), "log_raw_recording");
+                        }
+                    }
+
+                    const double elapsed_s = std::chrono::duration<double>(now - metricsLastSent).count();
+                    metricsLastSent = now;
+
+                    nlohmann::json metrics;
+                    metrics["interval_s"] = elapsed_s;
+                    if (jpegQualityController) {
+                        metrics["jpegQuality"] = jpegQualityController->GetQuality();
+                    }
+
+                    const size_t totalCameraCount = supervisedCameras.size() + syntheticCameraSources.size();
+
+                    for (auto& i : supervisedCameras) {
+                        const std::string& id = i.first;
+                        SupervisedCamera& supervisedCamera = i.second;
+                        auto& cameraMetrics = metrics["cameras"][id];
+                        cameraMetrics["state"] = GetCameraStateName(supervisedCamera.state);
+                        if (supervisedCamera.frameObserver) {
+                            try {
+                                Log(id, supervisedCamera.frameObserver, totalCameraCount, logTemperature, logExposureTime, logGain, cameraMetrics);
+                                supervisedCamera.frameObserver->GetAndResetMetrics(cameraMetrics, elapsed_s);
+
+                                const int64_t minQueuedFrameCount = supervisedCamera.frameObserver->GetAndResetMinQueuedFrameCount();
+                                cameraMetrics["frameBuffers"] = supervisedCamera.frames.size();
+                                cameraMetrics["frameBuffersQueuedMin"] = minQueuedFrameCount;
+
+                                const size_t incompleteFrameCount = cameraMetrics["framesIncomplete"].get<size_t>();
+                                if (frameBufferMemoryBudget_MiB > 0.0 && incompleteFrameCount > 0 && minQueuedFrameCount <= 0) {
+                                    growFrameBuffers(id, supervisedCamera, incompleteFrameCount);
+                                }
+                            }
+                            catch (std::exception& e) {
+                                numcfc::Logger::LogAndEcho("Camera " + id + ": " + e.what(), "log_errors");
+                                startReconnecting(id, supervisedCamera, "unable to read the camera status");
+                            }
                         }
                     }
+
+                    for (auto& i : syntheticCameraSources) {
+                        auto& cameraMetrics = metrics["cameras"][i.first];
+                        Log(i.first, i.second.get(), totalCameraCount, logTemperature, logExposureTime, logGain, cameraMetrics);
+                        i.second->GetAndResetMetrics(cameraMetrics, elapsed_s);
+                    }
+
+                    for (auto& i : rawRecorders) {
+                        auto& cameraMetrics = metrics["cameras"][i.first];
+                        cameraMetrics["rawRecording"] = i.second->IsFrozen() ? "frozen" : (i.second->IsFreezePending() ? "freezing" : "recording");
+                        cameraMetrics["framesRecorded"] = i.second->GetAndResetFramesRecorded();
+                        cameraMetrics["framesTooLargeToRecord"] = i.second->GetAndResetFramesTooLarge();
+                    }
+
+                    if (publishMetrics) {
+                        claim::AttributeMessage amsg;
+                        amsg.m_type = "Metrics";
+                        amsg.m_attributes["source"] = "AlliedVision";
+                        amsg.m_attributes["timestamp"] = system_clock_time_point_string_conversion::to_string(std::chrono::system_clock::now());
+                        amsg.m_attributes["data"] = metrics.dump();
+                        postOffice.Send(amsg);
+                    }
                 }
             }
             catch (std::exception& e) {
@@ -491,7 +3008,11 @@ int main(int argc, char* argv[])
                 imageEncodingThread.join();
             }
 
-            CHECK_VIMBA(vimbaSystem.Shutdown());
+            if (useVimba) {
+                vimbaSystem.UnregisterCameraListObserver(cameraListObserverPtr);
+
+                CHECK_VIMBA(vimbaSystem.Shutdown());
+            }
         }
         catch (std::exception& e) {
             numcfc::Logger::LogAndEcho(e.what(), "log_errors");
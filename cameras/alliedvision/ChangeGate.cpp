@@ -0,0 +1,49 @@
+#include "ChangeGate.h"
+#include "PixelFormatConversion.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+ChangeGate::ChangeGate(const Settings& settings)
+    : settings(settings)
+{}
+
+bool ChangeGate::Pass(const cv::Mat& rawData, VmbPixelFormatType pixelFormat, std::chrono::steady_clock::time_point time)
+{
+    if (!IsSupportedPixelFormat(pixelFormat)) {
+        return true;
+    }
+
+    const cv::Size imageSize = GetImageSize(rawData, pixelFormat);
+    if (imageSize.area() == 0) {
+        return true;
+    }
+
+    // Never larger than the raw data, which for the packed formats has a third of the columns
+    const int thumbnailWidth = std::max(1, std::min(settings.thumbnailWidth, imageSize.width / 2));
+    const int thumbnailHeight = std::max(1, std::min(imageSize.height, static_cast<int>(std::lround(thumbnailWidth * imageSize.height / static_cast<double>(imageSize.width)))));
+
+    CreateThumbnail(rawData, pixelFormat, cv::Size(thumbnailWidth, thumbnailHeight), thumbnail);
+
+    bool pass = reference.empty() || reference.size() != thumbnail.size() || referencePixelFormat != pixelFormat;
+
+    if (!pass && settings.heartbeatInterval_s > 0.0) {
+        pass = std::chrono::duration<double>(time - referenceTime).count() >= settings.heartbeatInterval_s;
+    }
+
+    if (!pass) {
+        cv::absdiff(thumbnail, reference, difference);
+        cv::threshold(difference, difference, settings.cellThreshold, 255, cv::THRESH_BINARY);
+        pass = static_cast<size_t>(cv::countNonZero(difference)) >= settings.minChangedCellCount;
+    }
+
+    if (pass) {
+        std::swap(reference, thumbnail);
+        referencePixelFormat = pixelFormat;
+        referenceTime = time;
+    }
+
+    return pass;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+// Lets through only the frames that differ from the last frame let through, so that an idle line
+// (an empty conveyor, say) does not keep the encoding, the network, the analysis and the storage
+// busy. Compares small grayscale thumbnails of the raw data (see CreateThumbnail) cell by cell,
+// so that a small object appearing counts as much as a large one. Unchanged frames are still let
+// through every now and then, as a heartbeat. Each camera needs a gate of its own; not
+// thread-safe.
+
+#include <VimbaC/Include/VmbCommonTypes.h>
+
+#include <opencv2/core/core.hpp>
+
+#include <chrono>
+#include <cstddef>
+
+class ChangeGate {
+public:
+    struct Settings {
+        int thumbnailWidth = 64;            // the height follows from the aspect ratio
+        double cellThreshold = 8.0;         // how much a thumbnail cell needs to change to count, in 8-bit levels
+        size_t minChangedCellCount = 1;     // how many cells need to change for the frame to be let through
+        double heartbeatInterval_s = 10.0;  // let an unchanged frame through at least this often (0 = never)
+    };
+
+    ChangeGate(const Settings& settings);
+
+    // Returns true if the frame should be let through: the first frame always is, as is the
+    // first frame after a change of size or pixel format
+    bool Pass(const cv::Mat& rawData, VmbPixelFormatType pixelFormat, std::chrono::steady_clock::time_point time);
+
+private:
+    const Settings settings;
+    cv::Mat reference;                      // the thumbnail of the last frame let through
+    VmbPixelFormatType referencePixelFormat = static_cast<VmbPixelFormatType>(0);
+    std::chrono::steady_clock::time_point referenceTime;
+    cv::Mat thumbnail;
+    cv::Mat difference;
+};
@@ -0,0 +1,245 @@
+#include "FrameBufferArena.h"
+
+#include <numcfc/Logger.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#pragma comment(lib, "advapi32.lib") // AdjustTokenPrivileges
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+    size_t RoundUp(size_t value, size_t multiple)
+    {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+    size_t GetPageSize()
+    {
+#ifdef _WIN32
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+        return systemInfo.dwPageSize;
+#else
+        return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+    }
+
+#ifdef _WIN32
+    // Large pages need SeLockMemoryPrivilege: the account must have it (see "Lock pages in memory"
+    // in the local security policy), but it must also be enabled for the process
+    bool EnableLockMemoryPrivilege()
+    {
+        HANDLE token = NULL;
+        if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+            return false;
+        }
+
+        TOKEN_PRIVILEGES privileges;
+        privileges.PrivilegeCount = 1;
+        privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+        bool enabled = LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid)
+            && AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL)
+            && GetLastError() == ERROR_SUCCESS; // not ERROR_NOT_ALL_ASSIGNED
+
+        CloseHandle(token);
+        return enabled;
+    }
+
+    void* Allocate(size_t size, DWORD allocationType, int numaNode)
+    {
+        return numaNode >= 0
+            ? VirtualAllocExNuma(GetCurrentProcess(), NULL, size, allocationType, PAGE_READWRITE, static_cast<DWORD>(numaNode))
+            : VirtualAlloc(NULL, size, allocationType, PAGE_READWRITE);
+    }
+#else
+    // A mapping of huge pages must be a whole number of them, or mmap fails on older kernels, and
+    // munmap on all of them
+    size_t GetHugePageSize()
+    {
+        std::ifstream meminfo("/proc/meminfo");
+        std::string name;
+        size_t value_kB = 0;
+        while (meminfo >> name) {
+            if (name == "Hugepagesize:" && meminfo >> value_kB && value_kB > 0) {
+                return value_kB * 1024;
+            }
+            meminfo.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        }
+        return 2 * 1024 * 1024; // the default on x86-64
+    }
+#endif
+
+#ifdef __linux__
+    // The pages are placed on the node when first touched; done with the raw system call
+    // (like numa_tonode_memory of libnuma would), so as not to depend on libnuma
+    bool PreferNumaNode(void* data, size_t size, int numaNode)
+    {
+        const int MPOL_PREFERRED = 1;
+        const size_t bitsPerLong = 8 * sizeof(unsigned long);
+        std::vector<unsigned long> nodeMask(numaNode / bitsPerLong + 1);
+        nodeMask[numaNode / bitsPerLong] |= 1ul << (numaNode % bitsPerLong);
+        return syscall(SYS_mbind, data, size, MPOL_PREFERRED, nodeMask.data(), nodeMask.size() * bitsPerLong + 1, 0) == 0;
+    }
+#endif
+}
+
+FrameBufferArena::FrameBufferArena(size_t bufferSize, size_t bufferCount, const Settings& settings)
+    : bufferSize(bufferSize)
+    , bufferCount(bufferCount)
+{
+    const size_t pageSize = GetPageSize();
+    bufferStride = RoundUp(std::max(static_cast<size_t>(1), bufferSize), pageSize);
+    size = bufferStride * std::max(static_cast<size_t>(1), bufferCount);
+
+#ifdef _WIN32
+    if (settings.largePages) {
+        const size_t largePageSize = GetLargePageMinimum();
+        if (largePageSize == 0) {
+            numcfc::Logger::LogAndEcho("Large pages not supported (using normal pages)", "log_init");
+        }
+        else if (!EnableLockMemoryPrivilege()) {
+            numcfc::Logger::LogAndEcho("Unable to enable the \"Lock pages in memory\" privilege needed for large pages (using normal pages)", "log_init");
+        }
+        else {
+            const size_t largePagesSize = RoundUp(size, largePageSize);
+            data = static_cast<uint8_t*>(Allocate(largePagesSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, settings.numaNode));
+            if (data) {
+                size = largePagesSize;
+                largePages = true;
+                locked = true;
+            }
+            else {
+                numcfc::Logger::LogAndEcho("Unable to allocate " + std::to_string(largePagesSize) + " bytes of large pages, error " + std::to_string(GetLastError()) + " (using normal pages)", "log_init");
+            }
+        }
+    }
+
+    if (!data) {
+        data = static_cast<uint8_t*>(Allocate(size, MEM_RESERVE | MEM_COMMIT, settings.numaNode));
+        if (!data) {
+            throw std::runtime_error("Unable to allocate " + std::to_string(size) + " bytes for the frame buffers, error " + std::to_string(GetLastError()));
+        }
+    }
+
+    // VirtualAllocExNuma takes the node as a preference only
+    numaNode = settings.numaNode;
+
+    if (settings.lock && !locked) {
+        // VirtualLock is limited by the minimum working set size, so make room for the arena first
+        SIZE_T minimumWorkingSetSize = 0, maximumWorkingSetSize = 0;
+        if (GetProcessWorkingSetSize(GetCurrentProcess(), &minimumWorkingSetSize, &maximumWorkingSetSize)) {
+            SetProcessWorkingSetSize(GetCurrentProcess(), minimumWorkingSetSize + size, std::max(maximumWorkingSetSize, minimumWorkingSetSize + size));
+        }
+        locked = VirtualLock(data, size) != 0;
+        if (!locked) {
+            numcfc::Logger::LogAndEcho("Unable to lock the frame buffers in memory, error " + std::to_string(GetLastError()), "log_init");
+        }
+    }
+#else
+    if (settings.largePages) {
+        const size_t largePagesSize = RoundUp(size, GetHugePageSize());
+        data = static_cast<uint8_t*>(mmap(nullptr, largePagesSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0));
+        if (data == MAP_FAILED) {
+            data = nullptr;
+            numcfc::Logger::LogAndEcho("Unable to allocate " + std::to_string(largePagesSize) + " bytes of huge pages, error " + std::to_string(errno) + " (using normal pages)", "log_init");
+        }
+        else {
+            size = largePagesSize;
+            largePages = true;
+        }
+    }
+
+    if (!data) {
+        data = static_cast<uint8_t*>(mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (data == MAP_FAILED) {
+            data = nullptr;
+            throw std::runtime_error("Unable to allocate " + std::to_string(size) + " bytes for the frame buffers");
+        }
+    }
+
+    if (settings.numaNode >= 0) {
+#ifdef __linux__
+        const bool preferred = PreferNumaNode(data, size, settings.numaNode);
+#else
+        const bool preferred = false;
+#endif
+        if (preferred) {
+            numaNode = settings.numaNode;
+        }
+        else {
+            numcfc::Logger::LogAndEcho("Unable to place the frame buffers on NUMA node " + std::to_string(settings.numaNode), "log_init");
+        }
+    }
+
+    if (settings.lock) {
+        locked = mlock(data, size) == 0;
+        if (!locked) {
+            numcfc::Logger::LogAndEcho("Unable to lock the frame buffers in memory", "log_init");
+        }
+    }
+#endif
+
+    // Touch every page now, rather than in the capture path
+    memset(data, 0, size);
+}
+
+FrameBufferArena::~FrameBufferArena()
+{
+#ifdef _WIN32
+    if (locked && !largePages) {
+        VirtualUnlock(data, size);
+    }
+    VirtualFree(data, 0, MEM_RELEASE);
+#else
+    if (locked) {
+        munlock(data, size);
+    }
+    if (munmap(data, size) != 0) {
+        numcfc::Logger::LogAndEcho("Unable to free the frame buffers, error " + std::to_string(errno), "log_errors");
+    }
+#endif
+}
+
+uint8_t* FrameBufferArena::GetBuffer(size_t index) const
+{
+    if (index >= bufferCount) {
+        throw std::runtime_error("Frame buffer index out of range: " + std::to_string(index));
+    }
+    return data + index * bufferStride;
+}
+
+std::string FrameBufferArena::GetDescription() const
+{
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(1)
+        << bufferCount << " x " << bufferSize / (1024.0 * 1024.0) << " MiB = " << size / (1024.0 * 1024.0) << " MiB";
+    if (largePages) {
+        oss << ", large pages";
+    }
+    if (locked) {
+        oss << ", locked";
+    }
+    if (numaNode >= 0) {
+        oss << ", NUMA node " << numaNode;
+    }
+    return oss.str();
+}
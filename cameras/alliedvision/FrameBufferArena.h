@@ -0,0 +1,52 @@
+#pragma once
+
+// One contiguous block of memory for all the frame buffers of a camera, instead of letting the
+// SDK allocate each frame on its own. The block is allocated and touched up front, so that the
+// memory use is known from the start, and no page faults hit the capture path later. Optionally
+// backed by large pages (fewer TLB misses when copying and debayering), and/or locked in memory
+// (so that the OS does not trim the working set of a long-running process), and/or placed on a
+// given NUMA node (that of the network adapter, or of the cores that process the frames).
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class FrameBufferArena {
+public:
+    struct Settings {
+        bool largePages = false;    // needs the "Lock pages in memory" privilege on Windows, and reserved huge pages on Linux
+        bool lock = false;          // large pages are never paged out anyway
+        int numaNode = -1;          // -1 = no preference
+    };
+
+    // Each buffer is at least bufferSize bytes, and starts at a page boundary. If large pages or
+    // locking is not possible, falls back to what is; throws std::runtime_error only if no memory
+    // can be allocated at all.
+    FrameBufferArena(size_t bufferSize, size_t bufferCount, const Settings& settings);
+    ~FrameBufferArena();
+
+    FrameBufferArena(const FrameBufferArena&) = delete;
+    FrameBufferArena& operator=(const FrameBufferArena&) = delete;
+
+    uint8_t* GetBuffer(size_t index) const;
+
+    size_t GetBufferSize() const { return bufferSize; }
+    size_t GetBufferCount() const { return bufferCount; }
+
+    bool IsLargePages() const { return largePages; }
+    bool IsLocked() const { return locked; }
+    int GetNumaNode() const { return numaNode; }
+
+    // E.g., "20 x 5.0 MiB = 100.0 MiB, large pages, locked, NUMA node 1"
+    std::string GetDescription() const;
+
+private:
+    const size_t bufferSize;
+    const size_t bufferCount;
+    size_t bufferStride = 0;
+    size_t size = 0;
+    uint8_t* data = nullptr;
+    bool largePages = false;
+    bool locked = false;
+    int numaNode = -1;
+};
@@ -0,0 +1,227 @@
+#include "ImageEncoder.h"
+
+#include "../../common/ImageFormats.h"
+#include "../../lib/tuc/include/tuc/string.hpp"
+
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+
+#ifdef USE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+    class OpenCvImageEncoder : public ImageEncoder {
+    public:
+        OpenCvImageEncoder(const ImageEncoderSettings& settings)
+            : extension("." + settings.imageFormat)
+        {
+            if (IsJpegFormat(settings.imageFormat)) {
+                parameters.push_back(cv::IMWRITE_JPEG_QUALITY);
+                parameters.push_back(settings.jpegQuality); // keep this the second item; see SetJpegQuality
+                if (settings.jpegOptimizeHuffman) {
+                    parameters.push_back(cv::IMWRITE_JPEG_OPTIMIZE);
+                    parameters.push_back(1);
+                }
+                // cv::imencode offers no control over the subsampling (always 4:2:0) or the DCT method
+            }
+        }
+
+        void Encode(const cv::Mat& image, std::string& output) override {
+            // cv::imencode can only write into a vector
+            cv::imencode(extension, image, buffer, parameters);
+            output.assign(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+        }
+
+        void SetJpegQuality(int jpegQuality) override {
+            if (parameters.size() >= 2 && parameters[0] == cv::IMWRITE_JPEG_QUALITY) {
+                parameters[1] = jpegQuality;
+            }
+        }
+
+        std::string GetName() const override {
+            return "opencv";
+        }
+
+    private:
+        const std::string extension;
+        std::vector<int> parameters;
+        std::vector<unsigned char> buffer;
+    };
+
+    // The formats of common/ImageFormats.h: "raw" (uncompressed) and "qoi" (fast lossless)
+    class SameHostImageEncoder : public ImageEncoder {
+    public:
+        SameHostImageEncoder(const std::string& imageFormat)
+            : imageFormat(imageFormat)
+        {}
+
+        void Encode(const cv::Mat& image, std::string& output) override {
+            if (image.depth() != CV_8U) {
+                throw std::runtime_error("Unsupported image type for " + imageFormat + ": " + std::to_string(image.type()));
+            }
+            if (image_formats::IsQoiFormat(imageFormat)) {
+                // Made big enough for the worst case, which is several times the typical size, so
+                // encoded into a buffer that is kept, and only then copied to the output
+                image_formats::EncodeQoi(image.data, image.step[0], image.cols, image.rows, image.channels(), buffer);
+                output.assign(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+            }
+            else {
+                image_formats::EncodeRaw(image.data, image.step[0], image.cols, image.rows, image.channels(), output);
+            }
+        }
+
+        void SetJpegQuality(int jpegQuality) override {}
+
+        std::string GetName() const override {
+            return imageFormat;
+        }
+
+    private:
+        const std::string imageFormat;
+        std::vector<uint8_t> buffer;
+    };
+
+#ifdef USE_TURBOJPEG
+    // Keeps one compressor for the lifetime of the encoder, instead of setting up
+    // the libjpeg state from scratch for each image like cv::imencode does
+    class TurboJpegImageEncoder : public ImageEncoder {
+    public:
+        TurboJpegImageEncoder(const ImageEncoderSettings& settings)
+            : quality(settings.jpegQuality)
+            , colorSubsampling(GetTurboJpegSubsampling(settings.jpegSubsampling))
+            , flags(TJFLAG_NOREALLOC | (settings.jpegFastDct ? TJFLAG_FASTDCT : TJFLAG_ACCURATEDCT))
+            , handle(tjInitCompress())
+        {
+            if (!handle) {
+                throw std::runtime_error(std::string("Unable to initialize TurboJPEG compressor: ") + tjGetErrorStr());
+            }
+            // The TurboJPEG API has no flag for Huffman optimization, so settings.jpegOptimizeHuffman is ignored
+        }
+
+        ~TurboJpegImageEncoder() {
+            tjDestroy(handle);
+        }
+
+        void Encode(const cv::Mat& image, std::string& output) override {
+            int pixelFormat = 0;
+            int subsampling = colorSubsampling;
+            switch (image.type()) {
+            case CV_8UC1: pixelFormat = TJPF_GRAY; subsampling = TJSAMP_GRAY; break;
+            case CV_8UC3: pixelFormat = TJPF_BGR; break;
+            default: throw std::runtime_error("Unsupported image type for TurboJPEG: " + std::to_string(image.type()));
+            }
+
+            // Compress straight into the output. The worst-case size is several times the typical
+            // size, and all of the output up to the size given needs to be zero-filled first, so
+            // try with some margin over the size of the previous image, and only if that is not
+            // enough, with the worst case.
+            const unsigned long maxSize = tjBufSize(image.cols, image.rows, subsampling);
+            unsigned long bufferSize = previousSize > 0 ? std::min(maxSize, previousSize + previousSize / 2 + 65536) : maxSize;
+
+            while (!TryCompress(image, pixelFormat, subsampling, bufferSize, output)) {
+                if (bufferSize >= maxSize) {
+                    throw std::runtime_error(std::string("TurboJPEG compression failed: ") + tjGetErrorStr2(handle));
+                }
+                bufferSize = maxSize;
+            }
+
+            previousSize = static_cast<unsigned long>(output.size());
+        }
+
+        void SetJpegQuality(int jpegQuality) override {
+            quality = jpegQuality;
+        }
+
+        std::string GetName() const override {
+            return "turbojpeg";
+        }
+
+    private:
+        // Returns false if the compression fails, e.g. because the buffer is too small
+        bool TryCompress(const cv::Mat& image, int pixelFormat, int subsampling, unsigned long bufferSize, std::string& output) {
+            output.resize(bufferSize);
+
+            unsigned char* jpegBuffer = reinterpret_cast<unsigned char*>(&output[0]);
+            unsigned long jpegSize = bufferSize;
+
+            const int result = tjCompress2(handle, image.data, image.cols, static_cast<int>(image.step[0]), image.rows, pixelFormat,
+                &jpegBuffer, &jpegSize, subsampling, quality, flags);
+
+            if (result != 0) {
+                return false;
+            }
+
+            output.resize(jpegSize);
+            return true;
+        }
+
+        static int GetTurboJpegSubsampling(JpegSubsampling jpegSubsampling) {
+            switch (jpegSubsampling) {
+            case JpegSubsampling::S444: return TJSAMP_444;
+            case JpegSubsampling::S422: return TJSAMP_422;
+            case JpegSubsampling::S420: return TJSAMP_420;
+            default: throw std::runtime_error("Unexpected JPEG subsampling");
+            }
+        }
+
+        int quality;
+        unsigned long previousSize = 0;
+        const int colorSubsampling;
+        const int flags;
+        const tjhandle handle;
+    };
+#endif // USE_TURBOJPEG
+}
+
+bool IsJpegFormat(const std::string& imageFormat)
+{
+    return tuc::string::equal_case_insensitive(imageFormat, "jpg") || tuc::string::equal_case_insensitive(imageFormat, "jpeg");
+}
+
+bool ParseJpegSubsampling(const std::string& value, JpegSubsampling& jpegSubsampling)
+{
+    if (value == "444") {
+        jpegSubsampling = JpegSubsampling::S444;
+    }
+    else if (value == "422") {
+        jpegSubsampling = JpegSubsampling::S422;
+    }
+    else if (value == "420") {
+        jpegSubsampling = JpegSubsampling::S420;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<ImageEncoder> CreateImageEncoder(const std::string& backend, const ImageEncoderSettings& settings)
+{
+    if (image_formats::IsRawFormat(settings.imageFormat) || image_formats::IsQoiFormat(settings.imageFormat)) {
+        return std::unique_ptr<ImageEncoder>(new SameHostImageEncoder(settings.imageFormat));
+    }
+    else if (tuc::string::equal_case_insensitive(backend, "opencv") || !IsJpegFormat(settings.imageFormat)) {
+        return std::unique_ptr<ImageEncoder>(new OpenCvImageEncoder(settings));
+    }
+    else if (tuc::string::equal_case_insensitive(backend, "turbojpeg")) {
+#ifdef USE_TURBOJPEG
+        return std::unique_ptr<ImageEncoder>(new TurboJpegImageEncoder(settings));
+#else
+        throw std::runtime_error("TurboJPEG support not compiled in (define USE_TURBOJPEG)");
+#endif
+    }
+    throw std::runtime_error("Unknown image encoder: " + backend);
+}
+
+bool IsTurboJpegAvailable()
+{
+#ifdef USE_TURBOJPEG
+    return true;
+#else
+    return false;
+#endif
+}
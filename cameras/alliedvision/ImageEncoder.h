@@ -0,0 +1,54 @@
+#pragma once
+
+// Encoders that turn the converted 8-bit grayscale or BGR images into the bytes that are sent
+// out. Each encoder thread should create an encoder of its own: an encoder may keep state
+// (such as a TurboJPEG compressor) between images, and is not thread-safe.
+
+#include <opencv2/core/core.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class JpegSubsampling {
+    S444,
+    S422,
+    S420
+};
+
+struct ImageEncoderSettings {
+    std::string imageFormat = "jpg";    // the file extension, e.g. "jpg" or "png", or "raw" or "qoi"
+    int jpegQuality = 90;
+    JpegSubsampling jpegSubsampling = JpegSubsampling::S420;
+    bool jpegFastDct = false;           // faster, but slightly less accurate
+    bool jpegOptimizeHuffman = false;   // smaller, but slower
+};
+
+class ImageEncoder {
+public:
+    virtual ~ImageEncoder() {}
+
+    // Replaces the contents of output with the encoded image. A string, so that it can be moved
+    // straight into the data attribute of a message, without copying.
+    virtual void Encode(const cv::Mat& image, std::string& output) = 0;
+
+    // Applies to the images encoded from now on; ignored by encoders of other formats than JPEG
+    virtual void SetJpegQuality(int jpegQuality) = 0;
+
+    virtual std::string GetName() const = 0;
+};
+
+bool IsJpegFormat(const std::string& imageFormat);
+
+// Parses "444", "422" or "420"; returns false if the string is none of these
+bool ParseJpegSubsampling(const std::string& value, JpegSubsampling& jpegSubsampling);
+
+// The backend is "opencv" (cv::imencode) or "turbojpeg" (libjpeg-turbo, if compiled in
+// with USE_TURBOJPEG). The TurboJPEG backend handles JPEG only, so for other formats the
+// OpenCV backend is used regardless - except for "raw" and "qoi", which are always encoded
+// by common/ImageFormats.h. Throws std::runtime_error if the backend is unknown or
+// not available.
+std::unique_ptr<ImageEncoder> CreateImageEncoder(const std::string& backend, const ImageEncoderSettings& settings);
+
+// Whether the TurboJPEG backend has been compiled in
+bool IsTurboJpegAvailable();
@@ -0,0 +1,107 @@
+#pragma once
+
+// A bounded lock-free queue, for handing the frames of a camera from the Vimba callback thread
+// over to the encoding threads without taking a lock on either side. Any number of threads may
+// push and pop (the camera pushes, and also pops when dropping its oldest frame; the encoding
+// threads pop), so this is the multi-producer multi-consumer ring of Dmitry Vyukov: each cell has
+// a sequence number that tells whose turn it is to use the cell next.
+//
+// Pushing and popping never block: they return false if the ring is full or empty. Waiting for
+// room or for items is left to the user.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+template <typename T>
+class MpmcRing {
+public:
+    // T must be default-constructible and move-assignable
+    explicit MpmcRing(size_t capacity)
+        : capacity(capacity > 0 ? capacity : 1)
+        , cells(new Cell[this->capacity])
+    {
+        for (size_t i = 0; i < this->capacity; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpmcRing(const MpmcRing&) = delete;
+    MpmcRing& operator=(const MpmcRing&) = delete;
+
+    // Moves from item only if there is room
+    bool TryPush(T&& item) {
+        size_t position = pushPosition.load(std::memory_order_relaxed);
+        Cell* cell = nullptr;
+        while (true) {
+            cell = &cells[position % capacity];
+            const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (difference == 0) {
+                if (pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (difference < 0) {
+                return false; // full: the cell has not been popped since the previous round
+            }
+            else {
+                position = pushPosition.load(std::memory_order_relaxed); // someone else pushed
+            }
+        }
+
+        cell->value = std::move(item);
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T& item) {
+        size_t position = popPosition.load(std::memory_order_relaxed);
+        Cell* cell = nullptr;
+        while (true) {
+            cell = &cells[position % capacity];
+            const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+            if (difference == 0) {
+                if (popPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (difference < 0) {
+                return false; // empty
+            }
+            else {
+                position = popPosition.load(std::memory_order_relaxed); // someone else popped
+            }
+        }
+
+        item = std::move(cell->value);
+        cell->value = T(); // let go of whatever the moved-from value may still hold, e.g. a frame buffer
+        cell->sequence.store(position + capacity, std::memory_order_release);
+        return true;
+    }
+
+    size_t GetCapacity() const {
+        return capacity;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    // Padding keeps the positions on cache lines of their own, so that pushing and popping do not
+    // contend for the same line
+    static const size_t cacheLineSize = 64;
+
+    const size_t capacity;
+    const std::unique_ptr<Cell[]> cells;
+    char padding0[cacheLineSize];
+    std::atomic<size_t> pushPosition{ 0 };
+    char padding1[cacheLineSize - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> popPosition{ 0 };
+    char padding2[cacheLineSize - sizeof(std::atomic<size_t>)];
+};
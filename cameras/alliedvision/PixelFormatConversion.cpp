@@ -0,0 +1,872 @@
+#include "PixelFormatConversion.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <stdexcept>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PIXEL_FORMAT_CONVERSION_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(PIXEL_FORMAT_CONVERSION_X86) && defined(__GNUC__)
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE41
+#define TARGET_AVX2
+#endif
+
+namespace {
+
+    enum class Layout {
+        Unsupported,
+        Mono8,
+        Mono16,         // 10 to 16 significant bits, each pixel in 16 bits
+        Mono12Packed,   // GEV: 2 pixels in 3 bytes, high bits of each pixel in a byte of its own
+        Mono12p,        // PFNC: 2 pixels in 3 bytes, continuously packed little-endian
+        Bayer8,
+        Bayer16,
+        Bayer12Packed,
+        Bayer12p,
+        Rgb8,
+        Bgr8,
+        Yuv422          // UYVY
+    };
+
+    enum class BayerPattern { None, RG, GR, BG, GB }; // named after the first row
+
+    struct FormatInfo {
+        Layout layout = Layout::Unsupported;
+        int significantBits = 8;
+        BayerPattern bayerPattern = BayerPattern::None;
+    };
+
+    FormatInfo GetFormatInfo(VmbPixelFormatType pixelFormat)
+    {
+        const auto make = [](Layout layout, int significantBits, BayerPattern bayerPattern = BayerPattern::None) {
+            FormatInfo info;
+            info.layout = layout;
+            info.significantBits = significantBits;
+            info.bayerPattern = bayerPattern;
+            return info;
+        };
+
+        const auto fromBayerRG = BayerPattern::RG;
+        const auto fromBayerGR = BayerPattern::GR;
+        const auto fromBayerBG = BayerPattern::BG;
+        const auto fromBayerGB = BayerPattern::GB;
+
+        switch (pixelFormat) {
+        case VmbPixelFormatMono8:           return make(Layout::Mono8, 8);
+        case VmbPixelFormatMono10:          return make(Layout::Mono16, 10);
+        case VmbPixelFormatMono12:          return make(Layout::Mono16, 12);
+        case VmbPixelFormatMono14:          return make(Layout::Mono16, 14);
+        case VmbPixelFormatMono16:          return make(Layout::Mono16, 16);
+        case VmbPixelFormatMono12Packed:    return make(Layout::Mono12Packed, 12);
+        case VmbPixelFormatMono12p:         return make(Layout::Mono12p, 12);
+
+        case VmbPixelFormatBayerRG8:        return make(Layout::Bayer8, 8, fromBayerRG);
+        case VmbPixelFormatBayerGR8:        return make(Layout::Bayer8, 8, fromBayerGR);
+        case VmbPixelFormatBayerBG8:        return make(Layout::Bayer8, 8, fromBayerBG);
+        case VmbPixelFormatBayerGB8:        return make(Layout::Bayer8, 8, fromBayerGB);
+
+        case VmbPixelFormatBayerRG10:       return make(Layout::Bayer16, 10, fromBayerRG);
+        case VmbPixelFormatBayerGR10:       return make(Layout::Bayer16, 10, fromBayerGR);
+        case VmbPixelFormatBayerBG10:       return make(Layout::Bayer16, 10, fromBayerBG);
+        case VmbPixelFormatBayerGB10:       return make(Layout::Bayer16, 10, fromBayerGB);
+
+        case VmbPixelFormatBayerRG12:       return make(Layout::Bayer16, 12, fromBayerRG);
+        case VmbPixelFormatBayerGR12:       return make(Layout::Bayer16, 12, fromBayerGR);
+        case VmbPixelFormatBayerBG12:       return make(Layout::Bayer16, 12, fromBayerBG);
+        case VmbPixelFormatBayerGB12:       return make(Layout::Bayer16, 12, fromBayerGB);
+
+        case VmbPixelFormatBayerRG16:       return make(Layout::Bayer16, 16, fromBayerRG);
+        case VmbPixelFormatBayerGR16:       return make(Layout::Bayer16, 16, fromBayerGR);
+        case VmbPixelFormatBayerBG16:       return make(Layout::Bayer16, 16, fromBayerBG);
+        case VmbPixelFormatBayerGB16:       return make(Layout::Bayer16, 16, fromBayerGB);
+
+        case VmbPixelFormatBayerRG12Packed: return make(Layout::Bayer12Packed, 12, fromBayerRG);
+        case VmbPixelFormatBayerGR12Packed: return make(Layout::Bayer12Packed, 12, fromBayerGR);
+        case VmbPixelFormatBayerBG12Packed: return make(Layout::Bayer12Packed, 12, fromBayerBG);
+        case VmbPixelFormatBayerGB12Packed: return make(Layout::Bayer12Packed, 12, fromBayerGB);
+
+        case VmbPixelFormatBayerRG12p:      return make(Layout::Bayer12p, 12, fromBayerRG);
+        case VmbPixelFormatBayerGR12p:      return make(Layout::Bayer12p, 12, fromBayerGR);
+        case VmbPixelFormatBayerBG12p:      return make(Layout::Bayer12p, 12, fromBayerBG);
+        case VmbPixelFormatBayerGB12p:      return make(Layout::Bayer12p, 12, fromBayerGB);
+
+        case VmbPixelFormatRgb8:            return make(Layout::Rgb8, 8);
+        case VmbPixelFormatBgr8:            return make(Layout::Bgr8, 8);
+        case VmbPixelFormatYuv422:          return make(Layout::Yuv422, 8);
+
+        default:                            return FormatInfo();
+        }
+    }
+
+    int GetBayerConversionCode(BayerPattern bayerPattern)
+    {
+        // Note that OpenCV names the Bayer patterns based on the second row, so the names don't match those of Vimba
+        switch (bayerPattern) {
+        case BayerPattern::RG: return cv::COLOR_BayerBG2BGR;
+        case BayerPattern::GR: return cv::COLOR_BayerGB2BGR;
+        case BayerPattern::BG: return cv::COLOR_BayerRG2BGR;
+        case BayerPattern::GB: return cv::COLOR_BayerGR2BGR;
+        default: throw std::runtime_error("Not a Bayer pattern");
+        }
+    }
+
+    bool IsBayer(Layout layout)
+    {
+        return layout == Layout::Bayer8 || layout == Layout::Bayer16 || layout == Layout::Bayer12Packed || layout == Layout::Bayer12p;
+    }
+
+    bool IsPacked(Layout layout)
+    {
+        return layout == Layout::Mono12Packed || layout == Layout::Mono12p || layout == Layout::Bayer12Packed || layout == Layout::Bayer12p;
+    }
+
+    // The Mat type, and the number of its columns per row, that raw data of the layout is wrapped
+    // as; returns false if the layout is not supported
+    bool GetRawDataShape(Layout layout, size_t width, size_t& cols, int& type)
+    {
+        switch (layout) {
+        case Layout::Mono8:
+        case Layout::Bayer8:
+            cols = width; type = CV_8UC1; return true;
+        case Layout::Mono16:
+        case Layout::Bayer16:
+            cols = width; type = CV_16UC1; return true;
+        case Layout::Mono12Packed:
+        case Layout::Mono12p:
+        case Layout::Bayer12Packed:
+        case Layout::Bayer12p:
+            cols = (width * 3 + 1) / 2; type = CV_8UC1; return true;
+        case Layout::Rgb8:
+        case Layout::Bgr8:
+            cols = width; type = CV_8UC3; return true;
+        case Layout::Yuv422:
+            cols = width; type = CV_8UC2; return true;
+        default:
+            return false;
+        }
+    }
+
+    enum class InstructionSet { Scalar, Sse41, Avx2 };
+
+    InstructionSet DetectInstructionSet()
+    {
+#if defined(PIXEL_FORMAT_CONVERSION_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        const int maxLeaf = info[0];
+        __cpuid(info, 1);
+        const bool sse41 = (info[2] & (1 << 19)) != 0;
+        const bool osxsave = (info[2] & (1 << 27)) != 0;
+        const bool avx = (info[2] & (1 << 28)) != 0;
+        bool avx2 = false;
+        if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6) {
+            __cpuidex(info, 7, 0);
+            avx2 = (info[1] & (1 << 5)) != 0;
+        }
+#elif defined(PIXEL_FORMAT_CONVERSION_X86) && defined(__GNUC__)
+        __builtin_cpu_init();
+        const bool sse41 = __builtin_cpu_supports("sse4.1") != 0;
+        const bool avx2 = __builtin_cpu_supports("avx2") != 0;
+#else
+        const bool sse41 = false;
+        const bool avx2 = false;
+#endif
+        if (avx2) {
+            return InstructionSet::Avx2;
+        }
+        if (sse41) {
+            return InstructionSet::Sse41;
+        }
+        return InstructionSet::Scalar;
+    }
+
+    InstructionSet GetAvailableInstructionSet()
+    {
+        static const InstructionSet instructionSet = DetectInstructionSet();
+        return instructionSet;
+    }
+
+    // Lowered by SetPixelFormatConversionInstructionSet, for testing the kernels one by one
+    std::atomic<int> instructionSetLimit(static_cast<int>(InstructionSet::Avx2));
+
+    InstructionSet GetInstructionSet()
+    {
+        return static_cast<InstructionSet>(std::min(static_cast<int>(GetAvailableInstructionSet()), instructionSetLimit.load(std::memory_order_relaxed)));
+    }
+
+    // Keeps the 8 most significant of the significant bits
+    void ShiftTo8Scalar(const uint16_t* input, uint8_t* output, size_t pixelCount, int shift)
+    {
+        for (size_t i = 0; i < pixelCount; ++i) {
+            output[i] = static_cast<uint8_t>(std::min(input[i] >> shift, 255));
+        }
+    }
+
+    // GEV: each pixel pair is [p0 high 8 bits] [p1 low 4 bits | p0 low 4 bits] [p1 high 8 bits]
+    void Unpack12PackedTo8Scalar(const uint8_t* input, uint8_t* output, size_t pixelCount)
+    {
+        for (size_t i = 0; i + 1 < pixelCount; i += 2, input += 3) {
+            output[i] = input[0];
+            output[i + 1] = input[2];
+        }
+        if (pixelCount % 2) {
+            output[pixelCount - 1] = input[0];
+        }
+    }
+
+    // PFNC: each pixel pair is [p0 bits 0-7] [p1 bits 0-3 | p0 bits 8-11] [p1 bits 4-11]
+    void Unpack12pTo8Scalar(const uint8_t* input, uint8_t* output, size_t pixelCount)
+    {
+        for (size_t i = 0; i + 1 < pixelCount; i += 2, input += 3) {
+            output[i] = static_cast<uint8_t>((input[0] >> 4) | ((input[1] & 0x0f) << 4));
+            output[i + 1] = input[2];
+        }
+        if (pixelCount % 2) {
+            output[pixelCount - 1] = static_cast<uint8_t>((input[0] >> 4) | ((input[1] & 0x0f) << 4));
+        }
+    }
+
+#ifdef PIXEL_FORMAT_CONVERSION_X86
+    // SSE2 is always there on x64, so this is what the SSE4.1 path uses too
+    TARGET_SSE41 void ShiftTo8Sse41(const uint16_t* input, uint8_t* output, size_t pixelCount, int shift)
+    {
+        const __m128i count = _mm_cvtsi32_si128(shift);
+        size_t i = 0;
+        for (; i + 16 <= pixelCount; i += 16) {
+            const __m128i a = _mm_srl_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i)), count);
+            const __m128i b = _mm_srl_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i + 8)), count);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_packus_epi16(a, b));
+        }
+        ShiftTo8Scalar(input + i, output + i, pixelCount - i, shift);
+    }
+
+    TARGET_AVX2 void ShiftTo8Avx2(const uint16_t* input, uint8_t* output, size_t pixelCount, int shift)
+    {
+        const __m128i count = _mm_cvtsi32_si128(shift);
+        size_t i = 0;
+        for (; i + 32 <= pixelCount; i += 32) {
+            const __m256i a = _mm256_srl_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i)), count);
+            const __m256i b = _mm256_srl_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i + 16)), count);
+            // packus works within 128-bit lanes, so the 64-bit blocks need to be put back in order
+            const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i), packed);
+        }
+        ShiftTo8Sse41(input + i, output + i, pixelCount - i, shift);
+    }
+
+    // Each iteration reads 16 bytes but consumes only 12 (8 pixels), hence the condition
+    TARGET_SSE41 void Unpack12PackedTo8Sse41(const uint8_t* input, uint8_t* output, size_t pixelCount)
+    {
+        const __m128i shuffle = _mm_setr_epi8(0, 2, 3, 5, 6, 8, 9, 11, -1, -1, -1, -1, -1, -1, -1, -1);
+        size_t i = 0;
+        for (; (i / 2 * 3) + 16 <= (pixelCount / 2 * 3); i += 8) {
+            const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i / 2 * 3));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(output + i), _mm_shuffle_epi8(packed, shuffle));
+        }
+        Unpack12PackedTo8Scalar(input + i / 2 * 3, output + i, pixelCount - i);
+    }
+
+    TARGET_SSE41 void Unpack12pTo8Sse41(const uint8_t* input, uint8_t* output, size_t pixelCount)
+    {
+        // Put bytes (0, 1) in the first 16-bit lane, (1, 2) in the second, (3, 4) in the third, and so on
+        const __m128i shuffle = _mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+        const __m128i lowByte = _mm_set1_epi16(0x00ff);
+        size_t i = 0;
+        for (; (i / 2 * 3) + 16 <= (pixelCount / 2 * 3); i += 8) {
+            const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i / 2 * 3));
+            const __m128i pairs = _mm_shuffle_epi8(packed, shuffle);
+            // Even pixels: bits 4-11 of (byte 1 << 8 | byte 0); odd pixels: simply byte 2
+            const __m128i even = _mm_srli_epi16(pairs, 4);
+            const __m128i odd = _mm_srli_epi16(pairs, 8);
+            const __m128i pixels = _mm_and_si128(_mm_blend_epi16(even, odd, 0xaa), lowByte);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(output + i), _mm_packus_epi16(pixels, pixels));
+        }
+        Unpack12pTo8Scalar(input + i / 2 * 3, output + i, pixelCount - i);
+    }
+
+    // Each iteration reads 32 bytes but consumes only 24 (16 pixels): the first 12 bytes go to the
+    // lower 128-bit lane and the next 12 to the upper one, so that the shuffles of the SSE4.1
+    // versions (which work within lanes) can be used as they are
+    TARGET_AVX2 __m256i Load12BytesPerLane(const uint8_t* input)
+    {
+        const __m256i spread = _mm256_setr_epi32(0, 1, 2, 2, 3, 4, 5, 5);
+        return _mm256_permutevar8x32_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(input)), spread);
+    }
+
+    // The lower 8 bytes of each lane, as 16 consecutive bytes
+    TARGET_AVX2 void StoreLowerHalfOfLanes(__m256i data, uint8_t* output)
+    {
+        const __m256i joined = _mm256_permute4x64_epi64(data, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output), _mm256_castsi256_si128(joined));
+    }
+
+    TARGET_AVX2 void Unpack12PackedTo8Avx2(const uint8_t* input, uint8_t* output, size_t pixelCount)
+    {
+        const __m256i shuffle = _mm256_setr_epi8(
+            0, 2, 3, 5, 6, 8, 9, 11, -1, -1, -1, -1, -1, -1, -1, -1,
+            0, 2, 3, 5, 6, 8, 9, 11, -1, -1, -1, -1, -1, -1, -1, -1);
+        size_t i = 0;
+        for (; (i / 2 * 3) + 32 <= (pixelCount / 2 * 3); i += 16) {
+            StoreLowerHalfOfLanes(_mm256_shuffle_epi8(Load12BytesPerLane(input + i / 2 * 3), shuffle), output + i);
+        }
+        Unpack12PackedTo8Sse41(input + i / 2 * 3, output + i, pixelCount - i);
+    }
+
+    TARGET_AVX2 void Unpack12pTo8Avx2(const uint8_t* input, uint8_t* output, size_t pixelCount)
+    {
+        const __m256i shuffle = _mm256_setr_epi8(
+            0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11,
+            0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+        const __m256i lowByte = _mm256_set1_epi16(0x00ff);
+        size_t i = 0;
+        for (; (i / 2 * 3) + 32 <= (pixelCount / 2 * 3); i += 16) {
+            const __m256i pairs = _mm256_shuffle_epi8(Load12BytesPerLane(input + i / 2 * 3), shuffle);
+            const __m256i even = _mm256_srli_epi16(pairs, 4);
+            const __m256i odd = _mm256_srli_epi16(pairs, 8);
+            const __m256i pixels = _mm256_and_si256(_mm256_blend_epi16(even, odd, 0xaa), lowByte);
+            StoreLowerHalfOfLanes(_mm256_packus_epi16(pixels, pixels), output + i);
+        }
+        Unpack12pTo8Sse41(input + i / 2 * 3, output + i, pixelCount - i);
+    }
+#endif // PIXEL_FORMAT_CONVERSION_X86
+
+    void ShiftTo8(const uint16_t* input, uint8_t* output, size_t pixelCount, int shift)
+    {
+#ifdef PIXEL_FORMAT_CONVERSION_X86
+        switch (GetInstructionSet()) {
+        case InstructionSet::Avx2: ShiftTo8Avx2(input, output, pixelCount, shift); return;
+        case InstructionSet::Sse41: ShiftTo8Sse41(input, output, pixelCount, shift); return;
+        default: break;
+        }
+#endif
+        ShiftTo8Scalar(input, output, pixelCount, shift);
+    }
+
+    void Unpack12PackedTo8(const uint8_t* input, uint8_t* output, size_t pixelCount)
+    {
+#ifdef PIXEL_FORMAT_CONVERSION_X86
+        switch (GetInstructionSet()) {
+        case InstructionSet::Avx2: Unpack12PackedTo8Avx2(input, output, pixelCount); return;
+        case InstructionSet::Sse41: Unpack12PackedTo8Sse41(input, output, pixelCount); return;
+        default: break;
+        }
+#endif
+        Unpack12PackedTo8Scalar(input, output, pixelCount);
+    }
+
+    void Unpack12pTo8(const uint8_t* input, uint8_t* output, size_t pixelCount)
+    {
+#ifdef PIXEL_FORMAT_CONVERSION_X86
+        switch (GetInstructionSet()) {
+        case InstructionSet::Avx2: Unpack12pTo8Avx2(input, output, pixelCount); return;
+        case InstructionSet::Sse41: Unpack12pTo8Sse41(input, output, pixelCount); return;
+        default: break;
+        }
+#endif
+        Unpack12pTo8Scalar(input, output, pixelCount);
+    }
+
+    // Makes each 2x2 cell one BGR pixel, averaging the two greens, in a single pass
+    template <typename T>
+    void SuperpixelDebayer(const cv::Mat& bayer, BayerPattern bayerPattern, int shift, cv::Mat& image)
+    {
+        // Where is red within each cell? Blue is then diagonally opposite, and greens are in the other two corners
+        const int redX = (bayerPattern == BayerPattern::GR || bayerPattern == BayerPattern::BG) ? 1 : 0;
+        const int redY = (bayerPattern == BayerPattern::GB || bayerPattern == BayerPattern::BG) ? 1 : 0;
+        const int blueX = 1 - redX;
+        const int blueY = 1 - redY;
+
+        for (int y = 0; y < image.rows; ++y) {
+            const T* rows[2] = { bayer.ptr<T>(2 * y), bayer.ptr<T>(2 * y + 1) };
+            const T* redRow = rows[redY];
+            const T* blueRow = rows[blueY];
+            const T* green1Row = rows[redY];   // next to red horizontally
+            const T* green2Row = rows[blueY];  // next to blue horizontally
+            uint8_t* output = image.ptr<uint8_t>(y);
+
+            for (int x = 0; x < image.cols; ++x, output += 3) {
+                const int x0 = 2 * x;
+                const int green = (green1Row[x0 + blueX] + green2Row[x0 + redX] + 1) >> 1;
+                output[0] = static_cast<uint8_t>(std::min(blueRow[x0 + blueX] >> shift, 255));
+                output[1] = static_cast<uint8_t>(std::min(green >> shift, 255));
+                output[2] = static_cast<uint8_t>(std::min(redRow[x0 + redX] >> shift, 255));
+            }
+        }
+    }
+
+    // Converts single-channel data of more than 8 bits to 8 bits, row by row
+    void ConvertTo8(const cv::Mat& rawData, const FormatInfo& info, cv::Mat& output)
+    {
+        for (int y = 0; y < output.rows; ++y) {
+            uint8_t* outputRow = output.ptr<uint8_t>(y);
+            switch (info.layout) {
+            case Layout::Mono16:
+            case Layout::Bayer16:
+                ShiftTo8(rawData.ptr<uint16_t>(y), outputRow, output.cols, info.significantBits - 8);
+                break;
+            case Layout::Mono12Packed:
+            case Layout::Bayer12Packed:
+                Unpack12PackedTo8(rawData.ptr<uint8_t>(y), outputRow, output.cols);
+                break;
+            case Layout::Mono12p:
+            case Layout::Bayer12p:
+                Unpack12pTo8(rawData.ptr<uint8_t>(y), outputRow, output.cols);
+                break;
+            default:
+                throw std::runtime_error("Unexpected layout");
+            }
+        }
+    }
+}
+
+cv::Mat WrapPixelBuffer(VmbUchar_t* data, VmbUint32_t width, VmbUint32_t height, VmbPixelFormatType pixelFormat)
+{
+    size_t cols = 0;
+    int type = 0;
+    if (!GetRawDataShape(GetFormatInfo(pixelFormat).layout, width, cols, type)) {
+        return cv::Mat();
+    }
+    return cv::Mat(static_cast<int>(height), static_cast<int>(cols), type, data);
+}
+
+size_t GetRawDataSize(VmbUint32_t width, VmbUint32_t height, VmbPixelFormatType pixelFormat)
+{
+    size_t cols = 0;
+    int type = 0;
+    if (!GetRawDataShape(GetFormatInfo(pixelFormat).layout, width, cols, type)) {
+        return 0;
+    }
+    return cols * CV_ELEM_SIZE(type) * height;
+}
+
+bool IsSupportedPixelFormat(VmbPixelFormatType pixelFormat)
+{
+    return GetFormatInfo(pixelFormat).layout != Layout::Unsupported;
+}
+
+bool IsBayerPixelFormat(VmbPixelFormatType pixelFormat)
+{
+    return IsBayer(GetFormatInfo(pixelFormat).layout);
+}
+
+bool IsPassThroughPixelFormat(VmbPixelFormatType pixelFormat)
+{
+    const Layout layout = GetFormatInfo(pixelFormat).layout;
+    return layout == Layout::Mono8 || layout == Layout::Bgr8;
+}
+
+cv::Size GetImageSize(const cv::Mat& rawData, VmbPixelFormatType pixelFormat)
+{
+    if (IsPacked(GetFormatInfo(pixelFormat).layout)) {
+        return cv::Size(rawData.cols * 2 / 3, rawData.rows);
+    }
+    return rawData.size();
+}
+
+cv::Mat GetRegionOfInterest(const cv::Mat& rawData, VmbPixelFormatType pixelFormat, cv::Rect& roi)
+{
+    const Layout layout = GetFormatInfo(pixelFormat).layout;
+    const cv::Size size = GetImageSize(rawData, pixelFormat);
+
+    const int alignX = IsBayer(layout) || IsPacked(layout) || layout == Layout::Yuv422 ? 2 : 1;
+    const int alignY = IsBayer(layout) ? 2 : 1;
+
+    // Round the start down and the end up, but not past the (aligned) end of the image
+    const auto align = [](int begin, int end, int alignment, int limit) {
+        begin = std::max(0, begin);
+        end = std::min(end, limit);
+        begin -= begin % alignment;
+        end = std::min(end + (alignment - end % alignment) % alignment, limit - limit % alignment);
+        return std::make_pair(begin, std::max(begin, end));
+    };
+
+    const auto x = align(roi.x, roi.x + roi.width, alignX, size.width);
+    const auto y = align(roi.y, roi.y + roi.height, alignY, size.height);
+
+    roi = cv::Rect(x.first, y.first, x.second - x.first, y.second - y.first);
+
+    if (roi.area() == 0) {
+        return cv::Mat();
+    }
+
+    if (IsPacked(layout)) {
+        // 2 pixels in 3 bytes
+        return rawData(cv::Rect(roi.x * 3 / 2, roi.y, roi.width * 3 / 2, roi.height));
+    }
+    return rawData(roi);
+}
+
+cv::Size GetConvertedImageSize(const cv::Mat& rawData, VmbPixelFormatType pixelFormat, DebayerMode debayerMode)
+{
+    const cv::Size size = GetImageSize(rawData, pixelFormat);
+    if (debayerMode == DebayerMode::Superpixel && IsBayerPixelFormat(pixelFormat)) {
+        return cv::Size(size.width / 2, size.height / 2);
+    }
+    return size;
+}
+
+int GetConvertedImageType(VmbPixelFormatType pixelFormat)
+{
+    switch (GetFormatInfo(pixelFormat).layout) {
+    case Layout::Mono8:
+    case Layout::Mono16:
+    case Layout::Mono12Packed:
+    case Layout::Mono12p:
+        return CV_8UC1;
+    default:
+        return CV_8UC3;
+    }
+}
+
+void ConvertPixelFormat(const cv::Mat& rawData, VmbPixelFormatType pixelFormat, cv::Mat& image, DebayerMode debayerMode)
+{
+    const FormatInfo info = GetFormatInfo(pixelFormat);
+    const cv::Size size = GetImageSize(rawData, pixelFormat);
+
+    if (debayerMode == DebayerMode::Superpixel && IsBayer(info.layout)) {
+        image.create(GetConvertedImageSize(rawData, pixelFormat, debayerMode), CV_8UC3);
+        switch (info.layout) {
+        case Layout::Bayer8:
+            SuperpixelDebayer<uint8_t>(rawData, info.bayerPattern, 0, image);
+            return;
+        case Layout::Bayer16:
+            SuperpixelDebayer<uint16_t>(rawData, info.bayerPattern, info.significantBits - 8, image);
+            return;
+        default:
+        {
+            thread_local cv::Mat bayer8;
+            bayer8.create(size, CV_8UC1);
+            ConvertTo8(rawData, info, bayer8);
+            SuperpixelDebayer<uint8_t>(bayer8, info.bayerPattern, 0, image);
+            return;
+        }
+        }
+    }
+
+    switch (info.layout) {
+    case Layout::Mono8:
+    case Layout::Bgr8:
+        image = rawData;
+        return;
+
+    case Layout::Mono16:
+    case Layout::Mono12Packed:
+    case Layout::Mono12p:
+        image.create(size, CV_8UC1);
+        ConvertTo8(rawData, info, image);
+        return;
+
+    case Layout::Bayer8:
+        cv::cvtColor(rawData, image, GetBayerConversionCode(info.bayerPattern));
+        return;
+
+    case Layout::Bayer16:
+    case Layout::Bayer12Packed:
+    case Layout::Bayer12p:
+    {
+        // Reducing to 8 bits before debayering halves the amount of data to interpolate
+        thread_local cv::Mat bayer8;
+        bayer8.create(size, CV_8UC1);
+        ConvertTo8(rawData, info, bayer8);
+        cv::cvtColor(bayer8, image, GetBayerConversionCode(info.bayerPattern));
+        return;
+    }
+
+    case Layout::Rgb8:
+        cv::cvtColor(rawData, image, cv::COLOR_RGB2BGR);
+        return;
+
+    case Layout::Yuv422:
+        cv::cvtColor(rawData, image, cv::COLOR_YUV2BGR_UYVY);
+        return;
+
+    default:
+        throw std::runtime_error("Unsupported pixel format: " + GetPixelFormatName(pixelFormat));
+    }
+}
+
+void CreateThumbnail(const cv::Mat& rawData, VmbPixelFormatType pixelFormat, cv::Size size, cv::Mat& thumbnail)
+{
+    const FormatInfo info = GetFormatInfo(pixelFormat);
+
+    // Shrunk first, while still in the raw layout, so that the rest only touches a few pixels
+    thread_local cv::Mat small;
+
+    switch (info.layout) {
+    case Layout::Mono8:
+    case Layout::Bayer8:
+        cv::resize(rawData, thumbnail, size, 0.0, 0.0, cv::INTER_AREA);
+        return;
+
+    case Layout::Mono16:
+    case Layout::Bayer16:
+        cv::resize(rawData, small, size, 0.0, 0.0, cv::INTER_AREA);
+        small.convertTo(thumbnail, CV_8U, 1.0 / (1 << (info.significantBits - 8)));
+        return;
+
+    case Layout::Mono12Packed:
+    case Layout::Mono12p:
+    case Layout::Bayer12Packed:
+    case Layout::Bayer12p:
+    {
+        // In both packings, the third byte of each pixel pair is the 8 most significant bits of
+        // the second pixel; every second pixel is plenty for a thumbnail
+        const cv::Mat pixelPairs(rawData.rows, rawData.cols / 3, CV_8UC3, rawData.data, rawData.step[0]);
+        cv::resize(pixelPairs, small, size, 0.0, 0.0, cv::INTER_AREA);
+        cv::extractChannel(small, thumbnail, 2);
+        return;
+    }
+
+    case Layout::Rgb8:
+        cv::resize(rawData, small, size, 0.0, 0.0, cv::INTER_AREA);
+        cv::cvtColor(small, thumbnail, cv::COLOR_RGB2GRAY);
+        return;
+
+    case Layout::Bgr8:
+        cv::resize(rawData, small, size, 0.0, 0.0, cv::INTER_AREA);
+        cv::cvtColor(small, thumbnail, cv::COLOR_BGR2GRAY);
+        return;
+
+    case Layout::Yuv422:
+        cv::resize(rawData, small, size, 0.0, 0.0, cv::INTER_AREA);
+        cv::extractChannel(small, thumbnail, 1); // UYVY: the luma is the second byte of each pixel
+        return;
+
+    default:
+        throw std::runtime_error("Unsupported pixel format: " + GetPixelFormatName(pixelFormat));
+    }
+}
+
+std::string GetPixelFormatName(VmbPixelFormatType pixelFormat)
+{
+    switch (pixelFormat) {
+    case VmbPixelFormatMono8:           return "Mono8";
+    case VmbPixelFormatMono10:          return "Mono10";
+    case VmbPixelFormatMono12:          return "Mono12";
+    case VmbPixelFormatMono14:          return "Mono14";
+    case VmbPixelFormatMono16:          return "Mono16";
+    case VmbPixelFormatMono12Packed:    return "Mono12Packed";
+    case VmbPixelFormatMono12p:         return "Mono12p";
+    case VmbPixelFormatBayerRG8:        return "BayerRG8";
+    case VmbPixelFormatBayerGR8:        return "BayerGR8";
+    case VmbPixelFormatBayerBG8:        return "BayerBG8";
+    case VmbPixelFormatBayerGB8:        return "BayerGB8";
+    case VmbPixelFormatBayerRG10:       return "BayerRG10";
+    case VmbPixelFormatBayerGR10:       return "BayerGR10";
+    case VmbPixelFormatBayerBG10:       return "BayerBG10";
+    case VmbPixelFormatBayerGB10:       return "BayerGB10";
+    case VmbPixelFormatBayerRG12:       return "BayerRG12";
+    case VmbPixelFormatBayerGR12:       return "BayerGR12";
+    case VmbPixelFormatBayerBG12:       return "BayerBG12";
+    case VmbPixelFormatBayerGB12:       return "BayerGB12";
+    case VmbPixelFormatBayerRG16:       return "BayerRG16";
+    case VmbPixelFormatBayerGR16:       return "BayerGR16";
+    case VmbPixelFormatBayerBG16:       return "BayerBG16";
+    case VmbPixelFormatBayerGB16:       return "BayerGB16";
+    case VmbPixelFormatBayerRG12Packed: return "BayerRG12Packed";
+    case VmbPixelFormatBayerGR12Packed: return "BayerGR12Packed";
+    case VmbPixelFormatBayerBG12Packed: return "BayerBG12Packed";
+    case VmbPixelFormatBayerGB12Packed: return "BayerGB12Packed";
+    case VmbPixelFormatBayerRG12p:      return "BayerRG12p";
+    case VmbPixelFormatBayerGR12p:      return "BayerGR12p";
+    case VmbPixelFormatBayerBG12p:      return "BayerBG12p";
+    case VmbPixelFormatBayerGB12p:      return "BayerGB12p";
+    case VmbPixelFormatRgb8:            return "RGB8";
+    case VmbPixelFormatBgr8:            return "BGR8";
+    case VmbPixelFormatYuv422:          return "YUV422Packed";
+    default:                            return std::to_string(pixelFormat);
+    }
+}
+
+bool ParsePixelFormat(const std::string& name, VmbPixelFormatType& pixelFormat)
+{
+    const auto toLower = [](std::string value) {
+        std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return value;
+    };
+
+    const std::string lowerCaseName = toLower(name);
+
+    for (const VmbPixelFormatType candidate : GetSupportedPixelFormats()) {
+        if (toLower(GetPixelFormatName(candidate)) == lowerCaseName) {
+            pixelFormat = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<VmbPixelFormatType> GetSupportedPixelFormats()
+{
+    return {
+        VmbPixelFormatMono8, VmbPixelFormatMono10, VmbPixelFormatMono12, VmbPixelFormatMono14, VmbPixelFormatMono16,
+        VmbPixelFormatMono12Packed, VmbPixelFormatMono12p,
+        VmbPixelFormatBayerRG8, VmbPixelFormatBayerGR8, VmbPixelFormatBayerBG8, VmbPixelFormatBayerGB8,
+        VmbPixelFormatBayerRG10, VmbPixelFormatBayerGR10, VmbPixelFormatBayerBG10, VmbPixelFormatBayerGB10,
+        VmbPixelFormatBayerRG12, VmbPixelFormatBayerGR12, VmbPixelFormatBayerBG12, VmbPixelFormatBayerGB12,
+        VmbPixelFormatBayerRG16, VmbPixelFormatBayerGR16, VmbPixelFormatBayerBG16, VmbPixelFormatBayerGB16,
+        VmbPixelFormatBayerRG12Packed, VmbPixelFormatBayerGR12Packed, VmbPixelFormatBayerBG12Packed, VmbPixelFormatBayerGB12Packed,
+        VmbPixelFormatBayerRG12p, VmbPixelFormatBayerGR12p, VmbPixelFormatBayerBG12p, VmbPixelFormatBayerGB12p,
+        VmbPixelFormatRgb8, VmbPixelFormatBgr8, VmbPixelFormatYuv422
+    };
+}
+
+void CreateRawData(const cv::Mat& image, VmbPixelFormatType pixelFormat, cv::Mat& rawData)
+{
+    if (image.type() != CV_8UC1 && image.type() != CV_8UC3) {
+        throw std::runtime_error("Unsupported image type: " + std::to_string(image.type()));
+    }
+
+    const FormatInfo info = GetFormatInfo(pixelFormat);
+    const int rows = image.rows;
+    const int cols = image.cols;
+
+    cv::Mat gray, bgr;
+    if (image.channels() == 1) {
+        gray = image;
+        if (IsBayer(info.layout) || info.layout == Layout::Rgb8 || info.layout == Layout::Bgr8 || info.layout == Layout::Yuv422) {
+            cv::cvtColor(image, bgr, cv::COLOR_GRAY2BGR);
+        }
+    }
+    else {
+        bgr = image;
+        if (!IsBayer(info.layout) && info.layout != Layout::Rgb8 && info.layout != Layout::Bgr8 && info.layout != Layout::Yuv422) {
+            cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+        }
+    }
+
+    // For the Bayer formats, the single-channel mosaic to be stored like a grayscale image
+    if (IsBayer(info.layout)) {
+        // The BGR channel of each pixel of a 2x2 cell: top left, top right, bottom left, bottom right
+        int channels[4] = { 0, 0, 0, 0 };
+        switch (info.bayerPattern) {
+        case BayerPattern::RG: channels[0] = 2; channels[1] = 1; channels[2] = 1; channels[3] = 0; break;
+        case BayerPattern::GR: channels[0] = 1; channels[1] = 2; channels[2] = 0; channels[3] = 1; break;
+        case BayerPattern::BG: channels[0] = 0; channels[1] = 1; channels[2] = 1; channels[3] = 2; break;
+        case BayerPattern::GB: channels[0] = 1; channels[1] = 0; channels[2] = 2; channels[3] = 1; break;
+        default: throw std::runtime_error("Not a Bayer pattern");
+        }
+
+        gray.create(rows, cols, CV_8UC1);
+        for (int y = 0; y < rows; ++y) {
+            const uint8_t* input = bgr.ptr<uint8_t>(y);
+            uint8_t* output = gray.ptr<uint8_t>(y);
+            for (int x = 0; x < cols; ++x) {
+                output[x] = input[3 * x + channels[(y % 2) * 2 + x % 2]];
+            }
+        }
+    }
+
+    switch (info.layout) {
+    case Layout::Mono8:
+    case Layout::Bayer8:
+        gray.copyTo(rawData);
+        return;
+
+    case Layout::Mono16:
+    case Layout::Bayer16:
+        gray.convertTo(rawData, CV_16UC1, 1 << (info.significantBits - 8));
+        return;
+
+    case Layout::Mono12Packed:
+    case Layout::Bayer12Packed:
+    case Layout::Mono12p:
+    case Layout::Bayer12p:
+    {
+        const bool gev = info.layout == Layout::Mono12Packed || info.layout == Layout::Bayer12Packed;
+        rawData.create(rows, (cols * 3 + 1) / 2, CV_8UC1);
+        for (int y = 0; y < rows; ++y) {
+            const uint8_t* input = gray.ptr<uint8_t>(y);
+            uint8_t* output = rawData.ptr<uint8_t>(y);
+            for (int x = 0; x < cols; x += 2, output += 3) {
+                const int p0 = input[x] << 4;
+                const int p1 = x + 1 < cols ? input[x + 1] << 4 : 0;
+                if (gev) {
+                    output[0] = static_cast<uint8_t>(p0 >> 4);
+                    output[1] = static_cast<uint8_t>(((p1 & 0x0f) << 4) | (p0 & 0x0f));
+                }
+                else {
+                    output[0] = static_cast<uint8_t>(p0);
+                    output[1] = static_cast<uint8_t>(((p1 & 0x0f) << 4) | (p0 >> 8));
+                }
+                if (x + 1 < cols) {
+                    output[2] = static_cast<uint8_t>(p1 >> 4);
+                }
+            }
+        }
+        return;
+    }
+
+    case Layout::Rgb8:
+        cv::cvtColor(bgr, rawData, cv::COLOR_BGR2RGB);
+        return;
+
+    case Layout::Bgr8:
+        bgr.copyTo(rawData);
+        return;
+
+    case Layout::Yuv422:
+    {
+        // UYVY: the chroma of each pixel pair is that of its first pixel
+        cv::Mat yuv;
+        cv::cvtColor(bgr, yuv, cv::COLOR_BGR2YUV);
+        rawData.create(rows, cols, CV_8UC2);
+        for (int y = 0; y < rows; ++y) {
+            const uint8_t* input = yuv.ptr<uint8_t>(y);
+            uint8_t* output = rawData.ptr<uint8_t>(y);
+            for (int x = 0; x < cols; ++x) {
+                const uint8_t* pair = input + 3 * (x - x % 2);
+                output[2 * x] = x % 2 == 0 ? pair[1] : pair[2];
+                output[2 * x + 1] = input[3 * x];
+            }
+        }
+        return;
+    }
+
+    default:
+        throw std::runtime_error("Unsupported pixel format: " + GetPixelFormatName(pixelFormat));
+    }
+}
+
+bool SetPixelFormatConversionInstructionSet(const std::string& name)
+{
+    InstructionSet instructionSet = InstructionSet::Avx2;
+    if (name == "scalar") {
+        instructionSet = InstructionSet::Scalar;
+    }
+    else if (name == "SSE4.1") {
+        instructionSet = InstructionSet::Sse41;
+    }
+    else if (name != "AVX2" && !name.empty()) {
+        return false;
+    }
+
+    if (!name.empty() && static_cast<int>(instructionSet) > static_cast<int>(GetAvailableInstructionSet())) {
+        return false;
+    }
+
+    instructionSetLimit = static_cast<int>(instructionSet);
+    return true;
+}
+
+std::string GetPixelFormatConversionInstructionSet()
+{
+    switch (GetInstructionSet()) {
+    case InstructionSet::Avx2: return "AVX2";
+    case InstructionSet::Sse41: return "SSE4.1";
+    default: return "scalar";
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+// Conversions from the Vimba pixel formats to 8-bit grayscale or BGR images,
+// which is what the image encoders (JPEG in particular) can accept.
+
+#include <VimbaC/Include/VmbCommonTypes.h>
+
+#include <opencv2/core/core.hpp>
+
+#include <string>
+#include <vector>
+
+// Wraps a Vimba frame buffer (without copying) as a cv::Mat of a type that matches the
+// pixel format: e.g., CV_16UC1 for Mono12, CV_8UC3 for RGB8, and for the packed formats
+// CV_8UC1 with as many columns as there are bytes per row. Returns an empty Mat if the
+// pixel format is not supported.
+cv::Mat WrapPixelBuffer(VmbUchar_t* data, VmbUint32_t width, VmbUint32_t height, VmbPixelFormatType pixelFormat);
+
+// How many bytes WrapPixelBuffer reads for an image of the size and pixel format; 0 if the pixel
+// format is not supported
+size_t GetRawDataSize(VmbUint32_t width, VmbUint32_t height, VmbPixelFormatType pixelFormat);
+
+bool IsSupportedPixelFormat(VmbPixelFormatType pixelFormat);
+
+bool IsBayerPixelFormat(VmbPixelFormatType pixelFormat);
+
+enum class DebayerMode {
+    Full,       // interpolate to full resolution
+    Superpixel  // make each 2x2 Bayer cell one BGR pixel, i.e., halve the width and the height
+};
+
+// True if the raw data can be encoded as such (Mono8 and BGR8)
+bool IsPassThroughPixelFormat(VmbPixelFormatType pixelFormat);
+
+// The size of the image in pixels, given data wrapped by WrapPixelBuffer
+cv::Size GetImageSize(const cv::Mat& rawData, VmbPixelFormatType pixelFormat);
+
+// A view (without copying) of the pixels inside roi, given data wrapped by WrapPixelBuffer.
+// The roi, in pixels, is first clipped to the image, and then grown as needed so that the view
+// can be converted like a full frame: Bayer formats need an even offset and size (to keep the
+// pattern), and packed and YUV formats an even x offset and width. The adjusted roi is returned
+// in roi; if it is empty, so is the view.
+cv::Mat GetRegionOfInterest(const cv::Mat& rawData, VmbPixelFormatType pixelFormat, cv::Rect& roi);
+
+// The size of the image that ConvertPixelFormat produces
+cv::Size GetConvertedImageSize(const cv::Mat& rawData, VmbPixelFormatType pixelFormat, DebayerMode debayerMode);
+
+// CV_8UC1 or CV_8UC3
+int GetConvertedImageType(VmbPixelFormatType pixelFormat);
+
+// Converts data wrapped by WrapPixelBuffer to an 8-bit grayscale or BGR image. If image already
+// has the right size and type, it is written in place; for pass-through formats, image is simply
+// made to refer to rawData.
+void ConvertPixelFormat(const cv::Mat& rawData, VmbPixelFormatType pixelFormat, cv::Mat& image, DebayerMode debayerMode = DebayerMode::Full);
+
+// A small grayscale (CV_8UC1) thumbnail of data wrapped by WrapPixelBuffer, for telling whether
+// anything has changed between frames. Much cheaper than ConvertPixelFormat followed by a resize:
+// the raw data is area-averaged as it is, Bayer patterns included, and the packed formats use the
+// most significant bits of every second pixel only. size should be much smaller than the image.
+void CreateThumbnail(const cv::Mat& rawData, VmbPixelFormatType pixelFormat, cv::Size size, cv::Mat& thumbnail);
+
+std::string GetPixelFormatName(VmbPixelFormatType pixelFormat);
+
+// Case-insensitive; the names are those of GetPixelFormatName. Returns false if the name is not
+// that of a supported pixel format.
+bool ParsePixelFormat(const std::string& name, VmbPixelFormatType& pixelFormat);
+
+std::vector<VmbPixelFormatType> GetSupportedPixelFormats();
+
+// The inverse of ConvertPixelFormat, for testing and benchmarking without a camera: makes raw data
+// in the layout of WrapPixelBuffer out of an 8-bit grayscale or BGR image. The extra bits of the
+// wider formats are zero, and Bayer formats keep only one color component per pixel.
+void CreateRawData(const cv::Mat& image, VmbPixelFormatType pixelFormat, cv::Mat& rawData);
+
+// Which instruction set the conversion kernels use on this machine: "AVX2", "SSE4.1", or "scalar"
+std::string GetPixelFormatConversionInstructionSet();
+
+// For testing: limits the conversion kernels to "scalar", "SSE4.1" or "AVX2" (an empty name lifts
+// the limit). Returns false if the instruction set is unknown, or not available on this machine.
+bool SetPixelFormatConversionInstructionSet(const std::string& name);
@@ -0,0 +1,319 @@
+#include "RawRecorder.h"
+
+#include <numcfc/Logger.h>
+
+#include "../../lib/system_clock_time_point_string_conversion/system_clock_time_point_string_conversion.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+    uint64_t RoundUp(uint64_t value, uint64_t multiple)
+    {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+    uint64_t GetPageSize()
+    {
+#ifdef _WIN32
+        // Views of a file mapping start at multiples of the allocation granularity, not the page size
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+        return systemInfo.dwAllocationGranularity;
+#else
+        return static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+#endif
+    }
+
+    std::chrono::system_clock::time_point FromMicroseconds(int64_t time_us)
+    {
+        return std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::microseconds(time_us)));
+    }
+
+    int64_t ToMicroseconds(std::chrono::system_clock::time_point time)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+    }
+
+    // E.g., RawRecording_DEV_1.ring -> RawRecording_DEV_1_frozen_2026-10-16T08.30.12.345Z.ring
+    std::string GetFrozenFilename(const std::string& filename, int64_t frozenAt_us)
+    {
+        std::string timestamp = system_clock_time_point_string_conversion::to_string(FromMicroseconds(frozenAt_us));
+        std::replace(timestamp.begin(), timestamp.end(), ':', '.');
+
+        const size_t directoryEnd = filename.find_last_of("/\\");
+        const size_t dot = filename.rfind('.');
+        const bool hasExtension = dot != std::string::npos && (directoryEnd == std::string::npos || dot > directoryEnd);
+        const std::string stem = hasExtension ? filename.substr(0, dot) : filename;
+        const std::string extension = hasExtension ? filename.substr(dot) : std::string();
+
+        return stem + "_frozen_" + timestamp + extension;
+    }
+
+    // A frozen recording left behind by an earlier run is renamed, so that it is not overwritten
+    void KeepFrozenRecording(const std::string& filename)
+    {
+        RawRecordingHeader header;
+        {
+            std::ifstream in(filename, std::ios::binary);
+            if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))
+                || std::memcmp(header.magic, rawRecordingMagic, sizeof(header.magic)) != 0 || !header.frozen) {
+                return;
+            }
+        }
+
+        const std::string frozenFilename = GetFrozenFilename(filename, header.frozenAt_us);
+        if (std::rename(filename.c_str(), frozenFilename.c_str()) != 0) {
+            throw std::runtime_error("Unable to rename frozen raw recording " + filename + " to " + frozenFilename);
+        }
+        numcfc::Logger::LogAndEcho("Frozen raw recording kept as " + frozenFilename, "log_init");
+    }
+}
+
+const std::chrono::steady_clock::rep RawRecorder::notFreezing = std::numeric_limits<std::chrono::steady_clock::rep>::max();
+
+RawRecorder::RawRecorder(const std::string& filename, uint64_t fileSize, size_t maxFrameSize, const std::string& cameraId)
+    : filename(filename)
+    , freezeAt(notFreezing)
+{
+    KeepFrozenRecording(filename);
+
+    const uint64_t pageSize = GetPageSize();
+    slotSize = RoundUp(std::max(static_cast<uint64_t>(maxFrameSize), static_cast<uint64_t>(1)), pageSize);
+    slotCount = std::max(fileSize / (slotSize + sizeof(RawRecordingIndexEntry)), static_cast<uint64_t>(1));
+
+    const uint64_t indexOffset = RoundUp(sizeof(RawRecordingHeader), 64);
+    const uint64_t dataOffset = RoundUp(indexOffset + slotCount * sizeof(RawRecordingIndexEntry), pageSize);
+    this->fileSize = dataOffset + slotCount * slotSize;
+
+    const auto fail = [&](const std::string& what) {
+        const std::string message = what + " " + filename + " (" + GetDescription() + ")";
+        Unmap();
+        throw std::runtime_error(message);
+    };
+
+#ifdef _WIN32
+    fileHandle = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        fileHandle = nullptr;
+        fail("Unable to create raw recording");
+    }
+
+    LARGE_INTEGER size;
+    size.QuadPart = static_cast<LONGLONG>(this->fileSize);
+    if (!SetFilePointerEx(fileHandle, size, NULL, FILE_BEGIN) || !SetEndOfFile(fileHandle)) {
+        fail("Unable to allocate raw recording");
+    }
+
+    mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READWRITE, static_cast<DWORD>(size.HighPart), size.LowPart, NULL);
+    if (!mappingHandle) {
+        fail("Unable to map raw recording");
+    }
+
+    data = static_cast<uint8_t*>(MapViewOfFile(mappingHandle, FILE_MAP_WRITE, 0, 0, 0));
+    if (!data) {
+        fail("Unable to map raw recording");
+    }
+#else
+    fileDescriptor = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fileDescriptor < 0) {
+        fail("Unable to create raw recording");
+    }
+
+    // Reserved up front: running out of disk space while writing to a mapped file would crash the process
+    if (posix_fallocate(fileDescriptor, 0, static_cast<off_t>(this->fileSize)) != 0) {
+        fail("Unable to allocate raw recording");
+    }
+
+    void* mapped = mmap(nullptr, this->fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+    if (mapped == MAP_FAILED) {
+        fail("Unable to map raw recording");
+    }
+    data = static_cast<uint8_t*>(mapped);
+#endif
+
+    // The file is all zeros to begin with, i.e. all the slots are empty
+    header = reinterpret_cast<RawRecordingHeader*>(data);
+    index = reinterpret_cast<RawRecordingIndexEntry*>(data + indexOffset);
+
+    std::memcpy(header->magic, rawRecordingMagic, sizeof(header->magic));
+    header->headerSize = sizeof(RawRecordingHeader);
+    header->indexEntrySize = sizeof(RawRecordingIndexEntry);
+    header->slotCount = slotCount;
+    header->slotSize = slotSize;
+    header->indexOffset = indexOffset;
+    header->dataOffset = dataOffset;
+    header->nextSequence = nextSequence;
+    std::strncpy(header->cameraId, cameraId.c_str(), sizeof(header->cameraId) - 1);
+
+    for (uint64_t slot = 0; slot < slotCount; ++slot) {
+        index[slot].offset = dataOffset + slot * slotSize;
+    }
+}
+
+RawRecorder::~RawRecorder()
+{
+    Unmap();
+}
+
+void RawRecorder::Unmap()
+{
+    // Whatever has been written stays in the page cache, and gets to the disk even after unmapping
+#ifdef _WIN32
+    if (data) {
+        UnmapViewOfFile(data);
+    }
+    if (mappingHandle) {
+        CloseHandle(mappingHandle);
+    }
+    if (fileHandle) {
+        CloseHandle(fileHandle);
+    }
+    fileHandle = mappingHandle = nullptr;
+#else
+    if (data) {
+        munmap(data, fileSize);
+    }
+    if (fileDescriptor >= 0) {
+        close(fileDescriptor);
+    }
+    fileDescriptor = -1;
+#endif
+    data = nullptr;
+}
+
+bool RawRecorder::Record(const void* frameData, size_t size, uint32_t width, uint32_t height, VmbPixelFormatType pixelFormat,
+    uint64_t counter, std::chrono::system_clock::time_point timestamp, std::chrono::steady_clock::time_point now)
+{
+    if (frozen) {
+        return false;
+    }
+    if (now.time_since_epoch().count() >= freezeAt.load()) {
+        FreezeNow(std::chrono::system_clock::now());
+        return false;
+    }
+    if (size > slotSize) {
+        ++framesTooLarge;
+        return false;
+    }
+
+    const uint64_t sequence = nextSequence++;
+    RawRecordingIndexEntry& entry = index[(sequence - 1) % slotCount];
+
+    // Marked empty while being overwritten, so that a frame cut short (say, by a crash) is not
+    // mistaken for a complete one
+    entry.sequence = 0;
+    std::atomic_thread_fence(std::memory_order_release);
+
+    std::memcpy(data + entry.offset, frameData, size);
+
+    entry.counter = counter;
+    entry.timestamp_us = ToMicroseconds(timestamp);
+    entry.size = static_cast<uint32_t>(size);
+    entry.width = width;
+    entry.height = height;
+    entry.pixelFormat = static_cast<uint32_t>(pixelFormat);
+
+    std::atomic_thread_fence(std::memory_order_release);
+    entry.sequence = sequence;
+    header->nextSequence = nextSequence;
+
+    ++framesRecorded;
+    return true;
+}
+
+void RawRecorder::Freeze(std::chrono::steady_clock::duration delay)
+{
+    std::chrono::steady_clock::rep expected = notFreezing;
+    freezeAt.compare_exchange_strong(expected, (std::chrono::steady_clock::now() + delay).time_since_epoch().count());
+}
+
+void RawRecorder::Resume()
+{
+    freezeAt = notFreezing;
+    header->frozen = 0;
+    header->frozenAt_us = 0;
+    freezeReported = false;
+    frozen = false;
+}
+
+bool RawRecorder::CheckFrozen(std::chrono::steady_clock::time_point now)
+{
+    if (!frozen && now.time_since_epoch().count() >= freezeAt.load()) {
+        FreezeNow(std::chrono::system_clock::now());
+    }
+    if (!frozen || freezeReported.exchange(true)) {
+        return false;
+    }
+
+    // Only started here; the OS finishes writing the pages in the background
+#ifdef _WIN32
+    FlushViewOfFile(data, 0);
+#else
+    msync(data, fileSize, MS_ASYNC);
+#endif
+    return true;
+}
+
+void RawRecorder::FreezeNow(std::chrono::system_clock::time_point time)
+{
+    // A frame being written at this moment (if frozen from another thread) still gets completed
+    if (!frozen.exchange(true)) {
+        header->frozenAt_us = ToMicroseconds(time);
+        header->frozen = 1;
+    }
+}
+
+std::string RawRecorder::GetDescription() const
+{
+    std::ostringstream description;
+    description << std::fixed << std::setprecision(1)
+        << slotCount << " x " << slotSize / 1048576.0 << " MiB = " << fileSize / 1073741824.0 << " GiB in " << filename;
+    return description.str();
+}
+
+std::string RawRecorder::GetWindowDescription() const
+{
+    const RawRecordingIndexEntry* oldest = nullptr;
+    const RawRecordingIndexEntry* newest = nullptr;
+    size_t frameCount = 0;
+
+    for (uint64_t slot = 0; slot < slotCount; ++slot) {
+        const RawRecordingIndexEntry& entry = index[slot];
+        if (entry.sequence == 0) {
+            continue;
+        }
+        if (!oldest || entry.sequence < oldest->sequence) {
+            oldest = &entry;
+        }
+        if (!newest || entry.sequence > newest->sequence) {
+            newest = &entry;
+        }
+        ++frameCount;
+    }
+
+    if (!frameCount) {
+        return "no frames";
+    }
+
+    return std::to_string(frameCount) + " frame" + (frameCount == 1 ? "" : "s")
+        + ", counters " + std::to_string(oldest->counter) + " to " + std::to_string(newest->counter)
+        + ", from " + system_clock_time_point_string_conversion::to_string(FromMicroseconds(oldest->timestamp_us))
+        + " to " + system_clock_time_point_string_conversion::to_string(FromMicroseconds(newest->timestamp_us));
+}
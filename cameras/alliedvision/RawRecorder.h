@@ -0,0 +1,126 @@
+#pragma once
+
+// Keeps the latest raw frames of a camera in a ring file on disk, so that when something goes
+// wrong, the frames leading up to it (and just after it) can be looked at afterwards, at the full
+// frame rate and without any encoding losses. The frames are copied as they are, straight out of
+// the buffer they arrived in, into a file that is allocated and mapped into memory up front: no
+// encoding, no allocation, and no system calls while recording. Writing the pages to disk is left
+// to the OS.
+//
+// A freeze stops the recording (after a delay, so that the frames just after the event get in as
+// well), and leaves the file as it is, to be converted by the RawExport tool. Until resumed, a
+// frozen file is not written to; if the process starts over, a frozen file is renamed first, so
+// that it is not overwritten.
+//
+// The file, in the native byte order:
+//
+//   RawRecordingHeader
+//   RawRecordingIndexEntry * slotCount    (at indexOffset)
+//   slotSize bytes * slotCount            (at dataOffset; entry i describes slot i)
+//
+// The frames go to the slots in turn, so the oldest one is overwritten when the file is full.
+
+#include <VimbaC/Include/VmbCommonTypes.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+const char rawRecordingMagic[8] = { 'O', 'I', 'S', 'R', 'A', 'W', 'R', '1' };
+
+struct RawRecordingHeader {
+    char magic[8];
+    uint32_t headerSize;            // sizeof(RawRecordingHeader)
+    uint32_t indexEntrySize;        // sizeof(RawRecordingIndexEntry)
+    uint64_t slotCount;
+    uint64_t slotSize;              // a multiple of the page size
+    uint64_t indexOffset;
+    uint64_t dataOffset;
+    uint64_t nextSequence;          // that of the next frame to be written
+    uint32_t frozen;                // nonzero if frozen
+    uint32_t reserved;
+    int64_t frozenAt_us;            // system time, since the epoch
+    char cameraId[64];              // zero-terminated
+};
+
+struct RawRecordingIndexEntry {
+    uint64_t sequence;              // 1 for the first frame written, 2 for the next, etc.; 0 = empty, or being written
+    uint64_t counter;               // that of the Image messages
+    int64_t timestamp_us;           // system time, since the epoch
+    uint64_t offset;                // of the data, from the start of the file
+    uint32_t size;                  // in bytes
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixelFormat;           // VmbPixelFormatType
+};
+
+class RawRecorder {
+public:
+    // Creates a file big enough for at least one frame of maxFrameSize bytes, and as many as fit in
+    // fileSize bytes. Throws std::runtime_error if the file cannot be created or mapped.
+    RawRecorder(const std::string& filename, uint64_t fileSize, size_t maxFrameSize, const std::string& cameraId);
+    ~RawRecorder();
+
+    RawRecorder(const RawRecorder&) = delete;
+    RawRecorder& operator=(const RawRecorder&) = delete;
+
+    // Call with each complete frame, from the thread that receives the frames. Returns false if the
+    // frame was not recorded: because frozen, or because the frame does not fit in a slot.
+    bool Record(const void* frameData, size_t size, uint32_t width, uint32_t height, VmbPixelFormatType pixelFormat,
+        uint64_t counter, std::chrono::system_clock::time_point timestamp, std::chrono::steady_clock::time_point now);
+
+    // Any thread: stops the recording once the delay has passed. If a freeze is pending already,
+    // the earlier one stands, so that the first event is never pushed out of the file.
+    void Freeze(std::chrono::steady_clock::duration delay);
+
+    // Any thread: cancels any pending freeze, and starts overwriting the frozen frames
+    void Resume();
+
+    // Call now and then from the main thread: returns true once after the recording has frozen,
+    // having started writing the file to disk. Freezes also if the delay has passed but no frame
+    // has arrived since.
+    bool CheckFrozen(std::chrono::steady_clock::time_point now);
+
+    bool IsFrozen() const { return frozen; }
+    bool IsFreezePending() const { return freezeAt.load() != notFreezing; }
+
+    size_t GetAndResetFramesRecorded() { return framesRecorded.exchange(0); }
+    size_t GetAndResetFramesTooLarge() { return framesTooLarge.exchange(0); }
+
+    const std::string& GetFilename() const { return filename; }
+    uint64_t GetSlotSize() const { return slotSize; }
+
+    // E.g., "2048 x 12.0 MiB = 24.0 GiB in RawRecording_DEV_1AB22C00C2F1.ring"
+    std::string GetDescription() const;
+
+    // E.g., "1024 frames, counters 1500 to 2523, from 2026-10-16T08:30:12.345Z to ..."
+    std::string GetWindowDescription() const;
+
+private:
+    void Unmap();
+    void FreezeNow(std::chrono::system_clock::time_point time);
+
+    static const std::chrono::steady_clock::rep notFreezing;
+
+    const std::string filename;
+    uint64_t slotSize = 0;
+    uint64_t slotCount = 0;
+    uint64_t fileSize = 0;
+    uint8_t* data = nullptr;
+    RawRecordingHeader* header = nullptr;
+    RawRecordingIndexEntry* index = nullptr;
+    uint64_t nextSequence = 1;      // touched only by the thread that receives the frames
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#else
+    int fileDescriptor = -1;
+#endif
+    std::atomic<bool> frozen{ false };
+    std::atomic<bool> freezeReported{ false };
+    std::atomic<std::chrono::steady_clock::rep> freezeAt;
+    std::atomic<size_t> framesRecorded{ 0 };
+    std::atomic<size_t> framesTooLarge{ 0 };
+};
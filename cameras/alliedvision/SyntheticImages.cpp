@@ -0,0 +1,126 @@
+#include "SyntheticImages.h"
+
+#include "../../common/ImageFormats.h"
+
+#include <opencv2/core/utility.hpp> // cv::glob
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+void CreateTestPattern(const std::string& pattern, int width, int height, bool color, uint64_t frameIndex, double noiseLevel, cv::Mat& image)
+{
+    const int shift = static_cast<int>(frameIndex % 1024) * 4;
+
+    image.create(height, width, color ? CV_8UC3 : CV_8UC1);
+
+    if (pattern == "gradient") {
+        const int period = std::max(1, width + height);
+        for (int y = 0; y < height; ++y) {
+            uint8_t* row = image.ptr<uint8_t>(y);
+            for (int x = 0; x < width; ++x) {
+                const uint8_t diagonal = static_cast<uint8_t>(((x + y + shift) % period) * 255 / period);
+                if (color) {
+                    row[3 * x] = static_cast<uint8_t>(x * 255 / std::max(1, width - 1));
+                    row[3 * x + 1] = static_cast<uint8_t>(y * 255 / std::max(1, height - 1));
+                    row[3 * x + 2] = diagonal;
+                }
+                else {
+                    row[x] = diagonal;
+                }
+            }
+        }
+    }
+    else if (pattern == "checkerboard") {
+        const int squareSize = 32;
+        for (int y = 0; y < height; ++y) {
+            uint8_t* row = image.ptr<uint8_t>(y);
+            for (int x = 0; x < width; ++x) {
+                const bool light = (((x + shift) / squareSize) + (y / squareSize)) % 2 != 0;
+                const uint8_t value = light ? 224 : 32;
+                if (color) {
+                    row[3 * x] = value;
+                    row[3 * x + 1] = light ? 192 : 64;
+                    row[3 * x + 2] = 255 - value;
+                }
+                else {
+                    row[x] = value;
+                }
+            }
+        }
+    }
+    else if (pattern == "noise") {
+        cv::RNG rng(frameIndex + 1);
+        rng.fill(image, cv::RNG::UNIFORM, 0, 256);
+    }
+    else {
+        throw std::runtime_error("Unknown test pattern: " + pattern);
+    }
+
+    if (noiseLevel > 0.0) {
+        cv::Mat noise(image.size(), CV_16SC(image.channels()));
+        cv::RNG rng(frameIndex + 1);
+        rng.fill(noise, cv::RNG::NORMAL, 0, noiseLevel);
+        cv::Mat noisy;
+        image.convertTo(noisy, CV_16S);
+        noisy += noise;
+        noisy.convertTo(image, CV_8U);
+    }
+}
+
+cv::Mat ReadImageFile(const std::string& filename)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        return cv::Mat();
+    }
+
+    const std::vector<unsigned char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    try {
+        image_formats::Image decoded;
+        if (image_formats::Decode(data.data(), data.size(), decoded)) {
+            const int type = decoded.channels == 1 ? CV_8UC1 : CV_8UC3;
+            return cv::Mat(decoded.height, decoded.width, type, decoded.pixels.data()).clone();
+        }
+    }
+    catch (std::exception&) {
+        return cv::Mat();
+    }
+
+    cv::Mat image = cv::imdecode(data, cv::IMREAD_UNCHANGED);
+    if (image.empty()) {
+        return image;
+    }
+
+    if (image.depth() != CV_8U) {
+        double minValue = 0, maxValue = 0;
+        cv::minMaxLoc(image.reshape(1), &minValue, &maxValue);
+        image.convertTo(image, CV_8U, maxValue > 255 ? 255.0 / maxValue : 1.0);
+    }
+
+    switch (image.channels()) {
+    case 1: case 3: return image;
+    case 4: cv::cvtColor(image, image, cv::COLOR_BGRA2BGR); return image;
+    default: return cv::Mat();
+    }
+}
+
+std::vector<cv::Mat> ReadImageFiles(const std::string& directory)
+{
+    std::vector<cv::String> filenames;
+    cv::glob(directory + "/*", filenames, false);
+    std::sort(filenames.begin(), filenames.end());
+
+    std::vector<cv::Mat> images;
+    for (const auto& filename : filenames) {
+        cv::Mat image = ReadImageFile(filename);
+        if (!image.empty()) {
+            images.push_back(image);
+        }
+    }
+    return images;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// Images for running the capture and encoding path without a camera: test patterns that
+// change from frame to frame, and images read from files.
+
+#include <opencv2/core/core.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The pattern is "gradient", "checkerboard" or "noise"; throws std::runtime_error if unknown.
+// The pattern moves a few pixels per frame, so that consecutive frames are not identical.
+// noiseLevel is the standard deviation of Gaussian noise added on top, in 8-bit levels.
+// The result is 8-bit grayscale, or BGR if color is set.
+void CreateTestPattern(const std::string& pattern, int width, int height, bool color, uint64_t frameIndex, double noiseLevel, cv::Mat& image);
+
+// Reads an image in the raw or qoi format of common/ImageFormats.h, or in any format that
+// OpenCV can read, as 8-bit grayscale or BGR. Returns an empty Mat if the file cannot be read.
+cv::Mat ReadImageFile(const std::string& filename);
+
+// Reads all the images in a directory, in alphabetical order; skips files that are not images
+std::vector<cv::Mat> ReadImageFiles(const std::string& directory);
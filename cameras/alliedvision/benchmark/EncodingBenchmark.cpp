@@ -0,0 +1,711 @@
+// Measures how many frames per second the capture PC can convert and encode: runs the stages of
+// the encoding threads of AlliedVision (copy out of the camera buffer, pixel format conversion,
+// encoding, building the message, and handing it over for sending) on in-memory frames, for each
+// combination of the settings in EncodingBenchmark.ini. Prints a table, and writes the results
+// as JSON.
+//
+// With Mode=queue, measures instead how long the camera thread takes to hand an item over to the
+// encoding threads, with the lock-free ring of ImageEncodingQueue vs. a deque behind a mutex, when
+// the encoding threads keep popping from the same queue.
+
+#include "../PixelFormatConversion.h"
+#include "../ImageEncoder.h"
+#include "../SyntheticImages.h"
+#include "../MpmcRing.h"
+
+#include <messaging/claim/AttributeMessage.h>
+
+#include <numcfc/IniFile.h>
+
+#include "../../../lib/system_clock_time_point_string_conversion/system_clock_time_point_string_conversion.h"
+
+#include "../../../lib/tuc/include/tuc/string.hpp"
+#include "../../../lib/nlohmann_json/single_include/nlohmann/json.hpp"
+
+#include <opencv2/imgproc/imgproc.hpp> // cv::resize
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+    enum Stage {
+        Copy,
+        Convert,
+        Encode,
+        Message,
+        Send,
+        StageCount
+    };
+
+    const char* const stageNames[StageCount] = { "copy", "convert", "encode", "message", "send" };
+
+    struct Configuration {
+        int width = 0;
+        int height = 0;
+        VmbPixelFormatType pixelFormat = VmbPixelFormatMono8;
+        std::string imageFormat;
+        std::string encoder;
+        int jpegQuality = 0;
+        size_t threadCount = 1;
+    };
+
+    struct Result {
+        Configuration configuration;
+        size_t frameCount = 0;
+        double elapsed_s = 0.0;
+        double cpuTime_s = 0.0;
+        double totalBytes = 0.0;
+        std::vector<double> stageTimes_us[StageCount];
+        std::vector<double> totalTimes_us;
+    };
+
+    // The user and kernel time of all the threads of the process
+    double GetProcessCpuTime_s()
+    {
+#ifdef _WIN32
+        FILETIME creationTime, exitTime, kernelTime, userTime;
+        if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        const auto toSeconds = [](const FILETIME& fileTime) {
+            return ((static_cast<uint64_t>(fileTime.dwHighDateTime) << 32) | fileTime.dwLowDateTime) * 1e-7; // 100 ns units
+        };
+        return toSeconds(kernelTime) + toSeconds(userTime);
+#else
+        timespec time;
+        if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time) != 0) {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        return time.tv_sec + time.tv_nsec * 1e-9;
+#endif
+    }
+
+    // Returns the given percentile (0...1) of the values, which get reordered; 0 if there are no values
+    double GetPercentile(std::vector<double>& values, double percentile)
+    {
+        if (values.empty()) {
+            return 0.0;
+        }
+        const size_t index = std::min(values.size() - 1, static_cast<size_t>(percentile * values.size()));
+        std::nth_element(values.begin(), values.begin() + index, values.end());
+        return values[index];
+    }
+
+    // E.g., "1, 2,4" -> { "1", "2", "4" }
+    std::vector<std::string> SplitList(const std::string& value)
+    {
+        std::vector<std::string> items;
+        std::istringstream iss(value);
+        std::string item;
+        while (std::getline(iss, item, ',')) {
+            item.erase(0, item.find_first_not_of(" \t"));
+            item.erase(item.find_last_not_of(" \t") + 1);
+            if (!item.empty()) {
+                items.push_back(item);
+            }
+        }
+        return items;
+    }
+
+    // Runs the configuration on as many threads as configured, for the given time
+    Result RunBenchmark(const Configuration& configuration, const std::vector<cv::Mat>& rawFrames, DebayerMode debayerMode, double duration_s)
+    {
+        ImageEncoderSettings settings;
+        settings.imageFormat = configuration.imageFormat;
+        settings.jpegQuality = configuration.jpegQuality;
+
+        struct ThreadResult {
+            size_t frameCount = 0;
+            double totalBytes = 0.0;
+            std::vector<double> stageTimes_us[StageCount];
+            std::vector<double> totalTimes_us;
+            std::exception_ptr error;
+        };
+
+        std::vector<ThreadResult> threadResults(configuration.threadCount);
+        std::atomic<size_t> readyCount(0);
+        std::atomic<bool> started(false);
+        std::atomic<bool> running(true);
+
+        // Instead of a PostOffice, a sink that merely looks at the message
+        std::atomic<size_t> bytesSent(0);
+        const std::function<void(claim::AttributeMessage&)> sendMessage = [&bytesSent](claim::AttributeMessage& amsg) {
+            bytesSent += amsg.m_attributes["data"].size();
+        };
+
+        const auto runThread = [&](size_t threadIndex) {
+            ThreadResult& threadResult = threadResults[threadIndex];
+            bool warmedUp = false;
+
+            try {
+                std::unique_ptr<ImageEncoder> imageEncoder = CreateImageEncoder(configuration.encoder, settings);
+
+                cv::Mat rawData;
+                cv::Mat image;
+
+                for (size_t i = threadIndex; running; i += configuration.threadCount) {
+                    const cv::Mat& frame = rawFrames[i % rawFrames.size()];
+
+                    const auto copyStarted = std::chrono::steady_clock::now();
+                    frame.copyTo(rawData);
+                    const auto conversionStarted = std::chrono::steady_clock::now();
+                    ConvertPixelFormat(rawData, configuration.pixelFormat, image, debayerMode);
+                    const auto encodingStarted = std::chrono::steady_clock::now();
+                    std::string encodedImage;
+                    imageEncoder->Encode(image, encodedImage);
+                    const size_t encodedByteCount = encodedImage.size();
+                    const auto messageStarted = std::chrono::steady_clock::now();
+
+                    claim::AttributeMessage amsg;
+                    amsg.m_type = "Image";
+                    amsg.m_attributes["id"] = "benchmark_" + std::to_string(i) + "." + configuration.imageFormat;
+                    amsg.m_attributes["timestamp"] = system_clock_time_point_string_conversion::to_string(std::chrono::system_clock::now());
+                    amsg.m_attributes["counter"] = std::to_string(i);
+                    amsg.m_attributes["rows"] = std::to_string(image.rows);
+                    amsg.m_attributes["cols"] = std::to_string(image.cols);
+                    amsg.m_attributes["format"] = configuration.imageFormat;
+                    if (IsJpegFormat(configuration.imageFormat)) {
+                        amsg.m_attributes["jpegQuality"] = std::to_string(static_cast<double>(configuration.jpegQuality));
+                    }
+                    amsg.m_attributes["data"] = std::move(encodedImage);
+
+                    const auto sendingStarted = std::chrono::steady_clock::now();
+                    sendMessage(amsg);
+                    const auto done = std::chrono::steady_clock::now();
+
+                    if (!warmedUp) {
+                        // The first frame allocates the buffers, so it does not count
+                        warmedUp = true;
+                        ++readyCount;
+                        while (!started) {
+                            std::this_thread::yield();
+                        }
+                        continue;
+                    }
+
+                    const auto us = [](std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end) {
+                        return std::chrono::duration<double, std::micro>(end - begin).count();
+                    };
+
+                    threadResult.stageTimes_us[Copy].push_back(us(copyStarted, conversionStarted));
+                    threadResult.stageTimes_us[Convert].push_back(us(conversionStarted, encodingStarted));
+                    threadResult.stageTimes_us[Encode].push_back(us(encodingStarted, messageStarted));
+                    threadResult.stageTimes_us[Message].push_back(us(messageStarted, sendingStarted));
+                    threadResult.stageTimes_us[Send].push_back(us(sendingStarted, done));
+                    threadResult.totalTimes_us.push_back(us(copyStarted, done));
+                    threadResult.totalBytes += encodedByteCount;
+                    ++threadResult.frameCount;
+                }
+            }
+            catch (...) {
+                threadResult.error = std::current_exception();
+                if (!warmedUp) {
+                    ++readyCount;
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < configuration.threadCount; ++i) {
+            threads.emplace_back(runThread, i);
+        }
+
+        while (readyCount < configuration.threadCount) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        const double cpuTimeStarted_s = GetProcessCpuTime_s();
+        const auto timeStarted = std::chrono::steady_clock::now();
+        started = true;
+
+        std::this_thread::sleep_for(std::chrono::duration<double>(duration_s));
+        running = false;
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        for (const auto& threadResult : threadResults) {
+            if (threadResult.error) {
+                std::rethrow_exception(threadResult.error);
+            }
+        }
+
+        Result result;
+        result.configuration = configuration;
+        result.elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - timeStarted).count();
+        result.cpuTime_s = GetProcessCpuTime_s() - cpuTimeStarted_s;
+
+        for (auto& threadResult : threadResults) {
+            result.frameCount += threadResult.frameCount;
+            result.totalBytes += threadResult.totalBytes;
+            for (int stage = 0; stage < StageCount; ++stage) {
+                auto& times = result.stageTimes_us[stage];
+                times.insert(times.end(), threadResult.stageTimes_us[stage].begin(), threadResult.stageTimes_us[stage].end());
+            }
+            result.totalTimes_us.insert(result.totalTimes_us.end(), threadResult.totalTimes_us.begin(), threadResult.totalTimes_us.end());
+        }
+
+        return result;
+    }
+
+    nlohmann::json GetPercentiles(std::vector<double>& times_us)
+    {
+        nlohmann::json percentiles;
+        percentiles["p50_us"] = GetPercentile(times_us, 0.50);
+        percentiles["p95_us"] = GetPercentile(times_us, 0.95);
+        percentiles["p99_us"] = GetPercentile(times_us, 0.99);
+        return percentiles;
+    }
+
+    // Stands for an ImageEncodingInputItem: a few shared pointers, and some timestamps
+    struct QueueItem {
+        std::shared_ptr<void> rawDataOwner;
+        std::shared_ptr<void> reorderTicket;
+        std::shared_ptr<void> metrics;
+        std::chrono::steady_clock::time_point pushed;
+        uint64_t counter = 0;
+    };
+
+    // How ImageEncodingQueue used to hold the items of a camera
+    class LockedQueue {
+    public:
+        explicit LockedQueue(size_t capacity)
+            : capacity(capacity)
+        {}
+
+        bool TryPush(QueueItem&& item) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (items.size() >= capacity) {
+                return false;
+            }
+            items.push_back(std::move(item));
+            return true;
+        }
+
+        bool TryPop(QueueItem& item) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (items.empty()) {
+                return false;
+            }
+            item = std::move(items.front());
+            items.pop_front();
+            return true;
+        }
+
+    private:
+        const size_t capacity;
+        std::mutex mutex;
+        std::deque<QueueItem> items;
+    };
+
+    struct QueueResult {
+        size_t itemCount = 0;
+        size_t fullCount = 0;
+        double elapsed_s = 0.0;
+        std::vector<double> pushTimes_us;
+        std::vector<double> latencies_us;
+    };
+
+    void WaitUntil(std::chrono::steady_clock::time_point time)
+    {
+        while (std::chrono::steady_clock::now() < time) {
+            // busy-wait, as sleeping would add jitter of its own
+        }
+    }
+
+    // One producer, like the Vimba callback of one camera, pushing at the given rate (0 = as fast as
+    // it can), and consumers that pop and then work for the given time. The consumers are woken up
+    // the way ImageEncodingQueue does it.
+    template <typename Queue>
+    QueueResult RunQueueBenchmark(size_t capacity, size_t consumerCount, double producerRate, double consumerWork_us, double duration_s)
+    {
+        Queue queue(capacity);
+
+        std::atomic<bool> running(true);
+        std::atomic<size_t> itemCount(0);
+        std::atomic<size_t> waitingConsumerCount(0);
+        std::mutex waitMutex;
+        std::condition_variable itemPushed;
+
+        std::vector<std::vector<double>> latencies_us(consumerCount);
+
+        const auto consumerWork = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::micro>(consumerWork_us));
+
+        const auto consume = [&](size_t consumerIndex) {
+            QueueItem item;
+            while (running) {
+                if (queue.TryPop(item)) {
+                    --itemCount;
+                    const auto popped = std::chrono::steady_clock::now();
+                    latencies_us[consumerIndex].push_back(std::chrono::duration<double, std::micro>(popped - item.pushed).count());
+                    item = QueueItem();
+                    WaitUntil(popped + consumerWork);
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(waitMutex);
+                ++waitingConsumerCount;
+                itemPushed.wait_for(lock, std::chrono::milliseconds(10), [&]() { return !running || itemCount > 0; });
+                --waitingConsumerCount;
+            }
+        };
+
+        std::vector<std::thread> consumers;
+        for (size_t i = 0; i < consumerCount; ++i) {
+            consumers.emplace_back(consume, i);
+        }
+
+        QueueResult result;
+
+        const auto owner = std::make_shared<int>(0);
+        const auto started = std::chrono::steady_clock::now();
+        const auto deadline = started + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(duration_s));
+        const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(producerRate > 0.0 ? 1.0 / producerRate : 0.0));
+        auto nextPush = started;
+
+        for (uint64_t counter = 0; ; ++counter) {
+            WaitUntil(nextPush);
+            nextPush += period;
+
+            const auto pushStarted = std::chrono::steady_clock::now();
+            if (pushStarted >= deadline) {
+                break;
+            }
+
+            QueueItem item;
+            item.rawDataOwner = owner;
+            item.reorderTicket = owner;
+            item.metrics = owner;
+            item.counter = counter;
+            item.pushed = pushStarted;
+
+            ++itemCount;
+            if (queue.TryPush(std::move(item))) {
+                ++result.itemCount;
+            }
+            else {
+                --itemCount;
+                ++result.fullCount;
+            }
+            if (waitingConsumerCount > 0) {
+                std::lock_guard<std::mutex> lock(waitMutex);
+                itemPushed.notify_one();
+            }
+
+            result.pushTimes_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - pushStarted).count());
+        }
+
+        result.elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+        running = false;
+        {
+            std::lock_guard<std::mutex> lock(waitMutex);
+            itemPushed.notify_all();
+        }
+        for (auto& consumer : consumers) {
+            consumer.join();
+        }
+
+        for (const auto& consumerLatencies_us : latencies_us) {
+            result.latencies_us.insert(result.latencies_us.end(), consumerLatencies_us.begin(), consumerLatencies_us.end());
+        }
+
+        return result;
+    }
+
+    void RunQueueBenchmarks(const std::vector<std::string>& consumerCounts, const std::vector<std::string>& consumerWorkTimes_us, double producerRate, size_t capacity, double duration_s, nlohmann::json& json)
+    {
+        std::cout << "Producer rate: " << (producerRate > 0.0 ? std::to_string(static_cast<int>(producerRate)) + " items/s" : "as fast as possible") << ", capacity: " << capacity << std::endl << std::endl;
+
+        std::cout << std::left
+            << std::setw(8) << "queue" << std::right << std::setw(5) << "thr" << std::setw(9) << "work us"
+            << std::setw(12) << "items/s" << std::setw(9) << "full"
+            << std::setw(11) << "push p50" << std::setw(11) << "push p99" << std::setw(11) << "push p99.9" << std::setw(11) << "push max"
+            << std::setw(11) << "lat p50" << std::setw(11) << "lat p99" << std::endl;
+
+        json["queue"] = nlohmann::json::array();
+
+        for (const auto& consumerCountValue : consumerCounts) {
+            const size_t consumerCount = std::max(1, std::stoi(consumerCountValue));
+            for (const auto& consumerWorkValue : consumerWorkTimes_us) {
+                const double consumerWork_us = std::stod(consumerWorkValue);
+                for (const std::string queueName : { "mutex", "ring" }) {
+                    QueueResult result = queueName == "ring"
+                        ? RunQueueBenchmark<MpmcRing<QueueItem>>(capacity, consumerCount, producerRate, consumerWork_us, duration_s)
+                        : RunQueueBenchmark<LockedQueue>(capacity, consumerCount, producerRate, consumerWork_us, duration_s);
+
+                    const double itemsPerSecond = result.itemCount / result.elapsed_s;
+
+                    std::cout << std::left << std::setw(8) << queueName << std::right << std::fixed << std::setprecision(0)
+                        << std::setw(5) << consumerCount << std::setw(9) << consumerWork_us
+                        << std::setw(12) << itemsPerSecond << std::setw(9) << result.fullCount
+                        << std::setprecision(2)
+                        << std::setw(11) << GetPercentile(result.pushTimes_us, 0.50)
+                        << std::setw(11) << GetPercentile(result.pushTimes_us, 0.99)
+                        << std::setw(11) << GetPercentile(result.pushTimes_us, 0.999)
+                        << std::setw(11) << GetPercentile(result.pushTimes_us, 1.0)
+                        << std::setw(11) << GetPercentile(result.latencies_us, 0.50)
+                        << std::setw(11) << GetPercentile(result.latencies_us, 0.99)
+                        << std::endl;
+
+                    nlohmann::json resultJson;
+                    resultJson["queue"] = queueName;
+                    resultJson["consumers"] = consumerCount;
+                    resultJson["consumerWork_us"] = consumerWork_us;
+                    resultJson["producerRate"] = producerRate;
+                    resultJson["capacity"] = capacity;
+                    resultJson["itemsPerSecond"] = itemsPerSecond;
+                    resultJson["fullCount"] = result.fullCount;
+                    resultJson["push"] = GetPercentiles(result.pushTimes_us);
+                    resultJson["push"]["p999_us"] = GetPercentile(result.pushTimes_us, 0.999);
+                    resultJson["push"]["max_us"] = GetPercentile(result.pushTimes_us, 1.0);
+                    resultJson["latency"] = GetPercentiles(result.latencies_us);
+                    json["queue"].push_back(resultJson);
+                }
+            }
+        }
+    }
+
+    // The configuration apart from the thread count, for finding the saturation point
+    std::string GetGroupName(const Configuration& configuration)
+    {
+        std::ostringstream oss;
+        oss << configuration.width << "x" << configuration.height << " " << GetPixelFormatName(configuration.pixelFormat) << " " << configuration.imageFormat;
+        if (IsJpegFormat(configuration.imageFormat)) {
+            oss << " " << configuration.encoder << " q" << configuration.jpegQuality;
+        }
+        return oss.str();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        numcfc::IniFile iniFile("EncodingBenchmark.ini");
+
+        const std::string mode = iniFile.GetSetValue("Benchmark", "Mode", "encoding", "\"encoding\", or \"queue\" for the queue between the camera and the encoding threads (see [QueueBenchmark])");
+
+        const auto resolutions = SplitList(iniFile.GetSetValue("Benchmark", "Resolutions", "1920x1200, 4096x3000", "Comma-separated, e.g. \"2048x1536, 4096x3000\""));
+        const auto pixelFormatNames = SplitList(iniFile.GetSetValue("Benchmark", "PixelFormats", "Mono8, Mono12p, BayerRG8", "Comma-separated Vimba pixel formats"));
+        const auto imageFormats = SplitList(iniFile.GetSetValue("Benchmark", "ImageFormats", "jpg, raw, qoi"));
+        const auto encoders = SplitList(iniFile.GetSetValue("Benchmark", "Encoders", "opencv, turbojpeg", "For JPEG only; those not compiled in are skipped"));
+        const auto jpegQualities = SplitList(iniFile.GetSetValue("Benchmark", "JpegQualities", "75, 90"));
+        const auto threadCounts = SplitList(iniFile.GetSetValue("Benchmark", "ThreadCounts", "1, 2, 4, 8"));
+        const double duration_s = iniFile.GetSetValue("Benchmark", "Duration_s", 3.0, "Per configuration");
+        const std::string debayering = iniFile.GetSetValue("Benchmark", "Debayering", "full", "\"full\" or \"superpixel\"");
+        const std::string pattern = iniFile.GetSetValue("Benchmark", "Pattern", "gradient", "Try \"gradient\", \"checkerboard\", or \"noise\"");
+        const double noiseLevel = iniFile.GetSetValue("Benchmark", "NoiseLevel", 2.0, "Makes the test patterns compress more like real images");
+        const std::string replayDirectory = iniFile.GetSetValue("Benchmark", "ReplayDirectory", "", "Use the images in this directory (resized to each resolution) instead of test patterns");
+        const size_t distinctFrameCount = static_cast<size_t>(iniFile.GetSetValue("Benchmark", "DistinctFrames", 4));
+        const std::string jsonFilename = iniFile.GetSetValue("Benchmark", "JsonOutput", "EncodingBenchmark.json");
+
+        const auto queueConsumerCounts = SplitList(iniFile.GetSetValue("QueueBenchmark", "ConsumerThreads", "1, 4, 8"));
+        const auto queueConsumerWorkTimes_us = SplitList(iniFile.GetSetValue("QueueBenchmark", "ConsumerWork_us", "0, 100", "How long each consumer is busy after popping an item (0 = maximum contention)"));
+        const double queueProducerRate = iniFile.GetSetValue("QueueBenchmark", "ProducerRate", 2000.0, "Items per second (0 = as fast as possible)");
+        const size_t queueCapacity = static_cast<size_t>(iniFile.GetSetValue("QueueBenchmark", "Capacity", 100));
+
+        if (iniFile.IsDirty()) {
+            iniFile.Save();
+        }
+
+        if (tuc::string::equal_case_insensitive(mode, "queue")) {
+            nlohmann::json json;
+            json["hardwareConcurrency"] = std::thread::hardware_concurrency();
+            json["duration_s"] = duration_s;
+            RunQueueBenchmarks(queueConsumerCounts, queueConsumerWorkTimes_us, queueProducerRate, queueCapacity, duration_s, json);
+
+            std::ofstream out(jsonFilename);
+            out << json.dump(2) << std::endl;
+            std::cout << std::endl << "Results written to " << jsonFilename << std::endl;
+            return 0;
+        }
+
+        const DebayerMode debayerMode = tuc::string::equal_case_insensitive(debayering, "superpixel") ? DebayerMode::Superpixel : DebayerMode::Full;
+
+        std::vector<cv::Mat> replayImages;
+        if (!replayDirectory.empty()) {
+            replayImages = ReadImageFiles(replayDirectory);
+            if (replayImages.empty()) {
+                throw std::runtime_error("No images found in " + replayDirectory);
+            }
+        }
+
+        std::cout << "Pixel format conversions using " << GetPixelFormatConversionInstructionSet()
+            << ", " << std::thread::hardware_concurrency() << " hardware threads" << std::endl << std::endl;
+
+        std::cout << std::left
+            << std::setw(10) << "size" << std::setw(16) << "pixel format" << std::setw(5) << "fmt" << std::setw(10) << "encoder" << std::setw(4) << "q"
+            << std::right
+            << std::setw(4) << "thr" << std::setw(9) << "fps" << std::setw(11) << "kB/frame" << std::setw(11) << "CPU ms/fr"
+            << std::setw(11) << "conv p50" << std::setw(11) << "conv p95" << std::setw(11) << "enc p50" << std::setw(11) << "enc p95"
+            << std::setw(11) << "msg p95" << std::setw(11) << "total p95" << std::endl;
+
+        nlohmann::json json;
+        json["instructionSet"] = GetPixelFormatConversionInstructionSet();
+        json["hardwareConcurrency"] = std::thread::hardware_concurrency();
+        json["duration_s"] = duration_s;
+        json["results"] = nlohmann::json::array();
+
+        std::map<std::string, std::vector<std::pair<size_t, double>>> fpsByGroup; // thread count, fps
+        std::vector<std::string> groupNames;
+
+        for (const auto& resolution : resolutions) {
+            Configuration configuration;
+            if (sscanf(resolution.c_str(), "%dx%d", &configuration.width, &configuration.height) != 2 || configuration.width <= 0 || configuration.height <= 0) {
+                throw std::runtime_error("Unexpected resolution: " + resolution);
+            }
+
+            for (const auto& pixelFormatName : pixelFormatNames) {
+                if (!ParsePixelFormat(pixelFormatName, configuration.pixelFormat)) {
+                    throw std::runtime_error("Unsupported pixel format: " + pixelFormatName);
+                }
+
+                const bool color = GetConvertedImageType(configuration.pixelFormat) == CV_8UC3;
+
+                std::vector<cv::Mat> rawFrames;
+                for (size_t i = 0; i < std::max(static_cast<size_t>(1), distinctFrameCount); ++i) {
+                    cv::Mat image;
+                    if (!replayImages.empty()) {
+                        cv::resize(replayImages[i % replayImages.size()], image, cv::Size(configuration.width, configuration.height), 0, 0, cv::INTER_AREA);
+                    }
+                    else {
+                        CreateTestPattern(pattern, configuration.width, configuration.height, color, i, noiseLevel, image);
+                    }
+                    cv::Mat rawData;
+                    CreateRawData(image, configuration.pixelFormat, rawData);
+                    rawFrames.push_back(rawData);
+                }
+
+                for (const auto& imageFormat : imageFormats) {
+                    configuration.imageFormat = imageFormat;
+
+                    const bool isJpeg = IsJpegFormat(imageFormat);
+                    const std::vector<std::string> encodersToRun = isJpeg ? encoders : std::vector<std::string>{ "opencv" };
+                    const std::vector<std::string> jpegQualitiesToRun = isJpeg ? jpegQualities : std::vector<std::string>{ "0" };
+
+                    for (const auto& encoder : encodersToRun) {
+                        if (tuc::string::equal_case_insensitive(encoder, "turbojpeg") && !IsTurboJpegAvailable()) {
+                            continue;
+                        }
+                        configuration.encoder = encoder;
+
+                        for (const auto& jpegQuality : jpegQualitiesToRun) {
+                            configuration.jpegQuality = std::stoi(jpegQuality);
+
+                            for (const auto& threadCount : threadCounts) {
+                                configuration.threadCount = std::max(1, std::stoi(threadCount));
+
+                                Result result = RunBenchmark(configuration, rawFrames, debayerMode, duration_s);
+
+                                const double fps = result.frameCount / result.elapsed_s;
+                                const double bytesPerFrame = result.frameCount ? result.totalBytes / result.frameCount : 0.0;
+                                const double cpuTimePerFrame_ms = result.frameCount ? 1000.0 * result.cpuTime_s / result.frameCount : 0.0;
+
+                                // Whatever an encoder reports as its name is what was actually used, e.g. "raw" or "qoi"
+                                ImageEncoderSettings settings;
+                                settings.imageFormat = imageFormat;
+                                const std::string encoderName = CreateImageEncoder(configuration.encoder, settings)->GetName();
+
+                                std::cout << std::left
+                                    << std::setw(10) << resolution << std::setw(16) << GetPixelFormatName(configuration.pixelFormat)
+                                    << std::setw(5) << imageFormat << std::setw(10) << encoderName << std::setw(4) << (isJpeg ? jpegQuality : "-")
+                                    << std::right << std::fixed
+                                    << std::setw(4) << configuration.threadCount
+                                    << std::setprecision(1) << std::setw(9) << fps
+                                    << std::setw(11) << bytesPerFrame / 1024
+                                    << std::setprecision(2) << std::setw(11) << cpuTimePerFrame_ms
+                                    << std::setprecision(0)
+                                    << std::setw(11) << GetPercentile(result.stageTimes_us[Convert], 0.50)
+                                    << std::setw(11) << GetPercentile(result.stageTimes_us[Convert], 0.95)
+                                    << std::setw(11) << GetPercentile(result.stageTimes_us[Encode], 0.50)
+                                    << std::setw(11) << GetPercentile(result.stageTimes_us[Encode], 0.95)
+                                    << std::setw(11) << GetPercentile(result.stageTimes_us[Message], 0.95)
+                                    << std::setw(11) << GetPercentile(result.totalTimes_us, 0.95)
+                                    << std::endl;
+
+                                nlohmann::json resultJson;
+                                resultJson["width"] = configuration.width;
+                                resultJson["height"] = configuration.height;
+                                resultJson["pixelFormat"] = GetPixelFormatName(configuration.pixelFormat);
+                                resultJson["imageFormat"] = imageFormat;
+                                resultJson["encoder"] = encoderName;
+                                if (isJpeg) {
+                                    resultJson["jpegQuality"] = configuration.jpegQuality;
+                                }
+                                resultJson["threads"] = configuration.threadCount;
+                                resultJson["frames"] = result.frameCount;
+                                resultJson["elapsed_s"] = result.elapsed_s;
+                                resultJson["fps"] = fps;
+                                resultJson["bytesPerFrame"] = bytesPerFrame;
+                                resultJson["cpuTimePerFrame_ms"] = cpuTimePerFrame_ms;
+                                for (int stage = 0; stage < StageCount; ++stage) {
+                                    resultJson["stages"][stageNames[stage]] = GetPercentiles(result.stageTimes_us[stage]);
+                                }
+                                resultJson["stages"]["total"] = GetPercentiles(result.totalTimes_us);
+                                json["results"].push_back(resultJson);
+
+                                const std::string groupName = GetGroupName(configuration);
+                                if (!fpsByGroup.count(groupName)) {
+                                    groupNames.push_back(groupName);
+                                }
+                                fpsByGroup[groupName].push_back(std::make_pair(configuration.threadCount, fps));
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        // The saturation point: the fewest threads that get within 10% of the best throughput
+        std::cout << std::endl << "Saturation:" << std::endl;
+        json["saturation"] = nlohmann::json::array();
+        for (const auto& groupName : groupNames) {
+            const auto& fps = fpsByGroup[groupName];
+            const double bestFps = std::max_element(fps.begin(), fps.end(), [](const std::pair<size_t, double>& a, const std::pair<size_t, double>& b) { return a.second < b.second; })->second;
+            size_t saturationThreadCount = std::numeric_limits<size_t>::max();
+            for (const auto& i : fps) {
+                if (i.second >= 0.9 * bestFps) {
+                    saturationThreadCount = std::min(saturationThreadCount, i.first);
+                }
+            }
+            std::cout << "  " << groupName << ": " << std::fixed << std::setprecision(1) << bestFps << " fps, reached with " << saturationThreadCount << " thread" << (saturationThreadCount == 1 ? "" : "s") << std::endl;
+
+            nlohmann::json saturationJson;
+            saturationJson["configuration"] = groupName;
+            saturationJson["maxFps"] = bestFps;
+            saturationJson["threads"] = saturationThreadCount;
+            json["saturation"].push_back(saturationJson);
+        }
+
+        std::ofstream out(jsonFilename);
+        out << json.dump(2) << std::endl;
+        std::cout << std::endl << "Results written to " << jsonFilename << std::endl;
+    }
+    catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
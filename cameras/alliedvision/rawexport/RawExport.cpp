@@ -0,0 +1,241 @@
+// Converts the frames of a frozen raw recording (see RawRecorder.h) into images: either sends them
+// to ImageStorage as Image messages (and asks it to keep them permanently), or writes them into a
+// directory. The frames are converted and encoded like AlliedVision would, but here it does not
+// matter how long it takes, so the default is a lossless format.
+//
+// Usage: RawExport [ring file]   (the ring file can be given in RawExport.ini instead)
+
+#include "../RawRecorder.h"
+#include "../PixelFormatConversion.h"
+#include "../ImageEncoder.h"
+
+#include <messaging/claim/PostOffice.h>
+#include <messaging/claim/AttributeMessage.h>
+
+#include <numcfc/IniFile.h>
+
+#include "../../../lib/system_clock_time_point_string_conversion/system_clock_time_point_string_conversion.h"
+
+#include "../../../lib/tuc/include/tuc/string.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    struct Frame {
+        RawRecordingIndexEntry entry;
+        std::chrono::system_clock::time_point timestamp;
+    };
+
+    std::chrono::system_clock::time_point FromMicroseconds(int64_t time_us)
+    {
+        return std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::microseconds(time_us)));
+    }
+
+    // The frames in the order they were recorded, leaving out any entries that do not point inside
+    // their slot; throws std::runtime_error if the file is not a raw recording
+    std::vector<Frame> ReadIndex(std::ifstream& in, const std::string& filename, RawRecordingHeader& header)
+    {
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))
+            || std::memcmp(header.magic, rawRecordingMagic, sizeof(header.magic)) != 0) {
+            throw std::runtime_error(filename + " is not a raw recording");
+        }
+        if (header.headerSize != sizeof(RawRecordingHeader) || header.indexEntrySize != sizeof(RawRecordingIndexEntry)) {
+            throw std::runtime_error(filename + " is of a different version");
+        }
+        header.cameraId[sizeof(header.cameraId) - 1] = '\0';
+
+        std::vector<RawRecordingIndexEntry> index(static_cast<size_t>(header.slotCount));
+        in.seekg(static_cast<std::streamoff>(header.indexOffset));
+        if (!in.read(reinterpret_cast<char*>(index.data()), index.size() * sizeof(RawRecordingIndexEntry))) {
+            throw std::runtime_error("Unable to read the index of " + filename);
+        }
+
+        std::vector<Frame> frames;
+        for (uint64_t slot = 0; slot < index.size(); ++slot) {
+            const RawRecordingIndexEntry& entry = index[slot];
+            if (entry.sequence == 0) {
+                continue;
+            }
+            if (entry.offset != header.dataOffset + slot * header.slotSize || entry.size > header.slotSize) {
+                std::cerr << "Frame " << entry.counter << ": offset " << entry.offset << " and size " << entry.size << " not inside slot " << slot << std::endl;
+                continue;
+            }
+
+            Frame frame;
+            frame.entry = entry;
+            frame.timestamp = FromMicroseconds(entry.timestamp_us);
+            frames.push_back(frame);
+        }
+
+        std::sort(frames.begin(), frames.end(), [](const Frame& a, const Frame& b) {
+            return a.entry.sequence < b.entry.sequence;
+        });
+
+        return frames;
+    }
+
+    // Like the ids of AlliedVision, but with a suffix of its own, so as not to clash with the images sent live
+    std::string GetId(const std::string& timestamp, uint64_t counter, const std::string& imageFormat)
+    {
+        std::string id = timestamp;
+        std::replace(id.begin(), id.end(), ':', '.');
+        std::ostringstream oss;
+        oss << std::hex << std::setw(16) << std::setfill('0') << counter;
+        return id + "_" + oss.str() + "_rec." + imageFormat;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        numcfc::IniFile iniFile("RawExport.ini");
+
+        std::string filename = iniFile.GetSetValue("RawExport", "RingFile", "", "The frozen raw recording to convert (can also be given on the command line)");
+        const double lastSeconds = iniFile.GetSetValue("RawExport", "LastSeconds", 0.0, "Convert only the frames recorded this long before the last one (0 = all)");
+        const std::string output = iniFile.GetSetValue("RawExport", "Output", "messages", "\"messages\" to send the images to ImageStorage, or a directory to write them into");
+        const bool makePermanent = iniFile.GetSetValue("RawExport", "MakePermanent", 1.0, "Ask ImageStorage to keep the images, instead of letting them rotate out") > 0.0;
+        const double messageInterval_ms = iniFile.GetSetValue("RawExport", "MessageInterval_ms", 10.0, "Pause between the images sent, so as not to flood ImageStorage");
+
+        ImageEncoderSettings imageEncoderSettings;
+        imageEncoderSettings.imageFormat = iniFile.GetSetValue("RawExport", "ImageFormat", "png", "E.g. \"png\" or \"qoi\" (lossless), or \"jpg\"");
+        imageEncoderSettings.jpegQuality = static_cast<int>(iniFile.GetSetValue("RawExport", "JpegCompressionQuality", imageEncoderSettings.jpegQuality));
+        const std::string debayering = iniFile.GetSetValue("RawExport", "Debayering", "full", "\"full\" or \"superpixel\"");
+
+        const bool sendMessages = tuc::string::equal_case_insensitive(output, "messages");
+
+        claim::PostOffice postOffice;
+        if (sendMessages) {
+            postOffice.Initialize(iniFile, "RawEx");
+        }
+
+        if (iniFile.IsDirty()) {
+            iniFile.Save();
+        }
+
+        if (argc > 1) {
+            filename = argv[1];
+        }
+        if (filename.empty()) {
+            throw std::runtime_error("No ring file given: set RingFile in RawExport.ini, or give it on the command line");
+        }
+
+        const DebayerMode debayerMode = tuc::string::equal_case_insensitive(debayering, "superpixel") ? DebayerMode::Superpixel : DebayerMode::Full;
+        const auto imageEncoder = CreateImageEncoder("opencv", imageEncoderSettings);
+
+        std::ifstream in(filename, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("Unable to read " + filename);
+        }
+
+        RawRecordingHeader header;
+        std::vector<Frame> frames = ReadIndex(in, filename, header);
+
+        if (!header.frozen) {
+            std::cout << "Warning: " << filename << " is not frozen - frames may have been overwritten while reading" << std::endl;
+        }
+
+        if (lastSeconds > 0.0 && !frames.empty()) {
+            const auto from = frames.back().timestamp - std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::duration<double>(lastSeconds));
+            frames.erase(frames.begin(), std::find_if(frames.begin(), frames.end(), [&](const Frame& frame) { return frame.timestamp >= from; }));
+        }
+
+        std::cout << "Camera " << header.cameraId << ": " << frames.size() << " frame" << (frames.size() == 1 ? "" : "s") << " to convert" << std::endl;
+
+        std::vector<uint8_t> rawBuffer;
+        cv::Mat image;
+        size_t convertedCount = 0;
+
+        for (const Frame& frame : frames) {
+            const RawRecordingIndexEntry& entry = frame.entry;
+            const VmbPixelFormatType pixelFormat = static_cast<VmbPixelFormatType>(entry.pixelFormat);
+
+            rawBuffer.resize(entry.size);
+            in.seekg(static_cast<std::streamoff>(entry.offset));
+            if (!in.read(reinterpret_cast<char*>(rawBuffer.data()), rawBuffer.size())) {
+                std::cerr << "Unable to read frame " << entry.counter << std::endl;
+                in.clear();
+                continue;
+            }
+
+            if (!IsSupportedPixelFormat(pixelFormat)) {
+                std::cerr << "Frame " << entry.counter << ": unsupported pixel format " << GetPixelFormatName(pixelFormat) << std::endl;
+                continue;
+            }
+
+            // The frame may have some padding after the pixels, but it must not be short of any
+            const size_t expectedSize = GetRawDataSize(entry.width, entry.height, pixelFormat);
+            if (expectedSize == 0 || entry.size < expectedSize) {
+                std::cerr << "Frame " << entry.counter << ": " << entry.size << " bytes, but " << entry.width << " x " << entry.height
+                    << " pixels of " << GetPixelFormatName(pixelFormat) << " take " << expectedSize << std::endl;
+                continue;
+            }
+
+            cv::Mat rawData = WrapPixelBuffer(rawBuffer.data(), entry.width, entry.height, pixelFormat);
+
+            if (IsPassThroughPixelFormat(pixelFormat)) {
+                image = rawData;
+            }
+            else {
+                ConvertPixelFormat(rawData, pixelFormat, image, debayerMode);
+            }
+
+            std::string encodedImage;
+            imageEncoder->Encode(image, encodedImage);
+
+            const std::string timestamp = system_clock_time_point_string_conversion::to_string(frame.timestamp);
+            const std::string id = GetId(timestamp, entry.counter, imageEncoderSettings.imageFormat);
+
+            if (sendMessages) {
+                claim::AttributeMessage amsg;
+                amsg.m_type = "Image";
+                amsg.m_attributes["id"] = id;
+                amsg.m_attributes["timestamp"] = timestamp;
+                amsg.m_attributes["counter"] = std::to_string(entry.counter);
+                amsg.m_attributes["rows"] = std::to_string(image.rows);
+                amsg.m_attributes["cols"] = std::to_string(image.cols);
+                amsg.m_attributes["format"] = imageEncoderSettings.imageFormat;
+                amsg.m_attributes["camera"] = header.cameraId;
+                amsg.m_attributes["data"] = std::move(encodedImage);
+                postOffice.Send(amsg);
+
+                if (makePermanent) {
+                    claim::AttributeMessage makePermanentMessage;
+                    makePermanentMessage.m_type = "MakePermanent";
+                    makePermanentMessage.m_attributes["id"] = id;
+                    postOffice.Send(makePermanentMessage);
+                }
+
+                std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(messageInterval_ms));
+            }
+            else {
+                const std::string path = output + "/" + id;
+                std::ofstream out(path, std::ios::binary);
+                if (!out.write(encodedImage.data(), encodedImage.size())) {
+                    throw std::runtime_error("Unable to write " + path);
+                }
+            }
+
+            ++convertedCount;
+        }
+
+        std::cout << convertedCount << " image" << (convertedCount == 1 ? "" : "s") << (sendMessages ? " sent" : " written to " + output) << std::endl;
+    }
+    catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,417 @@
+// Checks the pixel format conversions against plain per-pixel reference conversions: for each
+// supported pixel format, each debayering mode, and each instruction set available on this
+// machine (scalar, SSE4.1, AVX2), on odd widths, widths that leave a tail after the vector loops,
+// and strides padded on both sides. The raw data is made with CreateRawData, and then once more
+// with random bits, including those above the significant ones. Prints a table, and returns
+// nonzero if anything differs.
+//
+// How fast the conversions are, per pixel format, is measured by the Convert stage of
+// EncodingBenchmark.
+
+#include "../PixelFormatConversion.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+    enum class Packing { None, Gev, Pfnc };
+
+    // Spelled out here again, rather than asked from PixelFormatConversion, so that the reference
+    // does not share any mistakes with the code under test
+    struct ReferenceInfo {
+        bool supported = false;
+        int significantBits = 8;
+        Packing packing = Packing::None;
+        bool bayer = false;
+        int bayerCode = 0;              // cv::COLOR_Bayer*2BGR, named after the second row
+        int channels[4] = { 0, 0, 0, 0 }; // BGR channel of each pixel of a 2x2 cell: top left, top right, bottom left, bottom right
+    };
+
+    ReferenceInfo GetReferenceInfo(VmbPixelFormatType pixelFormat)
+    {
+        ReferenceInfo info;
+        info.supported = true;
+
+        const auto setBayer = [&](const std::string& pattern) {
+            info.bayer = true;
+            if (pattern == "RG") {
+                info.bayerCode = cv::COLOR_BayerBG2BGR;
+                info.channels[0] = 2; info.channels[1] = 1; info.channels[2] = 1; info.channels[3] = 0;
+            }
+            else if (pattern == "GR") {
+                info.bayerCode = cv::COLOR_BayerGB2BGR;
+                info.channels[0] = 1; info.channels[1] = 2; info.channels[2] = 0; info.channels[3] = 1;
+            }
+            else if (pattern == "BG") {
+                info.bayerCode = cv::COLOR_BayerRG2BGR;
+                info.channels[0] = 0; info.channels[1] = 1; info.channels[2] = 1; info.channels[3] = 2;
+            }
+            else {
+                info.bayerCode = cv::COLOR_BayerGR2BGR;
+                info.channels[0] = 1; info.channels[1] = 0; info.channels[2] = 2; info.channels[3] = 1;
+            }
+        };
+
+        switch (pixelFormat) {
+        case VmbPixelFormatMono8:           break;
+        case VmbPixelFormatMono10:          info.significantBits = 10; break;
+        case VmbPixelFormatMono12:          info.significantBits = 12; break;
+        case VmbPixelFormatMono14:          info.significantBits = 14; break;
+        case VmbPixelFormatMono16:          info.significantBits = 16; break;
+        case VmbPixelFormatMono12Packed:    info.significantBits = 12; info.packing = Packing::Gev; break;
+        case VmbPixelFormatMono12p:         info.significantBits = 12; info.packing = Packing::Pfnc; break;
+
+        case VmbPixelFormatBayerRG8:        setBayer("RG"); break;
+        case VmbPixelFormatBayerGR8:        setBayer("GR"); break;
+        case VmbPixelFormatBayerBG8:        setBayer("BG"); break;
+        case VmbPixelFormatBayerGB8:        setBayer("GB"); break;
+
+        case VmbPixelFormatBayerRG10:       setBayer("RG"); info.significantBits = 10; break;
+        case VmbPixelFormatBayerGR10:       setBayer("GR"); info.significantBits = 10; break;
+        case VmbPixelFormatBayerBG10:       setBayer("BG"); info.significantBits = 10; break;
+        case VmbPixelFormatBayerGB10:       setBayer("GB"); info.significantBits = 10; break;
+
+        case VmbPixelFormatBayerRG12:       setBayer("RG"); info.significantBits = 12; break;
+        case VmbPixelFormatBayerGR12:       setBayer("GR"); info.significantBits = 12; break;
+        case VmbPixelFormatBayerBG12:       setBayer("BG"); info.significantBits = 12; break;
+        case VmbPixelFormatBayerGB12:       setBayer("GB"); info.significantBits = 12; break;
+
+        case VmbPixelFormatBayerRG16:       setBayer("RG"); info.significantBits = 16; break;
+        case VmbPixelFormatBayerGR16:       setBayer("GR"); info.significantBits = 16; break;
+        case VmbPixelFormatBayerBG16:       setBayer("BG"); info.significantBits = 16; break;
+        case VmbPixelFormatBayerGB16:       setBayer("GB"); info.significantBits = 16; break;
+
+        case VmbPixelFormatBayerRG12Packed: setBayer("RG"); info.significantBits = 12; info.packing = Packing::Gev; break;
+        case VmbPixelFormatBayerGR12Packed: setBayer("GR"); info.significantBits = 12; info.packing = Packing::Gev; break;
+        case VmbPixelFormatBayerBG12Packed: setBayer("BG"); info.significantBits = 12; info.packing = Packing::Gev; break;
+        case VmbPixelFormatBayerGB12Packed: setBayer("GB"); info.significantBits = 12; info.packing = Packing::Gev; break;
+
+        case VmbPixelFormatBayerRG12p:      setBayer("RG"); info.significantBits = 12; info.packing = Packing::Pfnc; break;
+        case VmbPixelFormatBayerGR12p:      setBayer("GR"); info.significantBits = 12; info.packing = Packing::Pfnc; break;
+        case VmbPixelFormatBayerBG12p:      setBayer("BG"); info.significantBits = 12; info.packing = Packing::Pfnc; break;
+        case VmbPixelFormatBayerGB12p:      setBayer("GB"); info.significantBits = 12; info.packing = Packing::Pfnc; break;
+
+        case VmbPixelFormatRgb8:
+        case VmbPixelFormatBgr8:
+        case VmbPixelFormatYuv422:          break;
+
+        default:                            info.supported = false; break;
+        }
+        return info;
+    }
+
+    // The full-precision value of each pixel of single-channel raw data, one pixel at a time
+    cv::Mat Unpack(const cv::Mat& rawData, const ReferenceInfo& info, cv::Size size)
+    {
+        cv::Mat values(size, CV_32SC1);
+        for (int y = 0; y < size.height; ++y) {
+            int* output = values.ptr<int>(y);
+            for (int x = 0; x < size.width; ++x) {
+                if (info.packing == Packing::None) {
+                    output[x] = rawData.depth() == CV_16U ? rawData.at<uint16_t>(y, x) : rawData.at<uint8_t>(y, x);
+                    continue;
+                }
+                const uint8_t* pair = rawData.ptr<uint8_t>(y) + x / 2 * 3;
+                const bool first = x % 2 == 0;
+                if (info.packing == Packing::Gev) {
+                    output[x] = first ? (pair[0] << 4) | (pair[1] & 0x0f) : (pair[2] << 4) | (pair[1] >> 4);
+                }
+                else {
+                    output[x] = first ? pair[0] | ((pair[1] & 0x0f) << 8) : (pair[1] >> 4) | (pair[2] << 4);
+                }
+            }
+        }
+        return values;
+    }
+
+    // The 8 most significant of the significant bits, saturated if bits above them are set
+    uint8_t To8(int value, int significantBits)
+    {
+        return static_cast<uint8_t>(std::min(value >> (significantBits - 8), 255));
+    }
+
+    cv::Mat ReferenceTo8(const cv::Mat& values, const ReferenceInfo& info)
+    {
+        cv::Mat output(values.size(), CV_8UC1);
+        for (int y = 0; y < values.rows; ++y) {
+            for (int x = 0; x < values.cols; ++x) {
+                output.at<uint8_t>(y, x) = To8(values.at<int>(y, x), info.significantBits);
+            }
+        }
+        return output;
+    }
+
+    cv::Mat ReferenceSuperpixel(const cv::Mat& values, const ReferenceInfo& info)
+    {
+        // The packed formats are documented to be reduced to 8 bits first, and only then debayered
+        cv::Mat input;
+        int significantBits = info.significantBits;
+        if (info.packing != Packing::None) {
+            ReferenceTo8(values, info).convertTo(input, CV_32SC1);
+            significantBits = 8;
+        }
+        else {
+            input = values;
+        }
+
+        cv::Mat output(values.rows / 2, values.cols / 2, CV_8UC3);
+        for (int y = 0; y < output.rows; ++y) {
+            for (int x = 0; x < output.cols; ++x) {
+                int greenSum = 0;
+                for (int i = 0; i < 4; ++i) {
+                    const int value = input.at<int>(2 * y + i / 2, 2 * x + i % 2);
+                    if (info.channels[i] == 1) {
+                        greenSum += value;
+                    }
+                    else {
+                        output.at<cv::Vec3b>(y, x)[info.channels[i]] = To8(value, significantBits);
+                    }
+                }
+                output.at<cv::Vec3b>(y, x)[1] = To8((greenSum + 1) >> 1, significantBits);
+            }
+        }
+        return output;
+    }
+
+    cv::Mat Reference(const cv::Mat& rawData, VmbPixelFormatType pixelFormat, const ReferenceInfo& info, cv::Size size, DebayerMode debayerMode)
+    {
+        if (pixelFormat == VmbPixelFormatRgb8) {
+            cv::Mat output(size, CV_8UC3);
+            for (int y = 0; y < size.height; ++y) {
+                for (int x = 0; x < size.width; ++x) {
+                    const cv::Vec3b& rgb = rawData.at<cv::Vec3b>(y, x);
+                    output.at<cv::Vec3b>(y, x) = cv::Vec3b(rgb[2], rgb[1], rgb[0]);
+                }
+            }
+            return output;
+        }
+        if (pixelFormat == VmbPixelFormatBgr8) {
+            return rawData.clone();
+        }
+        if (pixelFormat == VmbPixelFormatYuv422) {
+            cv::Mat output;
+            cv::cvtColor(rawData, output, cv::COLOR_YUV2BGR_UYVY);
+            return output;
+        }
+
+        const cv::Mat values = Unpack(rawData, info, size);
+        if (info.bayer && debayerMode == DebayerMode::Superpixel) {
+            return ReferenceSuperpixel(values, info);
+        }
+
+        const cv::Mat output = ReferenceTo8(values, info);
+        if (!info.bayer) {
+            return output;
+        }
+
+        cv::Mat image;
+        cv::cvtColor(output, image, info.bayerCode);
+        return image;
+    }
+
+    // Copies the data in the middle of a bigger buffer of random bytes, so that the stride is
+    // longer than a row, and the rows do not start where they would in a buffer of their own
+    cv::Mat WithPaddedStride(const cv::Mat& rawData, cv::RNG& rng, cv::Mat& buffer)
+    {
+        buffer.create(rawData.rows + 2, rawData.cols + 7, rawData.type());
+        rng.fill(buffer, cv::RNG::UNIFORM, 0, rawData.depth() == CV_16U ? 65536 : 256);
+        cv::Mat padded = buffer(cv::Rect(3, 1, rawData.cols, rawData.rows));
+        rawData.copyTo(padded);
+        return padded;
+    }
+
+    const uint8_t guard = 0xa5;
+
+    // Whether anything outside the region of interest has changed
+    bool IsGuardIntact(const cv::Mat& buffer, const cv::Rect& roi)
+    {
+        cv::Mat outside = buffer.clone();
+        outside(roi).setTo(cv::Scalar::all(guard));
+        return cv::countNonZero(outside.reshape(1) != guard) == 0;
+    }
+
+    std::string FirstDifference(const cv::Mat& actual, const cv::Mat& expected)
+    {
+        if (actual.size() != expected.size() || actual.type() != expected.type()) {
+            std::ostringstream oss;
+            oss << "size " << actual.cols << "x" << actual.rows << ", expected " << expected.cols << "x" << expected.rows;
+            return oss.str();
+        }
+        const int channels = actual.channels();
+        for (int y = 0; y < actual.rows; ++y) {
+            const uint8_t* a = actual.ptr<uint8_t>(y);
+            const uint8_t* e = expected.ptr<uint8_t>(y);
+            for (int i = 0; i < actual.cols * channels; ++i) {
+                if (a[i] != e[i]) {
+                    std::ostringstream oss;
+                    oss << "at (" << i / channels << ", " << y << ") channel " << i % channels << ": " << int(a[i]) << ", expected " << int(e[i]);
+                    return oss.str();
+                }
+            }
+        }
+        return std::string();
+    }
+
+    struct Failure {
+        std::string instructionSet;
+        std::string what;
+    };
+
+    // Returns the number of cases run
+    size_t TestPixelFormat(VmbPixelFormatType pixelFormat, const std::vector<std::string>& instructionSets, cv::RNG& rng, std::vector<Failure>& failures)
+    {
+        const ReferenceInfo info = GetReferenceInfo(pixelFormat);
+        if (!info.supported) {
+            failures.push_back({ "", "no reference conversion" });
+            return 0;
+        }
+
+        // Each one takes the vector loops a different number of times, and leaves a different tail
+        const int widths[] = { 1, 2, 3, 6, 7, 8, 15, 16, 17, 18, 31, 32, 33, 34, 63, 64, 65, 66, 127, 130, 257, 1002 };
+        const int heights[] = { 1, 2, 3, 8 };
+
+        // Bayer cells are 2x2, and the chroma of UYVY is shared by pixel pairs
+        const bool evenWidth = info.bayer || pixelFormat == VmbPixelFormatYuv422;
+        const bool evenHeight = info.bayer;
+
+        size_t caseCount = 0;
+
+        for (int width : widths) {
+            for (int height : heights) {
+                if ((evenWidth && width % 2) || (evenHeight && height % 2)) {
+                    continue;
+                }
+
+                cv::Mat image(height, width, CV_8UC3);
+                rng.fill(image, cv::RNG::UNIFORM, 0, 256);
+
+                cv::Mat created;
+                CreateRawData(image, pixelFormat, created);
+
+                for (int randomBits = 0; randomBits < 2; ++randomBits) {
+                    if (randomBits) {
+                        rng.fill(created, cv::RNG::UNIFORM, 0, created.depth() == CV_16U ? 65536 : 256);
+                    }
+
+                    cv::Mat rawBuffer;
+                    const cv::Mat rawData = WithPaddedStride(created, rng, rawBuffer);
+                    const cv::Size size(width, height);
+
+                    for (DebayerMode debayerMode : { DebayerMode::Full, DebayerMode::Superpixel }) {
+                        if (debayerMode == DebayerMode::Superpixel && !info.bayer) {
+                            continue;
+                        }
+
+                        const cv::Mat expected = Reference(rawData, pixelFormat, info, size, debayerMode);
+                        const cv::Size convertedSize = GetConvertedImageSize(rawData, pixelFormat, debayerMode);
+
+                        for (const std::string& instructionSet : instructionSets) {
+                            if (!SetPixelFormatConversionInstructionSet(instructionSet)) {
+                                continue;
+                            }
+
+                            // Written in the middle of a bigger buffer, to catch any writes past the end of a row
+                            cv::Mat outputBuffer(convertedSize.height + 2, convertedSize.width + 5, GetConvertedImageType(pixelFormat), cv::Scalar::all(guard));
+                            const cv::Rect roi(2, 1, convertedSize.width, convertedSize.height);
+                            cv::Mat converted = outputBuffer(roi);
+
+                            ConvertPixelFormat(rawData, pixelFormat, converted, debayerMode);
+                            ++caseCount;
+
+                            std::ostringstream context;
+                            context << width << "x" << height
+                                << (debayerMode == DebayerMode::Superpixel ? ", superpixel" : "")
+                                << (randomBits ? ", random bits" : "");
+
+                            std::string difference = FirstDifference(converted, expected);
+                            if (difference.empty() && !IsPassThroughPixelFormat(pixelFormat)) {
+                                if (converted.datastart != outputBuffer.datastart) {
+                                    difference = "reallocated the output";
+                                }
+                                else if (!IsGuardIntact(outputBuffer, roi)) {
+                                    difference = "wrote outside the output";
+                                }
+                            }
+                            if (!difference.empty()) {
+                                failures.push_back({ instructionSet, context.str() + ": " + difference });
+                            }
+                        }
+                    }
+
+                    // The data as created should convert back to the image (the parts that survive the pixel format)
+                    if (!randomBits && !info.bayer && GetConvertedImageType(pixelFormat) == CV_8UC1) {
+                        cv::Mat gray;
+                        cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+                        const std::string difference = FirstDifference(Reference(rawData, pixelFormat, info, size, DebayerMode::Full), gray);
+                        if (!difference.empty()) {
+                            failures.push_back({ "", std::to_string(width) + "x" + std::to_string(height) + ", CreateRawData: " + difference });
+                        }
+                    }
+                }
+            }
+        }
+
+        SetPixelFormatConversionInstructionSet("");
+        return caseCount;
+    }
+}
+
+int main()
+{
+    try {
+        const std::vector<std::string> instructionSets = { "scalar", "SSE4.1", "AVX2" };
+
+        std::vector<std::string> availableInstructionSets;
+        for (const std::string& instructionSet : instructionSets) {
+            if (SetPixelFormatConversionInstructionSet(instructionSet)) {
+                availableInstructionSets.push_back(instructionSet);
+            }
+            else {
+                std::cout << "Note: " << instructionSet << " not available on this machine, not tested" << std::endl;
+            }
+        }
+        SetPixelFormatConversionInstructionSet("");
+
+        cv::RNG rng(20261016);
+        size_t failureCount = 0;
+
+        std::cout << std::left << std::setw(24) << "Pixel format" << std::setw(10) << "Cases" << "Result" << std::endl;
+
+        for (VmbPixelFormatType pixelFormat : GetSupportedPixelFormats()) {
+            std::vector<Failure> failures;
+            const size_t caseCount = TestPixelFormat(pixelFormat, availableInstructionSets, rng, failures);
+
+            std::cout << std::left << std::setw(24) << GetPixelFormatName(pixelFormat) << std::setw(10) << caseCount
+                << (failures.empty() ? "ok" : std::to_string(failures.size()) + " failed") << std::endl;
+
+            // The first few are enough to go on
+            for (size_t i = 0; i < failures.size() && i < 5; ++i) {
+                std::cout << "    " << (failures[i].instructionSet.empty() ? "" : failures[i].instructionSet + ", ") << failures[i].what << std::endl;
+            }
+
+            failureCount += failures.size();
+        }
+
+        if (failureCount) {
+            std::cout << failureCount << " case" << (failureCount == 1 ? "" : "s") << " failed" << std::endl;
+            return 1;
+        }
+
+        std::cout << "All ok" << std::endl;
+    }
+    catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
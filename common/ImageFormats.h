@@ -0,0 +1,318 @@
+#pragma once
+
+// Uncompressed ("raw") and fast lossless ("qoi") image formats, for when the image producer
+// and the consumers run on the same host, and the CPU time of a JPEG encode and decode is worth
+// more than the bytes saved.
+//
+// raw: a 16-byte header followed by the pixels, row by row, with no padding:
+//   bytes 0-3    magic "OISR"
+//   bytes 4-7    width (little-endian)
+//   bytes 8-11   height (little-endian)
+//   byte 12      channels: 1 (grayscale) or 3 (BGR)
+//   bytes 13-15  zero
+//
+// qoi: the Quite OK Image format (https://qoiformat.org/). Grayscale images are encoded as RGB.
+//
+// Header-only, with no dependencies, so that it can be used by all the components.
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace image_formats {
+
+    // Interleaved 8-bit pixels, grayscale or BGR (the OpenCV order), with no row padding
+    struct Image {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint8_t channels = 0;
+        std::vector<uint8_t> pixels;
+    };
+
+    inline bool IsRawFormat(const std::string& imageFormat)
+    {
+        return imageFormat == "raw";
+    }
+
+    inline bool IsQoiFormat(const std::string& imageFormat)
+    {
+        return imageFormat == "qoi";
+    }
+
+    namespace detail {
+
+        const size_t rawHeaderSize = 16;
+        const size_t qoiHeaderSize = 14;
+        const uint8_t qoiEndMarker[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+        const uint8_t QOI_OP_INDEX = 0x00;
+        const uint8_t QOI_OP_DIFF  = 0x40;
+        const uint8_t QOI_OP_LUMA  = 0x80;
+        const uint8_t QOI_OP_RUN   = 0xc0;
+        const uint8_t QOI_OP_RGB   = 0xfe;
+        const uint8_t QOI_OP_RGBA  = 0xff;
+        const uint8_t QOI_MASK_2   = 0xc0;
+
+        struct Rgba {
+            uint8_t r = 0, g = 0, b = 0, a = 0;
+
+            bool operator==(const Rgba& that) const {
+                return r == that.r && g == that.g && b == that.b && a == that.a;
+            }
+        };
+
+        inline int QoiHash(const Rgba& px)
+        {
+            return (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64;
+        }
+
+        inline void WriteUint32(uint8_t* p, uint32_t value, bool bigEndian)
+        {
+            for (int i = 0; i < 4; ++i) {
+                const int shift = bigEndian ? 24 - 8 * i : 8 * i;
+                p[i] = static_cast<uint8_t>(value >> shift);
+            }
+        }
+
+        inline uint32_t ReadUint32(const uint8_t* p, bool bigEndian)
+        {
+            uint32_t value = 0;
+            for (int i = 0; i < 4; ++i) {
+                const int shift = bigEndian ? 24 - 8 * i : 8 * i;
+                value |= static_cast<uint32_t>(p[i]) << shift;
+            }
+            return value;
+        }
+
+        inline void CheckChannels(int channels)
+        {
+            if (channels != 1 && channels != 3) {
+                throw std::runtime_error("Unsupported channel count: " + std::to_string(channels));
+            }
+        }
+
+        // Protects against malicious or corrupted headers before anything is allocated
+        inline void CheckDimensions(uint32_t width, uint32_t height, size_t maxPixelCount)
+        {
+            if (width == 0 || height == 0 || static_cast<uint64_t>(width) * height > maxPixelCount) {
+                throw std::runtime_error("Unexpected image size: " + std::to_string(width) + " x " + std::to_string(height));
+            }
+        }
+    }
+
+    // data points to the first row; step is the distance between rows in bytes. The output can be
+    // a std::vector<uint8_t>, or a std::string (e.g. the payload of a message, written in place).
+    template <typename Output>
+    inline void EncodeRaw(const uint8_t* data, size_t step, uint32_t width, uint32_t height, int channels, Output& output)
+    {
+        detail::CheckChannels(channels);
+
+        const size_t rowSize = static_cast<size_t>(width) * channels;
+        output.resize(detail::rawHeaderSize + rowSize * height);
+
+        uint8_t* p = reinterpret_cast<uint8_t*>(&output[0]);
+        memcpy(p, "OISR", 4);
+        detail::WriteUint32(p + 4, width, false);
+        detail::WriteUint32(p + 8, height, false);
+        p[12] = static_cast<uint8_t>(channels);
+        p[13] = p[14] = p[15] = 0;
+        p += detail::rawHeaderSize;
+
+        for (uint32_t y = 0; y < height; ++y, p += rowSize) {
+            memcpy(p, data + y * step, rowSize);
+        }
+    }
+
+    // The output is first made big enough for the worst case, i.e., 4 bytes per pixel
+    template <typename Output>
+    inline void EncodeQoi(const uint8_t* data, size_t step, uint32_t width, uint32_t height, int channels, Output& output)
+    {
+        using namespace detail;
+
+        CheckChannels(channels);
+
+        // The worst case is one QOI_OP_RGB (4 bytes) per pixel
+        output.resize(qoiHeaderSize + static_cast<size_t>(width) * height * 4 + sizeof(qoiEndMarker));
+
+        uint8_t* const begin = reinterpret_cast<uint8_t*>(&output[0]);
+        uint8_t* p = begin;
+        memcpy(p, "qoif", 4);
+        WriteUint32(p + 4, width, true);
+        WriteUint32(p + 8, height, true);
+        p[12] = 3;  // always RGB
+        p[13] = 0;  // sRGB with linear alpha
+        p += qoiHeaderSize;
+
+        Rgba index[64];
+        Rgba previous;
+        previous.a = 255;
+        int run = 0;
+
+        for (uint32_t y = 0; y < height; ++y) {
+            const uint8_t* row = data + y * step;
+            for (uint32_t x = 0; x < width; ++x) {
+                Rgba px;
+                if (channels == 1) {
+                    px.r = px.g = px.b = row[x];
+                }
+                else {
+                    px.b = row[3 * x];
+                    px.g = row[3 * x + 1];
+                    px.r = row[3 * x + 2];
+                }
+                px.a = 255;
+
+                if (px == previous) {
+                    ++run;
+                    if (run == 62) {
+                        *p++ = QOI_OP_RUN | (run - 1);
+                        run = 0;
+                    }
+                    continue;
+                }
+
+                if (run > 0) {
+                    *p++ = QOI_OP_RUN | (run - 1);
+                    run = 0;
+                }
+
+                const int hash = QoiHash(px);
+                if (index[hash] == px) {
+                    *p++ = QOI_OP_INDEX | hash;
+                }
+                else {
+                    index[hash] = px;
+
+                    const int8_t vr = static_cast<int8_t>(px.r - previous.r);
+                    const int8_t vg = static_cast<int8_t>(px.g - previous.g);
+                    const int8_t vb = static_cast<int8_t>(px.b - previous.b);
+                    const int vgr = vr - vg;
+                    const int vgb = vb - vg;
+
+                    if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                        *p++ = QOI_OP_DIFF | ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2);
+                    }
+                    else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8) {
+                        *p++ = QOI_OP_LUMA | (vg + 32);
+                        *p++ = static_cast<uint8_t>(((vgr + 8) << 4) | (vgb + 8));
+                    }
+                    else {
+                        *p++ = QOI_OP_RGB;
+                        *p++ = px.r;
+                        *p++ = px.g;
+                        *p++ = px.b;
+                    }
+                }
+
+                previous = px;
+            }
+        }
+
+        if (run > 0) {
+            *p++ = QOI_OP_RUN | (run - 1);
+        }
+
+        memcpy(p, qoiEndMarker, sizeof(qoiEndMarker));
+        p += sizeof(qoiEndMarker);
+
+        output.resize(p - begin);
+    }
+
+    // Returns true if the data is in the raw or the qoi format, and could be decoded; returns
+    // false if it is in some other format. Throws std::runtime_error if the data is corrupted.
+    inline bool Decode(const void* data, size_t size, Image& image, size_t maxPixelCount = 1 << 28)
+    {
+        using namespace detail;
+
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+
+        if (size >= rawHeaderSize && memcmp(p, "OISR", 4) == 0) {
+            image.width = ReadUint32(p + 4, false);
+            image.height = ReadUint32(p + 8, false);
+            image.channels = p[12];
+            CheckChannels(image.channels);
+            CheckDimensions(image.width, image.height, maxPixelCount);
+
+            const size_t pixelDataSize = static_cast<size_t>(image.width) * image.height * image.channels;
+            if (size < rawHeaderSize + pixelDataSize) {
+                throw std::runtime_error("Truncated raw image");
+            }
+            image.pixels.assign(p + rawHeaderSize, p + rawHeaderSize + pixelDataSize);
+            return true;
+        }
+
+        if (size >= qoiHeaderSize + sizeof(qoiEndMarker) && memcmp(p, "qoif", 4) == 0) {
+            image.width = ReadUint32(p + 4, true);
+            image.height = ReadUint32(p + 8, true);
+            image.channels = 3;
+            CheckDimensions(image.width, image.height, maxPixelCount);
+
+            const size_t pixelCount = static_cast<size_t>(image.width) * image.height;
+            image.pixels.resize(pixelCount * 3);
+
+            const uint8_t* const end = p + size - sizeof(qoiEndMarker);
+            p += qoiHeaderSize;
+
+            Rgba index[64];
+            Rgba px;
+            px.a = 255;
+            int run = 0;
+
+            for (size_t i = 0; i < pixelCount; ++i) {
+                if (run > 0) {
+                    --run;
+                }
+                else {
+                    if (p >= end) {
+                        throw std::runtime_error("Truncated qoi image");
+                    }
+                    const uint8_t b1 = *p++;
+                    if (b1 == QOI_OP_RGB || b1 == QOI_OP_RGBA) {
+                        const int byteCount = b1 == QOI_OP_RGB ? 3 : 4;
+                        if (end - p < byteCount) {
+                            throw std::runtime_error("Truncated qoi image");
+                        }
+                        px.r = *p++;
+                        px.g = *p++;
+                        px.b = *p++;
+                        if (byteCount == 4) {
+                            px.a = *p++;
+                        }
+                    }
+                    else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+                        px = index[b1];
+                    }
+                    else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+                        px.r += ((b1 >> 4) & 0x03) - 2;
+                        px.g += ((b1 >> 2) & 0x03) - 2;
+                        px.b += (b1 & 0x03) - 2;
+                    }
+                    else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+                        if (p >= end) {
+                            throw std::runtime_error("Truncated qoi image");
+                        }
+                        const uint8_t b2 = *p++;
+                        const int vg = (b1 & 0x3f) - 32;
+                        px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+                        px.g += vg;
+                        px.b += vg - 8 + (b2 & 0x0f);
+                    }
+                    else {
+                        run = b1 & 0x3f;
+                    }
+                    index[QoiHash(px)] = px;
+                }
+
+                uint8_t* out = &image.pixels[i * 3];
+                out[0] = px.b;
+                out[1] = px.g;
+                out[2] = px.r;
+            }
+            return true;
+        }
+
+        return false;
+    }
+}
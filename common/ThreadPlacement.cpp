@@ -0,0 +1,308 @@
+#include "ThreadPlacement.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+namespace {
+
+    std::string Trim(const std::string& value)
+    {
+        const auto isSpace = [](char c) { return std::isspace(static_cast<unsigned char>(c)) != 0; };
+        const auto begin = std::find_if_not(value.begin(), value.end(), isSpace);
+        const auto end = std::find_if_not(value.rbegin(), value.rend(), isSpace).base();
+        return begin < end ? std::string(begin, end) : std::string();
+    }
+
+    bool ParseCoreNumber(const std::string& value, unsigned int& core)
+    {
+        if (value.empty() || value.size() > 6 || !std::all_of(value.begin(), value.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+            return false;
+        }
+        core = static_cast<unsigned int>(std::stoul(value));
+        return true;
+    }
+
+#ifdef _WIN32
+    const unsigned int coresPerGroup = 64;
+
+    // Returns false if the cores are not all in the same processor group
+    bool GetGroupAffinity(const thread_placement::CoreSet& cores, GROUP_AFFINITY& groupAffinity)
+    {
+        ZeroMemory(&groupAffinity, sizeof(groupAffinity));
+        groupAffinity.Group = static_cast<WORD>(cores.front() / coresPerGroup);
+        for (unsigned int core : cores) {
+            if (core / coresPerGroup != groupAffinity.Group) {
+                return false;
+            }
+            groupAffinity.Mask |= static_cast<KAFFINITY>(1) << (core % coresPerGroup);
+        }
+        return true;
+    }
+
+    int GetWindowsThreadPriority(thread_placement::Priority priority)
+    {
+        switch (priority) {
+        case thread_placement::Priority::Lowest: return THREAD_PRIORITY_LOWEST;
+        case thread_placement::Priority::BelowNormal: return THREAD_PRIORITY_BELOW_NORMAL;
+        case thread_placement::Priority::AboveNormal: return THREAD_PRIORITY_ABOVE_NORMAL;
+        case thread_placement::Priority::Highest: return THREAD_PRIORITY_HIGHEST;
+        default: return THREAD_PRIORITY_NORMAL;
+        }
+    }
+#elif defined(__linux__)
+    // Returns false if some core does not fit in a cpu_set_t
+    bool GetCpuSet(const thread_placement::CoreSet& cores, cpu_set_t& cpuSet)
+    {
+        CPU_ZERO(&cpuSet);
+        for (unsigned int core : cores) {
+            if (core >= CPU_SETSIZE) {
+                return false;
+            }
+            CPU_SET(core, &cpuSet);
+        }
+        return true;
+    }
+
+    // Raising the priority above normal needs CAP_SYS_NICE
+    int GetNiceValue(thread_placement::Priority priority)
+    {
+        switch (priority) {
+        case thread_placement::Priority::Lowest: return 10;
+        case thread_placement::Priority::BelowNormal: return 5;
+        case thread_placement::Priority::AboveNormal: return -5;
+        case thread_placement::Priority::Highest: return -10;
+        default: return 0;
+        }
+    }
+#endif
+}
+
+namespace thread_placement {
+
+    CoreSet ParseCoreSet(const std::string& value)
+    {
+        CoreSet cores;
+
+        if (Trim(value).empty()) {
+            return cores;
+        }
+
+        for (size_t begin = 0; begin <= value.size(); ) {
+            const size_t end = std::min(value.find(',', begin), value.size());
+            const std::string item = Trim(value.substr(begin, end - begin));
+            begin = end + 1;
+
+            if (item.empty()) {
+                throw std::runtime_error("Empty item in core list: \"" + value + "\"");
+            }
+
+            const size_t dash = item.find('-');
+            unsigned int first = 0, last = 0;
+            const bool valid = dash == std::string::npos
+                ? ParseCoreNumber(item, first) && ParseCoreNumber(item, last)
+                : ParseCoreNumber(Trim(item.substr(0, dash)), first) && ParseCoreNumber(Trim(item.substr(dash + 1)), last) && first <= last;
+
+            if (!valid) {
+                throw std::runtime_error("Unexpected item in core list: \"" + item + "\" (expected e.g. \"0-7,16-23\")");
+            }
+
+            for (unsigned int core = first; core <= last; ++core) {
+                cores.push_back(core);
+            }
+        }
+
+        std::sort(cores.begin(), cores.end());
+        cores.erase(std::unique(cores.begin(), cores.end()), cores.end());
+        return cores;
+    }
+
+    std::string FormatCoreSet(const CoreSet& cores)
+    {
+        std::string result;
+        for (size_t i = 0; i < cores.size(); ) {
+            size_t j = i;
+            while (j + 1 < cores.size() && cores[j + 1] == cores[j] + 1) {
+                ++j;
+            }
+            if (!result.empty()) {
+                result += ",";
+            }
+            result += std::to_string(cores[i]);
+            if (j > i) {
+                result += "-" + std::to_string(cores[j]);
+            }
+            i = j + 1;
+        }
+        return result;
+    }
+
+    CoreSet Intersect(const CoreSet& a, const CoreSet& b)
+    {
+        CoreSet result;
+        std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(result));
+        return result;
+    }
+
+    bool ParsePriority(const std::string& value, Priority& priority)
+    {
+        for (Priority candidate : { Priority::Lowest, Priority::BelowNormal, Priority::Normal, Priority::AboveNormal, Priority::Highest }) {
+            if (value == ToString(candidate)) {
+                priority = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string ToString(Priority priority)
+    {
+        switch (priority) {
+        case Priority::Lowest: return "lowest";
+        case Priority::BelowNormal: return "below-normal";
+        case Priority::AboveNormal: return "above-normal";
+        case Priority::Highest: return "highest";
+        default: return "normal";
+        }
+    }
+
+    bool ApplyToCurrentThread(const Placement& placement, size_t threadIndex)
+    {
+        CoreSet cores = placement.cores;
+        if (placement.onePerCore && !cores.empty()) {
+            cores = CoreSet{ cores[threadIndex % cores.size()] };
+        }
+
+#ifdef _WIN32
+        if (!cores.empty()) {
+            GROUP_AFFINITY groupAffinity;
+            if (!GetGroupAffinity(cores, groupAffinity) || !SetThreadGroupAffinity(GetCurrentThread(), &groupAffinity, NULL)) {
+                return false;
+            }
+        }
+        return placement.priority == Priority::Normal
+            || SetThreadPriority(GetCurrentThread(), GetWindowsThreadPriority(placement.priority)) != 0;
+#elif defined(__linux__)
+        if (!cores.empty()) {
+            cpu_set_t cpuSet;
+            if (!GetCpuSet(cores, cpuSet) || pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) != 0) {
+                return false;
+            }
+        }
+        // On Linux, the nice value is per thread
+        return placement.priority == Priority::Normal
+            || setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), GetNiceValue(placement.priority)) == 0;
+#else
+        return cores.empty() && placement.priority == Priority::Normal;
+#endif
+    }
+
+    bool RestrictProcess(const CoreSet& cores)
+    {
+        if (cores.empty()) {
+            return true;
+        }
+
+#ifdef _WIN32
+        // A process can be restricted to the first processor group only; beyond that, the
+        // threads need to be placed one by one
+        GROUP_AFFINITY groupAffinity;
+        return GetGroupAffinity(cores, groupAffinity) && groupAffinity.Group == 0
+            && SetProcessAffinityMask(GetCurrentProcess(), groupAffinity.Mask) != 0;
+#elif defined(__linux__)
+        // The threads started later inherit the affinity of the thread that starts them
+        cpu_set_t cpuSet;
+        return GetCpuSet(cores, cpuSet) && sched_setaffinity(0, sizeof(cpuSet), &cpuSet) == 0;
+#else
+        return false;
+#endif
+    }
+
+    int GetNumaNode(unsigned int core)
+    {
+#ifdef _WIN32
+        PROCESSOR_NUMBER processorNumber;
+        ZeroMemory(&processorNumber, sizeof(processorNumber));
+        processorNumber.Group = static_cast<WORD>(core / coresPerGroup);
+        processorNumber.Number = static_cast<BYTE>(core % coresPerGroup);
+        USHORT node = 0;
+        return GetNumaProcessorNodeEx(&processorNumber, &node) ? static_cast<int>(node) : -1;
+#elif defined(__linux__)
+        // The node of a cpu shows up as a link named e.g. node1 in its sysfs directory
+        const std::string directory = "/sys/devices/system/cpu/cpu" + std::to_string(core) + "/";
+        for (int node = 0; node < 1024; ++node) {
+            struct stat info;
+            if (stat((directory + "node" + std::to_string(node)).c_str(), &info) == 0) {
+                return node;
+            }
+        }
+        return -1;
+#else
+        return -1;
+#endif
+    }
+
+    CoreBudget ReadCoreBudget(const std::string& filename)
+    {
+        std::ifstream in(filename);
+        if (!in) {
+            throw std::runtime_error("Unable to read core budget file " + filename);
+        }
+
+        CoreBudget coreBudget;
+
+        std::string line;
+        for (size_t lineNumber = 1; std::getline(in, line); ++lineNumber) {
+            line = Trim(line);
+            if (line.empty() || line[0] == ';' || line[0] == '#' || line[0] == '[') {
+                continue;
+            }
+
+            const size_t equals = line.find('=');
+            const std::string service = equals == std::string::npos ? "" : Trim(line.substr(0, equals));
+            if (service.empty()) {
+                throw std::runtime_error(filename + ", line " + std::to_string(lineNumber) + ": expected e.g. \"FindThings = 12-23\"");
+            }
+            if (coreBudget.count(service)) {
+                throw std::runtime_error(filename + ", line " + std::to_string(lineNumber) + ": " + service + " listed twice");
+            }
+
+            try {
+                coreBudget[service] = ParseCoreSet(line.substr(equals + 1));
+            }
+            catch (std::exception& e) {
+                throw std::runtime_error(filename + ", line " + std::to_string(lineNumber) + ": " + e.what());
+            }
+        }
+
+        return coreBudget;
+    }
+
+    std::vector<std::string> FindOverlaps(const CoreBudget& coreBudget)
+    {
+        std::vector<std::string> overlaps;
+        for (auto i = coreBudget.begin(); i != coreBudget.end(); ++i) {
+            for (auto j = std::next(i); j != coreBudget.end(); ++j) {
+                const CoreSet shared = Intersect(i->second, j->second);
+                if (!shared.empty()) {
+                    overlaps.push_back(i->first + " and " + j->first + " share cores " + FormatCoreSet(shared));
+                }
+            }
+        }
+        return overlaps;
+    }
+}
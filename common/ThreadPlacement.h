@@ -0,0 +1,77 @@
+#pragma once
+
+// Pinning threads to cores, and setting their priority, so that the services running on the
+// same host can be kept out of each other's way.
+//
+// Cores are the logical processor numbers as the OS sees them, written as lists of numbers and
+// ranges, e.g. "0-7,16-23". On Windows, the numbers of 64 and above refer to the later processor
+// groups (group = number / 64), and a set of cores must stay within one group.
+//
+// The core budget is a file shared by the services, one line per service:
+//
+//   ; the cameras on the first socket, the inference on the second
+//   AlliedVision = 0-11
+//   FindThings = 12-23
+//
+// Each service restricts itself to its own cores, if it is listed. Lines starting with ';' or
+// '#', and [section] headers, are ignored.
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace thread_placement {
+
+    // Sorted, and with no duplicates
+    typedef std::vector<unsigned int> CoreSet;
+
+    typedef std::map<std::string, CoreSet> CoreBudget;
+
+    enum class Priority {
+        Lowest,
+        BelowNormal,
+        Normal,
+        AboveNormal,
+        Highest
+    };
+
+    // Where a thread should run, and at which priority
+    struct Placement {
+        CoreSet cores;                      // empty = wherever the OS likes
+        bool onePerCore = false;            // thread i gets only cores[i % cores.size()], instead of all the cores
+        Priority priority = Priority::Normal;
+    };
+
+    // An empty string gives an empty set; throws std::runtime_error if the string cannot be parsed
+    CoreSet ParseCoreSet(const std::string& value);
+
+    // The inverse of ParseCoreSet, e.g. "0-7,16-23"
+    std::string FormatCoreSet(const CoreSet& cores);
+
+    // The cores that are in both sets
+    CoreSet Intersect(const CoreSet& a, const CoreSet& b);
+
+    // Parses "lowest", "below-normal", "normal", "above-normal" or "highest"; returns false if
+    // the string is none of these
+    bool ParsePriority(const std::string& value, Priority& priority);
+
+    std::string ToString(Priority priority);
+
+    // Returns false if the cores or the priority cannot be set (e.g. the cores do not exist, or
+    // raising the priority needs privileges that the process does not have). threadIndex matters
+    // only if placement.onePerCore is set.
+    bool ApplyToCurrentThread(const Placement& placement, size_t threadIndex = 0);
+
+    // Restricts the whole process, including the threads that libraries start later; returns
+    // false if not possible. Call early, before starting any threads.
+    bool RestrictProcess(const CoreSet& cores);
+
+    // The NUMA node of the core, or -1 if not known
+    int GetNumaNode(unsigned int core);
+
+    // Throws std::runtime_error if the file cannot be read or parsed
+    CoreBudget ReadCoreBudget(const std::string& filename);
+
+    // E.g. "AlliedVision and FindThings share cores 6-7"; empty if no two services overlap
+    std::vector<std::string> FindOverlaps(const CoreBudget& coreBudget);
+}
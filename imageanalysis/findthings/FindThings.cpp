@@ -7,6 +7,9 @@
 #include "../../lib/annonet/annonet_things/annonet_infer.h"
 #include "../../lib/annonet/annonet_things/annonet_parse_anno_classes.h"
 
+#include "../../common/ImageFormats.h"
+#include "../../common/ThreadPlacement.h"
+
 #include "dlib/image_loader/load_image.h"
 
 #include "rapidjson/stringbuffer.h"
@@ -109,10 +112,42 @@ int main(int argc, char* argv[])
 
             claim::PostOffice postOffice;
             postOffice.Initialize(iniFile, "FT");
-            postOffice.Subscribe("Image");
+
+            const std::string imageMessageType = iniFile.GetSetValue("Input", "ImageMessageType", "Image", "Which images to analyze - try \"Image\", or \"ImagePreview\" for the downscaled ones (if sent)");
+            postOffice.Subscribe(imageMessageType);
 
             const std::string modelFilename = iniFile.GetSetValue("AnnonetModel", "Filename", "annonet.dnn");
 
+            // Set up before any threads are started (e.g. by dlib or the BLAS library), so that they inherit the cores
+            const std::string coreBudgetFile = iniFile.GetSetValue("Threading", "CoreBudgetFile", "", "A file shared with the other services on this host (e.g. AlliedVision), with lines like \"FindThings = 12-23\"; empty = no budget");
+            const std::string coreBudgetName = iniFile.GetSetValue("Threading", "CoreBudgetName", "FindThings", "The name of this service in CoreBudgetFile");
+            const std::string priorityString = iniFile.GetSetValue("Threading", "Priority", "normal", "Of the thread running the inference - try \"lowest\", \"below-normal\", \"normal\", \"above-normal\", or \"highest\"");
+
+            thread_placement::Placement placement;
+            if (!coreBudgetFile.empty()) {
+                const thread_placement::CoreBudget coreBudget = thread_placement::ReadCoreBudget(coreBudgetFile);
+                for (const std::string& overlap : thread_placement::FindOverlaps(coreBudget)) {
+                    numcfc::Logger::LogAndEcho("Core budget " + coreBudgetFile + ": " + overlap, "log_errors");
+                }
+                const auto i = coreBudget.find(coreBudgetName);
+                if (i == coreBudget.end() || i->second.empty()) {
+                    numcfc::Logger::LogAndEcho("Core budget " + coreBudgetFile + ": no cores for " + coreBudgetName + " (not restricting)", "log_errors");
+                }
+                else if (thread_placement::RestrictProcess(i->second)) {
+                    numcfc::Logger::LogAndEcho("Core budget: cores " + thread_placement::FormatCoreSet(i->second));
+                }
+                else {
+                    numcfc::Logger::LogAndEcho("Unable to restrict the process to cores " + thread_placement::FormatCoreSet(i->second) + " (placing the main thread only)", "log_errors");
+                    placement.cores = i->second;
+                }
+            }
+            if (!thread_placement::ParsePriority(priorityString, placement.priority)) {
+                numcfc::Logger::LogAndEcho("Unexpected thread priority: " + priorityString + " (using normal)", "log_errors");
+            }
+            if (!thread_placement::ApplyToCurrentThread(placement)) {
+                numcfc::Logger::LogAndEcho("Unable to place the main thread on cores " + thread_placement::FormatCoreSet(placement.cores) + " with priority " + thread_placement::ToString(placement.priority), "log_errors");
+            }
+
 #if 0
             const int min_input_dimension = NetPimpl::TrainingNet::GetRequiredInputDimension();
 #else
@@ -192,6 +227,7 @@ int main(int argc, char* argv[])
             iniFile.Refresh();
 
             NetPimpl::input_type inputImage;
+            image_formats::Image decodedImage;
             std::vector<dlib::mmod_rect> labels;
 
             numcfc::Logger::LogAndEcho("Ready, now waiting for images...");
@@ -211,24 +247,44 @@ int main(int argc, char* argv[])
                     timeout_s = 0.0;
                 }
 
-                if (msgLastReceived.m_type == "Image") {
+                if (msgLastReceived.m_type == imageMessageType) {
                     claim::AttributeMessage amsg(msgLastReceived);
                     const auto& data = amsg.m_attributes["data"];
                     if (!data.empty()) {
                         const std::string& imageId = amsg.m_attributes["id"];
 
-                        // TODO: avoid going via a file
-
                         const auto t0 = std::chrono::system_clock::now();
-                        {
-                            std::ofstream out(imageId, std::ios::binary);
-                            out << data;
-                        }
+
+                        // The raw and qoi formats can be decoded directly from memory
+                        const bool decoded = image_formats::Decode(data.data(), data.size(), decodedImage);
+
                         const auto t1 = std::chrono::system_clock::now();
 
-                        dlib::load_image(inputImage, imageId);
+                        if (decoded) {
+                            inputImage.set_size(decodedImage.height, decodedImage.width);
+                            const uint8_t* pixel = decodedImage.pixels.data();
+                            for (long r = 0; r < inputImage.nr(); ++r) {
+                                for (long c = 0; c < inputImage.nc(); ++c, pixel += decodedImage.channels) {
+                                    if (decodedImage.channels == 1) {
+                                        dlib::assign_pixel(inputImage(r, c), pixel[0]);
+                                    }
+                                    else {
+                                        dlib::assign_pixel(inputImage(r, c), dlib::rgb_pixel(pixel[2], pixel[1], pixel[0]));
+                                    }
+                                }
+                            }
+                        }
+                        else {
+                            // TODO: avoid going via a file
+                            {
+                                std::ofstream out(imageId, std::ios::binary);
+                                out << data;
+                            }
+
+                            dlib::load_image(inputImage, imageId);
 
-                        std::remove(imageId.c_str());
+                            std::remove(imageId.c_str());
+                        }
 
                         if (!firstImageReceived) {
                             numcfc::Logger::LogAndEcho("First image received, size = " + std::to_string(inputImage.nc()) + " x " + std::to_string(inputImage.nr()) + " (" + std::to_string(data.size()) + " bytes)");
@@ -241,6 +297,20 @@ int main(int argc, char* argv[])
 
                         const auto t3 = std::chrono::system_clock::now();
 
+                        // If the image is a preview, then report the results in full-size image coordinates
+                        const std::string& previewScaleString = amsg.m_attributes["previewScale"];
+                        const double previewScale = previewScaleString.empty() ? 1.0 : std::stod(previewScaleString);
+                        if (previewScale > 0.0 && previewScale != 1.0) {
+                            for (auto& label : labels) {
+                                label.rect = dlib::rectangle(
+                                    std::lround(label.rect.left() / previewScale),
+                                    std::lround(label.rect.top() / previewScale),
+                                    std::lround(label.rect.right() / previewScale),
+                                    std::lround(label.rect.bottom() / previewScale)
+                                );
+                            }
+                        }
+
                         const auto formatMilliseconds = [](const auto& duration) {
                             return std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count());
                         };
@@ -251,11 +321,27 @@ int main(int argc, char* argv[])
                             + formatMilliseconds(t2 - t1) + " + "
                             + formatMilliseconds(t3 - t2) + " ms", "log_find_things");
 
+                        // So that the results can be mapped to sensor coordinates, if only a region of interest was sent
+                        std::map<std::string, std::string> sensorMappingAttributes;
+                        for (const char* attributeName : { "offsetX", "offsetY", "scale" }) {
+                            const auto i = amsg.m_attributes.find(attributeName);
+                            if (i != amsg.m_attributes.end()) {
+                                sensorMappingAttributes[attributeName] = i->second;
+                            }
+                        }
+                        if (previewScale > 0.0 && previewScale != 1.0 && sensorMappingAttributes.count("scale")) {
+                            // The results are in full-size image coordinates
+                            sensorMappingAttributes["scale"] = std::to_string(std::stod(sensorMappingAttributes["scale"]) / previewScale);
+                        }
+
                         claim::AttributeMessage amsg;
                         amsg.m_type = "AnnoResultJson";
                         amsg.m_attributes["id"] = imageId + "_result_path.json";
                         amsg.m_attributes["image_id"] = imageId;
                         amsg.m_attributes["data"] = format_anno_results(labels, anno_classes);
+                        for (const auto& attribute : sensorMappingAttributes) {
+                            amsg.m_attributes[attribute.first] = attribute.second;
+                        }
                         amsg.m_attributes["timestamp"] = amsg.m_attributes["timestamp"];
                         postOffice.Send(amsg);
 
@@ -1,4 +1,5 @@
 #include "../../lib/system_clock_time_point_string_conversion/system_clock_time_point_string_conversion.h"
+#include "../../common/ImageFormats.h"
 
 #include <messaging/claim/PostOffice.h>
 #include <messaging/claim/AttributeMessage.h>
@@ -7,7 +8,7 @@
 #include <numcfc/Logger.h>
 
 #include <opencv2/imgcodecs/imgcodecs.hpp>
-#include <opencv2/imgproc/imgproc.hpp> // cv::putText
+#include <opencv2/imgproc/imgproc.hpp> // cv::putText, cv::cvtColor
 #include <opencv2/highgui/highgui.hpp>
 
 #include "../../lib/nlohmann_json/single_include/nlohmann/json.hpp"
@@ -18,7 +19,9 @@ int main(int argc, char* argv[])
 
     claim::PostOffice postOffice;
     postOffice.Initialize(iniFile, "IV");
-    postOffice.Subscribe("Image");
+
+    const std::string imageMessageType = iniFile.GetSetValue("Input", "ImageMessageType", "Image", "Which images to show - try \"Image\", or \"ImagePreview\" for the downscaled ones (if sent)");
+    postOffice.Subscribe(imageMessageType);
     postOffice.Subscribe("AnnoResultJson");
 
     if (iniFile.IsDirty()) {
@@ -27,7 +30,9 @@ int main(int argc, char* argv[])
 
     std::string currentImageId;
     cv::Mat currentImage;
+    double currentImagePreviewScale = 1.0; // the results are in full-size image coordinates
     std::chrono::system_clock::time_point currentImageReceived;
+    image_formats::Image decodedImage;
 
     const auto putText = [&currentImage](const std::string& text, const cv::Point& origin) {
         cv::putText(currentImage, text, origin, cv::FONT_HERSHEY_PLAIN, 1.0, cv::Scalar(0, 0, 0), 3);
@@ -39,7 +44,7 @@ int main(int argc, char* argv[])
 
         double timeout_s = 1.0;
         while (postOffice.Receive(msg, timeout_s)) {
-            if (msg.GetType() == "Image") {
+            if (msg.GetType() == imageMessageType) {
                 msgImageLastReceived = msg;
                 timeout_s = 0.0;
             }
@@ -68,8 +73,8 @@ int main(int argc, char* argv[])
 
                             for (const auto& point : colorPath) {
                                 contour.emplace_back(
-                                    point["x"].get<int>(),
-                                    point["y"].get<int>()
+                                    static_cast<int>(std::round(point["x"].get<int>() * currentImagePreviewScale)),
+                                    static_cast<int>(std::round(point["y"].get<int>() * currentImagePreviewScale))
                                 );
                             }
                             contours.push_back(contour);
@@ -95,15 +100,28 @@ int main(int argc, char* argv[])
             }
         }
 
-        if (msgImageLastReceived.m_type == "Image") {
+        if (msgImageLastReceived.m_type == imageMessageType) {
             const auto now = std::chrono::system_clock::now();
             claim::AttributeMessage amsg(msgImageLastReceived);
             const auto& data = amsg.m_attributes["data"];
             if (!data.empty()) {
-                const std::vector<unsigned char> buffer(data.begin(), data.end());
-                currentImage = cv::imdecode(buffer, cv::IMREAD_COLOR);
+                if (image_formats::Decode(data.data(), data.size(), decodedImage)) {
+                    const cv::Mat decoded(decodedImage.height, decodedImage.width, CV_8UC(decodedImage.channels), decodedImage.pixels.data());
+                    if (decodedImage.channels == 1) {
+                        cv::cvtColor(decoded, currentImage, cv::COLOR_GRAY2BGR); // so that the results can be drawn in color
+                    }
+                    else {
+                        decoded.copyTo(currentImage);
+                    }
+                }
+                else {
+                    const std::vector<unsigned char> buffer(data.begin(), data.end());
+                    currentImage = cv::imdecode(buffer, cv::IMREAD_COLOR);
+                }
                 if (!currentImage.empty()) {
                     currentImageId = amsg.m_attributes["id"];
+                    const auto& previewScale = amsg.m_attributes["previewScale"];
+                    currentImagePreviewScale = previewScale.empty() ? 1.0 : std::stod(previewScale);
                     currentImageReceived = now;
                     putText(currentImageId, cv::Point(10, 20));
                     const auto& timestamp = amsg.m_attributes["timestamp"];